@@ -28,7 +28,9 @@ void main() {
     vec3 lightPos = uPointLights[0].posRad.xyz;
     vec3 lightColor = uPointLights[0].color;
 
-    vec3 norm = normalize(texture(samplerNormal, oTexCoord).rgb * 2.0 - 1.0);
+    // Normal maps may be two-channel (BC5), z is rebuilt from xy
+    vec2 normXY = texture(samplerNormal, oTexCoord).rg * 2.0 - 1.0;
+    vec3 norm = vec3(normXY, sqrt(max(1.0 - dot(normXY, normXY), 0.0)));
 
     vec3 lightDir = normalize(oTBN * lightPos - oTBN * oFragPos);
     float diff = max(dot(norm, lightDir), 0.0);
@@ -3,32 +3,51 @@
 layout(std140, set = 1, binding = 0) uniform Projection {
     mat4 uProj;
 };
-layout(std140, set = 1, binding = 1) uniform Model {
-    mat4 uModel;
-};
-layout(std140, set = 1, binding = 2) uniform View {
+layout(std140, set = 1, binding = 1) uniform View {
     mat4 uView;
 };
 
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec3 aTangent;
-layout (location = 3) in vec2 aTexCoord;
+// Renderer::Vertex of all meshes, 11 floats each: pos, normal, tangent, texCoord
+layout(std430, set = 0, binding = 0) readonly buffer Vertices {
+    float vVertices[];
+};
+
+// Renderer::DrawData, indexed by the first_instance of the draw's commands
+struct DrawData {
+    mat4 model;
+    uint vertexOffset;
+    uint materialLayers[3];
+};
+layout(std430, set = 0, binding = 1) readonly buffer Draws {
+    DrawData vDraws[];
+};
 
 layout (location = 0) out vec2 oTexCoord;
 layout (location = 1) out vec3 oFragPos;
 layout (location = 2) out mat3 oTBN;
+layout (location = 5) flat out uvec3 oMaterialLayers; // Used by basic_array.frag
 
 layout(location = 0) out gl_PerVertex {
     vec4 gl_Position;
 };
 
+vec3 LoadVec3(uint i) {
+    return vec3(vVertices[i], vVertices[i + 1], vVertices[i + 2]);
+}
+
 void main() {
-    gl_Position = uProj * uView * uModel * vec4(aPos, 1.0);
+    DrawData draw = vDraws[gl_InstanceIndex];
+    uint base = (draw.vertexOffset + uint(gl_VertexIndex)) * 11;
+    vec3 aPos      = LoadVec3(base);
+    vec3 aNormal   = LoadVec3(base + 3);
+    vec3 aTangent  = LoadVec3(base + 6);
+    vec2 aTexCoord = vec2(vVertices[base + 9], vVertices[base + 10]);
+
+    gl_Position = uProj * uView * draw.model * vec4(aPos, 1.0);
     oTexCoord = aTexCoord;
     oFragPos = gl_Position.xyz;
 
-    mat3 normalMatrix = transpose(inverse(mat3(uModel)));
+    mat3 normalMatrix = transpose(inverse(mat3(draw.model)));
     normalMatrix = mat3(1);
     vec3 T = normalize(normalMatrix * aTangent);
     vec3 N = normalize(normalMatrix * aNormal);
@@ -36,4 +55,5 @@ void main() {
     vec3 B = cross(N, T);
 
     oTBN = transpose(mat3(T, B, N));
+    oMaterialLayers = uvec3(draw.materialLayers[0], draw.materialLayers[1], draw.materialLayers[2]);
 }
@@ -0,0 +1,45 @@
+#version 450
+
+// Variant of basic.frag for batched materials: the textures are layers of texture arrays
+
+#define MAX_POINT_LIGHT_NUM 1024
+
+layout (location = 0) in vec2 oTexCoord;
+layout (location = 1) in vec3 oFragPos;
+layout (location = 2) in mat3 oTBN;
+layout (location = 5) flat in uvec3 oMaterialLayers; // Albedo, normal, ARM
+
+layout (location = 0) out vec4 FragColor;
+
+layout (set = 2, binding = 0) uniform sampler2DArray samplerAlbedo;
+layout (set = 2, binding = 1) uniform sampler2DArray samplerNormal;
+layout (set = 2, binding = 2) uniform sampler2DArray samplerARM;
+
+struct PointLight {
+    vec4 posRad;
+    vec3 color;
+};
+
+layout(std140, set = 2, binding = 3) buffer FrameData {
+    vec3       uCamPos;
+    vec3       uDirLight;
+    uint       uPointLightNum;
+    PointLight uPointLights[MAX_POINT_LIGHT_NUM];
+};
+
+void main() {
+    vec3 lightPos = uPointLights[0].posRad.xyz;
+    vec3 lightColor = uPointLights[0].color;
+
+    // Normal maps may be two-channel (BC5), z is rebuilt from xy
+    vec2 normXY = texture(samplerNormal, vec3(oTexCoord, oMaterialLayers.y)).rg * 2.0 - 1.0;
+    vec3 norm = vec3(normXY, sqrt(max(1.0 - dot(normXY, normXY), 0.0)));
+
+    vec3 lightDir = normalize(oTBN * lightPos - oTBN * oFragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * lightColor;
+
+    vec3 result = diffuse * texture(samplerAlbedo, vec3(oTexCoord, oMaterialLayers.x)).xyz;
+    FragColor = vec4(result, 1.0);
+}
+
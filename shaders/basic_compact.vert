@@ -0,0 +1,64 @@
+#version 450
+
+// Variant of basic.vert for Renderer::CompactVertex. The position dequantization
+// (mesh bounds) is folded into the model matrix of the draw on the CPU side.
+
+layout(std140, set = 1, binding = 0) uniform Projection {
+    mat4 uProj;
+};
+layout(std140, set = 1, binding = 1) uniform View {
+    mat4 uView;
+};
+
+// Renderer::CompactVertex of all meshes, 5 words each
+layout(std430, set = 0, binding = 0) readonly buffer Vertices {
+    uint vVertices[];
+};
+
+// Renderer::DrawData, indexed by the first_instance of the draw's commands
+struct DrawData {
+    mat4 model;
+    uint vertexOffset;
+    uint materialLayers[3];
+};
+layout(std430, set = 0, binding = 1) readonly buffer Draws {
+    DrawData vDraws[];
+};
+
+layout (location = 0) out vec2 oTexCoord;
+layout (location = 1) out vec3 oFragPos;
+layout (location = 2) out mat3 oTBN;
+layout (location = 5) flat out uvec3 oMaterialLayers; // Used by basic_array.frag
+
+layout(location = 0) out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+vec3 OctDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main() {
+    DrawData draw = vDraws[gl_InstanceIndex];
+    uint base = (draw.vertexOffset + uint(gl_VertexIndex)) * 5;
+    vec3 aPos      = vec3(unpackUnorm2x16(vVertices[base]), unpackUnorm2x16(vVertices[base + 1]).x); // UNORM16
+    vec2 aNormal   = unpackSnorm2x16(vVertices[base + 2]); // Octahedral SNORM16
+    vec2 aTangent  = unpackSnorm2x16(vVertices[base + 3]); // Octahedral SNORM16
+    vec2 aTexCoord = unpackHalf2x16(vVertices[base + 4]);  // Half floats
+
+    gl_Position = uProj * uView * draw.model * vec4(aPos, 1.0);
+    oTexCoord = aTexCoord;
+    oFragPos = gl_Position.xyz;
+
+    vec3 T = OctDecode(aTangent);
+    vec3 N = OctDecode(aNormal);
+    T = normalize(T - dot(T, N) * N);
+    vec3 B = cross(N, T);
+
+    oTBN = transpose(mat3(T, B, N));
+    oMaterialLayers = uvec3(draw.materialLayers[0], draw.materialLayers[1], draw.materialLayers[2]);
+}
@@ -0,0 +1,139 @@
+#include "arena.h"
+
+#include "pch.h"
+
+namespace {
+
+thread_local ArenaScope* s_pCurrentScope = nullptr;
+
+Arena& GetScratchArena() {
+    static thread_local Arena scratchArena(4 * 1024 * 1024);
+    return scratchArena;
+}
+
+u64 AlignUp(u64 value, u64 alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+}
+
+Arena::Arena(u64 blockSize) : m_blockSize(blockSize) {}
+
+Arena::Arena(BlockAllocator allocateBlock) : m_blockSize(0), m_allocateBlock(std::move(allocateBlock)) {}
+
+Arena::~Arena() {
+    if (m_allocateBlock)
+        return;
+    for (Block& block : m_blocks)
+        SDL_free(block.pData);
+}
+
+void* Arena::Allocate(u64 size, u64 alignment) {
+    SDL_assert((alignment & (alignment - 1)) == 0 && alignment <= 16);
+    std::lock_guard lock(m_mutex);
+
+    // SDL_malloc and mapped blocks are 16 byte aligned, so aligning the offset aligns the pointer
+    if (m_blockIdx < m_blocks.size()) {
+        const u64 offset = AlignUp(m_offset, alignment);
+        if (offset + size <= m_blocks[m_blockIdx].size) {
+            m_offset = offset + size;
+            return m_blocks[m_blockIdx].pData + offset;
+        }
+    }
+
+    // Later blocks are free after a rewind, oversized requests get a block of their own
+    u32 blockIdx = m_blocks.empty() ? 0 : m_blockIdx + 1;
+    while (blockIdx < m_blocks.size() && m_blocks[blockIdx].size < size)
+        blockIdx++;
+    if (blockIdx == m_blocks.size()) {
+        const u64 blockSize = std::max(m_blockSize, size);
+        u8* pData = (u8*)(m_allocateBlock ? m_allocateBlock(blockSize) : SDL_malloc(blockSize));
+        if (pData == nullptr)
+            FatalError("Arena is out of memory");
+        m_blocks.push_back({ pData, blockSize });
+    }
+
+    m_blockIdx = blockIdx;
+    m_offset   = size;
+    return m_blocks[blockIdx].pData;
+}
+
+bool Arena::Owns(const void* p) const {
+    std::lock_guard lock(m_mutex);
+    for (const Block& block : m_blocks) {
+        if ((const u8*)p >= block.pData && (const u8*)p < block.pData + block.size)
+            return true;
+    }
+    return false;
+}
+
+Arena::Marker Arena::GetMarker() const {
+    std::lock_guard lock(m_mutex);
+    return { m_blockIdx, m_offset };
+}
+
+void Arena::Rewind(const Marker& marker) {
+    std::lock_guard lock(m_mutex);
+    m_blockIdx = marker.blockIdx;
+    m_offset   = marker.offset;
+}
+
+void Arena::Reset() {
+    Rewind({});
+}
+
+u64 Arena::GetReservedSize() const {
+    std::lock_guard lock(m_mutex);
+    u64 size = 0;
+    for (const Block& block : m_blocks)
+        size += block.size;
+    return size;
+}
+
+ArenaScope::ArenaScope(Arena& arena) : m_arena(arena), m_pPrevious(s_pCurrentScope) {
+    s_pCurrentScope = this;
+}
+
+ArenaScope::~ArenaScope() {
+    s_pCurrentScope = m_pPrevious;
+}
+
+Arena* ArenaScope::GetCurrent() {
+    return s_pCurrentScope != nullptr ? &s_pCurrentScope->m_arena : nullptr;
+}
+
+ScratchScope::ScratchScope() : m_arena(GetScratchArena()), m_marker(m_arena.GetMarker()), m_scope(m_arena) {}
+
+ScratchScope::~ScratchScope() {
+    m_arena.Rewind(m_marker);
+}
+
+void* ScopedAlloc(u64 size) {
+    if (Arena* pArena = ArenaScope::GetCurrent())
+        return pArena->Allocate(size);
+    return SDL_malloc(size);
+}
+
+void* ScopedRealloc(void* p, u64 oldSize, u64 newSize) {
+    Arena* pArena = ArenaScope::GetCurrent();
+    if (pArena == nullptr)
+        return SDL_realloc(p, newSize);
+
+    // Arenas cannot grow in place, the old copy stays until the arena is reset
+    void* pNew = pArena->Allocate(newSize);
+    if (p != nullptr) {
+        SDL_memcpy(pNew, p, std::min(oldSize, newSize));
+        ScopedFree(p);
+    }
+    return pNew;
+}
+
+void ScopedFree(void* p) {
+    if (p == nullptr)
+        return;
+    for (const ArenaScope* pScope = s_pCurrentScope; pScope != nullptr; pScope = pScope->m_pPrevious) {
+        if (pScope->m_arena.Owns(p))
+            return;
+    }
+    SDL_free(p);
+}
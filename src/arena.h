@@ -0,0 +1,81 @@
+#pragma once
+
+#include "pch.h"
+#include <mutex>
+
+// Bump allocator over a chain of large blocks. Single allocations are never freed:
+// Rewind() drops everything allocated after a marker and Reset() everything, while
+// the blocks are kept for reuse until destruction. Allocation is thread-safe.
+class Arena {
+public:
+    struct Marker {
+        u32 blockIdx = 0;
+        u64 offset   = 0;
+    };
+
+    // Blocks from allocateBlock instead of SDL_malloc, one per allocation that does not fit and
+    // never freed by the arena; e.g. mapped GPU transfer memory, see Renderer::CreateStagingBuffer()
+    using BlockAllocator = std::function<void*(u64 size)>;
+
+    explicit Arena(u64 blockSize = 16 * 1024 * 1024);
+    explicit Arena(BlockAllocator allocateBlock);
+    Arena(const Arena&) = delete;
+    void operator=(const Arena&) = delete;
+    ~Arena();
+    void* Allocate(u64 size, u64 alignment = 16);
+    bool Owns(const void* p) const;
+    Marker GetMarker() const;
+    void Rewind(const Marker& marker);
+    void Reset();
+    u64 GetReservedSize() const; // Bytes of all blocks
+private:
+    struct Block {
+        u8* pData;
+        u64 size;
+    };
+
+    u64             m_blockSize;
+    BlockAllocator  m_allocateBlock;
+    vector<Block>   m_blocks;
+    u32             m_blockIdx = 0;
+    u64             m_offset   = 0;
+    mutable std::mutex m_mutex;
+};
+
+// Binds an arena to the calling thread for its lifetime; scopes nest. Allocations made
+// through ScopedAlloc() go to the innermost bound arena, which is how stb_image
+// (STBI_MALLOC hooks in pch.cpp), the texture loaders and the compressor hand their
+// pixels to whoever owns the load
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& arena);
+    ArenaScope(const ArenaScope&) = delete;
+    void operator=(const ArenaScope&) = delete;
+    ~ArenaScope();
+    static Arena* GetCurrent();
+private:
+    friend void ScopedFree(void* p);
+
+    Arena&      m_arena;
+    ArenaScope* m_pPrevious;
+};
+
+// Per-thread frame allocator for temporaries of one decode step: binds the thread's
+// scratch arena and rewinds it on exit. Jobs run while waiting nest like scopes do
+class ScratchScope {
+public:
+    ScratchScope();
+    ScratchScope(const ScratchScope&) = delete;
+    void operator=(const ScratchScope&) = delete;
+    ~ScratchScope();
+private:
+    Arena&        m_arena;
+    Arena::Marker m_marker;
+    ArenaScope    m_scope;
+};
+
+// The arena bound to the calling thread, SDL_malloc without one. Frees of memory owned by any
+// arena bound to the thread are no-ops
+void* ScopedAlloc(u64 size);
+void* ScopedRealloc(void* p, u64 oldSize, u64 newSize);
+void ScopedFree(void* p);
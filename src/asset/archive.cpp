@@ -0,0 +1,253 @@
+#include "archive.h"
+
+#include "../pch.h"
+#include "../hash.h"
+#include "../job_system.h"
+#include "file_system.h"
+#include "lz4.h"
+#include <atomic>
+
+namespace {
+
+u64 AlignUp(u64 value, u64 alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+u64 HashPath(const string& genericPath) {
+    return HashBytes(genericPath.data(), genericPath.size());
+}
+
+}
+
+bool Archive::Open(const string& path) {
+    if (!m_file.Open(path))
+        return false;
+
+    Header header;
+    if (m_file.GetSize() < sizeof(header)) {
+        m_file.Close();
+        return false;
+    }
+    SDL_memcpy(&header, m_file.GetData(), sizeof(header));
+    const bool valid =
+        header.magic == ARCHIVE_MAGIC &&
+        header.version == ARCHIVE_VERSION &&
+        header.indexOffset % alignof(Entry) == 0 &&
+        header.pathsOffset >= sizeof(header) &&
+        header.pathsOffset <= header.indexOffset &&
+        header.indexOffset + (u64)header.entryNum * sizeof(Entry) <= m_file.GetSize();
+    if (!valid) {
+        SDL_Log("Invalid archive: %s", path.c_str());
+        m_file.Close();
+        return false;
+    }
+
+    // Paths of every entry lie in the paths section, Find() reads them unchecked
+    const Entry* pEntries = (const Entry*)(m_file.GetData() + header.indexOffset);
+    const u64 pathsSize = header.indexOffset - header.pathsOffset;
+    for (u32 i = 0; i < header.entryNum; i++) {
+        if ((u64)pEntries[i].pathOffset + pEntries[i].pathLength > pathsSize) {
+            SDL_Log("Invalid archive: %s", path.c_str());
+            m_file.Close();
+            return false;
+        }
+    }
+
+    m_pEntries  = pEntries;
+    m_entryNum  = header.entryNum;
+    m_pPaths    = (const char*)m_file.GetData() + header.pathsOffset;
+    m_pathsSize = pathsSize;
+    return true;
+}
+
+bool Archive::Contains(const string& path) const {
+    return Find(path) != nullptr;
+}
+
+bool Archive::Read(const string& path, FileBuffer& buffer) const {
+    const Entry* pEntry = Find(path);
+    if (pEntry == nullptr)
+        return false;
+
+    const u64 tableSize = AlignUp((u64)pEntry->blockNum * sizeof(u32), ARCHIVE_ALIGNMENT);
+    if (pEntry->dataOffset + tableSize > m_file.GetSize())
+        return false;
+
+    // Block offsets inside the archive; each block is ARCHIVE_BLOCK_SIZE of output except the last
+    const u8* pTable = m_file.GetData() + pEntry->dataOffset;
+    vector<u64> blockOffsets(pEntry->blockNum + 1);
+    blockOffsets[0] = pEntry->dataOffset + tableSize;
+    bool allRaw = true;
+    for (u32 i = 0; i < pEntry->blockNum; i++) {
+        u32 blockSize;
+        SDL_memcpy(&blockSize, pTable + i * sizeof(u32), sizeof(blockSize));
+        allRaw = allRaw && (blockSize & ARCHIVE_RAW_BLOCK);
+        blockOffsets[i + 1] = blockOffsets[i] + (blockSize & ~ARCHIVE_RAW_BLOCK);
+    }
+    if (blockOffsets.back() > m_file.GetSize())
+        return false;
+
+    // Raw blocks are contiguous, nothing to copy
+    if (allRaw) {
+        if (blockOffsets.back() - blockOffsets[0] != pEntry->size)
+            return false;
+        buffer.SetView(m_file.GetData() + blockOffsets[0], pEntry->size);
+        return true;
+    }
+
+    u8* pData = buffer.Allocate(pEntry->size);
+    std::atomic<bool> succeeded = true;
+    JobSystem::GetInstance().ParallelFor(pEntry->blockNum, 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            const u64 outOffset = (u64)i * ARCHIVE_BLOCK_SIZE;
+            const u64 outSize = std::min<u64>(ARCHIVE_BLOCK_SIZE, pEntry->size - std::min(outOffset, pEntry->size));
+            const u8* pBlock = m_file.GetData() + blockOffsets[i];
+            const u64 blockSize = blockOffsets[i + 1] - blockOffsets[i];
+
+            u32 storedSize;
+            SDL_memcpy(&storedSize, pTable + i * sizeof(u32), sizeof(storedSize));
+            if (storedSize & ARCHIVE_RAW_BLOCK) {
+                if (blockSize != outSize)
+                    succeeded = false;
+                else
+                    SDL_memcpy(pData + outOffset, pBlock, outSize);
+            }
+            else if (!Lz4Decompress(pBlock, blockSize, pData + outOffset, outSize)) {
+                succeeded = false;
+            }
+        }
+    });
+    if (!succeeded) {
+        SDL_Log("Corrupt archive entry: %s", path.c_str());
+        buffer.Reset();
+        return false;
+    }
+    return true;
+}
+
+u32 Archive::GetEntryNum() const {
+    return m_entryNum;
+}
+
+const Archive::Entry* Archive::Find(const string& path) const {
+    const string genericPath = GetGenericPath(path);
+    const u64 hash = HashPath(genericPath);
+
+    const Entry* pEnd = m_pEntries + m_entryNum;
+    const Entry* pEntry = std::lower_bound(m_pEntries, pEnd, hash, [](const Entry& entry, u64 hash) {
+        return entry.pathHash < hash;
+    });
+    // Equal hashes are told apart by the stored path
+    for (; pEntry != pEnd && pEntry->pathHash == hash; pEntry++) {
+        SDL_assert((u64)pEntry->pathOffset + pEntry->pathLength <= m_pathsSize);
+        if (std::string_view(m_pPaths + pEntry->pathOffset, pEntry->pathLength) == genericPath)
+            return pEntry;
+    }
+    return nullptr;
+}
+
+bool WriteArchive(const string& archivePath, const string& rootDirectory, const vector<string>& relativePaths) {
+    struct PackedEntry {
+        Archive::Entry entry;
+        string         path;
+        vector<u8>     data; // Block table and blocks
+    };
+    vector<PackedEntry> entries(relativePaths.size());
+
+    std::atomic<bool> succeeded = true;
+    JobSystem::GetInstance().ParallelFor(relativePaths.size(), 1, [&](u32 begin, u32 end) {
+        for (u32 fileIdx = begin; fileIdx < end; fileIdx++) {
+            PackedEntry& packed = entries[fileIdx];
+            packed.path = GetGenericPath(relativePaths[fileIdx]);
+
+            FileBuffer file;
+            if (!file.Map(rootDirectory + "/" + packed.path)) {
+                SDL_Log("Could not pack %s", packed.path.c_str());
+                succeeded = false;
+                continue;
+            }
+
+            const u32 blockNum = (file.GetSize() + ARCHIVE_BLOCK_SIZE - 1) / ARCHIVE_BLOCK_SIZE;
+            vector<vector<u8>> blocks(blockNum);
+            vector<u32> blockSizes(blockNum);
+            JobSystem::GetInstance().ParallelFor(blockNum, 1, [&](u32 blockBegin, u32 blockEnd) {
+                for (u32 i = blockBegin; i < blockEnd; i++) {
+                    const u8* pRaw = file.GetData() + (u64)i * ARCHIVE_BLOCK_SIZE;
+                    const u64 rawSize = std::min<u64>(ARCHIVE_BLOCK_SIZE, file.GetSize() - (u64)i * ARCHIVE_BLOCK_SIZE);
+                    blocks[i].resize(Lz4CompressBound(rawSize));
+                    const u64 compressedSize = Lz4Compress(pRaw, rawSize, blocks[i].data(), blocks[i].size());
+                    // Keep blocks that barely compress raw, they are cheaper to read
+                    if (compressedSize == 0 || compressedSize > rawSize - rawSize / 16) {
+                        blocks[i].assign(pRaw, pRaw + rawSize);
+                        blockSizes[i] = (u32)rawSize | ARCHIVE_RAW_BLOCK;
+                    }
+                    else {
+                        blocks[i].resize(compressedSize);
+                        blockSizes[i] = (u32)compressedSize;
+                    }
+                }
+            });
+
+            packed.data.resize(AlignUp(blockNum * sizeof(u32), ARCHIVE_ALIGNMENT), 0);
+            SDL_memcpy(packed.data.data(), blockSizes.data(), blockNum * sizeof(u32));
+            for (const vector<u8>& block : blocks)
+                packed.data.insert(packed.data.end(), block.begin(), block.end());
+
+            packed.entry = {
+                .pathHash = HashPath(packed.path),
+                .size     = file.GetSize(),
+                .blockNum = blockNum
+            };
+        }
+    });
+    if (!succeeded)
+        return false;
+
+    std::sort(entries.begin(), entries.end(), [](const PackedEntry& a, const PackedEntry& b) {
+        return a.entry.pathHash != b.entry.pathHash ? a.entry.pathHash < b.entry.pathHash : a.path < b.path;
+    });
+    for (u64 i = 1; i < entries.size(); i++) {
+        if (entries[i].path == entries[i - 1].path) {
+            SDL_Log("Duplicate archive path: %s", entries[i].path.c_str());
+            return false;
+        }
+    }
+
+    // Entries and their blocks are aligned so that raw entries can be used in place
+    vector<u8> out(sizeof(Archive::Header));
+    for (PackedEntry& packed : entries) {
+        out.resize(AlignUp(out.size(), ARCHIVE_ALIGNMENT));
+        packed.entry.dataOffset = out.size();
+        out.insert(out.end(), packed.data.begin(), packed.data.end());
+    }
+    const u64 pathsOffset = out.size();
+    for (PackedEntry& packed : entries) {
+        packed.entry.pathOffset = out.size() - pathsOffset;
+        packed.entry.pathLength = packed.path.size();
+        out.insert(out.end(), packed.path.begin(), packed.path.end());
+    }
+    out.resize(AlignUp(out.size(), alignof(Archive::Entry)));
+    const u64 indexOffset = out.size();
+    for (const PackedEntry& packed : entries) {
+        const u8* pEntry = (const u8*)&packed.entry;
+        out.insert(out.end(), pEntry, pEntry + sizeof(Archive::Entry));
+    }
+
+    const Archive::Header header = {
+        .magic       = ARCHIVE_MAGIC,
+        .version     = ARCHIVE_VERSION,
+        .entryNum    = (u32)entries.size(),
+        .indexOffset = indexOffset,
+        .pathsOffset = pathsOffset
+    };
+    SDL_memcpy(out.data(), &header, sizeof(header));
+
+    // Written next to the target first so that a mapped archive is never seen half-written
+    const string tempPath = archivePath + ".tmp";
+    if (!SDL_SaveFile(tempPath.c_str(), out.data(), out.size()))
+        return false;
+    std::error_code error;
+    std::filesystem::rename(tempPath, archivePath, error);
+    return !error;
+}
+
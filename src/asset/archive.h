@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../pch.h"
+#include "mapped_file.h"
+
+class FileBuffer;
+
+// Packed read-only archive of many files behind one mapping.
+// Layout: Header, entry data, path strings, then the index sorted by path hash.
+// Each entry is split in ARCHIVE_BLOCK_SIZE blocks that are LZ4-compressed
+// independently (stored raw when that does not pay off), so a single large
+// entry still decompresses on all worker threads. Entry data starts with the
+// u32 size of each block, the high bit marks raw blocks; the table is padded so
+// that the blocks start ARCHIVE_ALIGNMENT aligned like the entry.
+constexpr u32 ARCHIVE_MAGIC      = 0x41524250; // "PBRA"
+constexpr u32 ARCHIVE_VERSION    = 2;
+constexpr u32 ARCHIVE_BLOCK_SIZE = 256 * 1024;
+constexpr u32 ARCHIVE_RAW_BLOCK  = 0x80000000;
+constexpr u32 ARCHIVE_ALIGNMENT  = 16;
+
+class Archive {
+public:
+    bool Open(const string& path);
+    bool Contains(const string& path) const;
+    // Entries made of raw blocks only are returned as a view into the mapping
+    bool Read(const string& path, FileBuffer& buffer) const;
+    u32 GetEntryNum() const;
+private:
+    struct Header {
+        u32 magic;
+        u32 version;
+        u32 entryNum;
+        u32 padding0;
+        u64 indexOffset;
+        u64 pathsOffset;
+    };
+    struct Entry {
+        u64 pathHash;
+        u64 dataOffset;
+        u64 size;
+        u32 blockNum;
+        u32 pathOffset;
+        u32 pathLength;
+        u32 padding0;
+    };
+
+    const Entry* Find(const string& path) const;
+
+    MappedFile   m_file;
+    const Entry* m_pEntries = nullptr;
+    u32          m_entryNum = 0;
+    const char*  m_pPaths   = nullptr;
+    u64          m_pathsSize = 0;
+
+    friend bool WriteArchive(const string&, const string&, const vector<string>&);
+};
+
+// Packs the given files, paths inside the archive are relativePaths with generic separators
+bool WriteArchive(const string& archivePath, const string& rootDirectory, const vector<string>& relativePaths);
+
@@ -0,0 +1,214 @@
+#include "file_system.h"
+
+#include "../pch.h"
+#include "../hash.h"
+#include "archive.h"
+#include "../job_system.h"
+#include <utility>
+
+namespace {
+
+constexpr u32 ASYNC_READS_IN_FLIGHT = 32;
+
+}
+
+FileBuffer::~FileBuffer() {
+    Reset();
+}
+
+FileBuffer::FileBuffer(FileBuffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+FileBuffer& FileBuffer::operator=(FileBuffer&& other) noexcept {
+    if (this == &other)
+        return *this;
+    Reset();
+    m_pOwned = std::exchange(other.m_pOwned, nullptr);
+    m_file   = std::move(other.m_file);
+    m_pData  = std::exchange(other.m_pData, nullptr);
+    m_size   = std::exchange(other.m_size, 0);
+    return *this;
+}
+
+const u8* FileBuffer::GetData() const {
+    return m_pData;
+}
+
+u64 FileBuffer::GetSize() const {
+    return m_size;
+}
+
+u8* FileBuffer::Allocate(u64 size) {
+    Reset();
+    m_pOwned = (u8*)SDL_malloc(std::max<u64>(size, 1));
+    m_pData  = m_pOwned;
+    m_size   = size;
+    return m_pOwned;
+}
+
+bool FileBuffer::Map(const string& path) {
+    Reset();
+    if (!m_file.Open(path)) {
+        // Empty files cannot be mapped but are still files
+        std::error_code error;
+        return std::filesystem::is_regular_file(path, error) && std::filesystem::file_size(path, error) == 0 && !error;
+    }
+    m_pData = m_file.GetData();
+    m_size  = m_file.GetSize();
+    return true;
+}
+
+void FileBuffer::SetView(const u8* pData, u64 size) {
+    Reset();
+    m_pData = pData;
+    m_size  = size;
+}
+
+void FileBuffer::Reset() {
+    SDL_free(m_pOwned);
+    m_pOwned = nullptr;
+    m_file.Close();
+    m_pData = nullptr;
+    m_size  = 0;
+}
+
+FileSystem& FileSystem::GetInstance() {
+    static FileSystem instance;
+    return instance;
+}
+
+bool FileSystem::Mount(const string& archivePath, const string& mountPoint) {
+    unique<Archive> pArchive = std::make_unique<Archive>();
+    if (!pArchive->Open(archivePath))
+        return false;
+
+    string prefix = GetGenericPath(mountPoint);
+    if (!prefix.empty() && prefix.back() != '/')
+        prefix += '/';
+    SDL_Log("Mounted %s (%u files) at %s", archivePath.c_str(), pArchive->GetEntryNum(), prefix.c_str());
+    m_mounts.push_back({
+        .prefix     = prefix,
+        .pArchive   = std::move(pArchive),
+        .archiveKey = ::GetFileKey(archivePath)
+    });
+    return true;
+}
+
+bool FileSystem::ReadFile(const string& path, FileBuffer& buffer) const {
+    string relativePath;
+    const MountPoint* pMount = Resolve(path, relativePath);
+    if (pMount != nullptr)
+        return pMount->pArchive->Read(relativePath, buffer);
+    return buffer.Map(path);
+}
+
+void FileSystem::ReadFiles(const vector<string>& paths, const ReadCallback& onRead) const {
+    JobSystem& jobSystem = JobSystem::GetInstance();
+    JobSystem::Group group;
+    vector<FileBuffer> buffers(paths.size());
+    auto complete = [&](u32 fileIdx, bool read) {
+        jobSystem.Submit(group, [&, fileIdx, read]() {
+            onRead(fileIdx, std::move(buffers[fileIdx]), read);
+            buffers[fileIdx].Reset();
+        });
+    };
+
+    SDL_AsyncIOQueue* pQueue = SDL_CreateAsyncIOQueue();
+    if (pQueue == nullptr) {
+        jobSystem.ParallelFor(paths.size(), 1, [&](u32 begin, u32 end) {
+            for (u32 i = begin; i < end; i++) {
+                const bool read = ReadFile(paths[i], buffers[i]);
+                onRead(i, std::move(buffers[i]), read);
+                buffers[i].Reset();
+            }
+        });
+        return;
+    }
+
+    // Reads complete in any order, closes are queued on the same queue and only counted
+    u32 nextIdx = 0, readingNum = 0, closingNum = 0;
+    while (nextIdx < paths.size() || readingNum > 0 || closingNum > 0) {
+        while (nextIdx < paths.size() && readingNum < ASYNC_READS_IN_FLIGHT) {
+            const u32 fileIdx = nextIdx++;
+            string relativePath;
+            if (const MountPoint* pMount = Resolve(paths[fileIdx], relativePath)) {
+                // The archive is mapped, its entries only need decompression
+                jobSystem.Submit(group, [&, fileIdx, pMount, relativePath]() {
+                    const bool read = pMount->pArchive->Read(relativePath, buffers[fileIdx]);
+                    onRead(fileIdx, std::move(buffers[fileIdx]), read);
+                    buffers[fileIdx].Reset();
+                });
+                continue;
+            }
+
+            SDL_AsyncIO* pFile = SDL_AsyncIOFromFile(paths[fileIdx].c_str(), "r");
+            const i64 size = pFile != nullptr ? SDL_GetAsyncIOSize(pFile) : -1;
+            u8* pData = size >= 0 ? buffers[fileIdx].Allocate(size) : nullptr;
+            if (size > 0 && SDL_ReadAsyncIO(pFile, pData, 0, size, pQueue, (void*)(uintptr_t)fileIdx)) {
+                readingNum++;
+                continue;
+            }
+            if (pFile != nullptr && SDL_CloseAsyncIO(pFile, false, pQueue, nullptr))
+                closingNum++;
+            complete(fileIdx, size == 0);
+        }
+
+        // Missing and archived files queue nothing, there may be no result to wait for
+        if (readingNum + closingNum == 0)
+            continue;
+        SDL_AsyncIOOutcome outcome;
+        if (!SDL_WaitAsyncIOResult(pQueue, &outcome, -1))
+            continue;
+        if (outcome.type == SDL_ASYNCIO_TASK_CLOSE) {
+            closingNum--;
+            continue;
+        }
+        readingNum--;
+        if (SDL_CloseAsyncIO(outcome.asyncio, false, pQueue, nullptr))
+            closingNum++;
+        complete((u32)(uintptr_t)outcome.userdata, outcome.result == SDL_ASYNCIO_COMPLETE && outcome.bytes_transferred == outcome.bytes_requested);
+    }
+    SDL_DestroyAsyncIOQueue(pQueue);
+    jobSystem.Wait(group);
+}
+
+bool FileSystem::Exists(const string& path) const {
+    string relativePath;
+    if (Resolve(path, relativePath) != nullptr)
+        return true;
+    std::error_code error;
+    return std::filesystem::is_regular_file(path, error);
+}
+
+u64 FileSystem::GetFileKey(const string& path) const {
+    string relativePath;
+    const MountPoint* pMount = Resolve(path, relativePath);
+    if (pMount != nullptr)
+        return HashCombine(pMount->archiveKey, HashBytes(relativePath.data(), relativePath.size()));
+    return ::GetFileKey(path);
+}
+
+const FileSystem::MountPoint* FileSystem::Resolve(const string& path, string& relativePath) const {
+    if (m_mounts.empty())
+        return nullptr;
+
+    const string genericPath = GetGenericPath(path);
+    for (auto it = m_mounts.rbegin(); it != m_mounts.rend(); it++) {
+        if (!genericPath.starts_with(it->prefix))
+            continue;
+        relativePath = genericPath.substr(it->prefix.size());
+        if (it->pArchive->Contains(relativePath))
+            return &*it;
+    }
+    return nullptr;
+}
+
+string GetGenericPath(const string& path) {
+    string genericPath = path;
+    std::replace(genericPath.begin(), genericPath.end(), '\\', '/');
+    while (genericPath.starts_with("./"))
+        genericPath.erase(0, 2);
+    return genericPath;
+}
+
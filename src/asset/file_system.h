@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../pch.h"
+#include "mapped_file.h"
+
+class Archive;
+
+// Bytes of one file: heap memory, a mapping of an OS file, or a view into a mounted archive
+class FileBuffer {
+public:
+    FileBuffer() = default;
+    ~FileBuffer();
+    FileBuffer(const FileBuffer&) = delete;
+    void operator=(const FileBuffer&) = delete;
+    FileBuffer(FileBuffer&& other) noexcept;
+    FileBuffer& operator=(FileBuffer&& other) noexcept;
+    const u8* GetData() const;
+    u64 GetSize() const;
+    u8* Allocate(u64 size);
+    bool Map(const string& path);
+    void SetView(const u8* pData, u64 size); // The owner of pData must outlive the buffer
+    void Reset();
+private:
+    u8*        m_pOwned = nullptr;
+    MappedFile m_file;
+    const u8*  m_pData  = nullptr;
+    u64        m_size   = 0;
+};
+
+// Virtual file system: a path below a mount point is looked up in that mount's archive
+// first, later mounts taking priority; everything else comes from the OS. Mounting is
+// not thread-safe and happens before loading, reads may come from any thread.
+class FileSystem {
+private:
+    FileSystem() = default;
+public:
+    static FileSystem& GetInstance();
+    FileSystem(const FileSystem&) = delete;
+    void operator=(const FileSystem&) = delete;
+    bool Mount(const string& archivePath, const string& mountPoint);
+    bool ReadFile(const string& path, FileBuffer& buffer) const;
+    // Reads a batch at once: OS files through SDL_AsyncIO with up to ASYNC_READS_IN_FLIGHT reads
+    // in flight, archive entries without any I/O. onRead runs on the job system as soon as a file is
+    // in memory, so decoding overlaps the remaining reads. The buffer is handed over: a callback that
+    // needs the bytes later moves it out, otherwise it is freed when the callback returns.
+    // read is false for missing files. Blocks until every callback is done
+    using ReadCallback = std::function<void(u32 fileIdx, FileBuffer&& buffer, bool read)>;
+    void ReadFiles(const vector<string>& paths, const ReadCallback& onRead) const;
+    bool Exists(const string& path) const;
+    // Changes whenever the file does; archive entries are keyed by archive and path
+    u64 GetFileKey(const string& path) const;
+private:
+    struct MountPoint {
+        string          prefix; // Generic separators with a trailing '/'
+        unique<Archive> pArchive;
+        u64             archiveKey;
+    };
+
+    const MountPoint* Resolve(const string& path, string& relativePath) const;
+
+    vector<MountPoint> m_mounts;
+};
+
+// Normalizes separators to '/' and drops leading "./"
+string GetGenericPath(const string& path);
+
@@ -0,0 +1,293 @@
+#include "geometry_codec.h"
+
+#include "../pch.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define GEOMETRY_CODEC_SSE2
+    #include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr u32 CHUNK_VERTEX_NUM = 16;
+
+enum PlaneMode : u32 {
+    PlaneMode_Zero = 0,
+    PlaneMode_Bits2,
+    PlaneMode_Bits4,
+    PlaneMode_Bits8
+};
+
+constexpr u32 PLANE_MODE_SIZES[] = { 0, 4, 8, 16 };
+
+u32 GetChunkHeaderSize(u32 vertexSize) {
+    return (vertexSize + 3) / 4;
+}
+
+// Unpacked bytes of every 2-bit and 4-bit payload byte
+struct UnpackTables {
+    u8 bits2[256][4];
+    u8 bits4[256][2];
+    UnpackTables() {
+        for (u32 i = 0; i < 256; i++) {
+            for (u32 j = 0; j < 4; j++)
+                bits2[i][j] = (i >> (j * 2)) & 3;
+            bits4[i][0] = i & 15;
+            bits4[i][1] = i >> 4;
+        }
+    }
+};
+const UnpackTables s_unpackTables;
+
+u8 ZigzagEncode(u8 delta) {
+    return (u8)((delta << 1) ^ (u8)((i8)delta >> 7));
+}
+
+u8 ZigzagDecode(u8 value) {
+    return (u8)((value >> 1) ^ (u8)-(value & 1));
+}
+
+// Reads one plane payload into 16 zigzag coded deltas
+bool UnpackPlane(const u8*& pCursor, const u8* pEnd, u32 mode, u8* pDeltas) {
+    const u32 size = PLANE_MODE_SIZES[mode];
+    if ((u64)(pEnd - pCursor) < size)
+        return false;
+
+    switch (mode) {
+    case PlaneMode_Zero:
+        SDL_memset(pDeltas, 0, CHUNK_VERTEX_NUM);
+        break;
+    case PlaneMode_Bits2:
+        for (u32 i = 0; i < 4; i++)
+            SDL_memcpy(pDeltas + i * 4, s_unpackTables.bits2[pCursor[i]], 4);
+        break;
+    case PlaneMode_Bits4:
+        for (u32 i = 0; i < 8; i++)
+            SDL_memcpy(pDeltas + i * 2, s_unpackTables.bits4[pCursor[i]], 2);
+        break;
+    default:
+        SDL_memcpy(pDeltas, pCursor, CHUNK_VERTEX_NUM);
+        break;
+    }
+    pCursor += size;
+    return true;
+}
+
+// Undoes the zigzag and delta filters of one plane and scatters it into the chunk
+void FilterPlaneScalar(const u8* pDeltas, u8& carry, u8* pChunk, u32 vertexSize) {
+    for (u32 i = 0; i < CHUNK_VERTEX_NUM; i++) {
+        carry += ZigzagDecode(pDeltas[i]);
+        pChunk[i * vertexSize] = carry;
+    }
+}
+
+#ifdef GEOMETRY_CODEC_SSE2
+// Raw and zero planes skip the scratch copy
+bool UnpackPlane(const u8*& pCursor, const u8* pEnd, u32 mode, __m128i& deltas) {
+    if (mode == PlaneMode_Zero) {
+        deltas = _mm_setzero_si128();
+        return true;
+    }
+    if (mode == PlaneMode_Bits8) {
+        if ((u64)(pEnd - pCursor) < CHUNK_VERTEX_NUM)
+            return false;
+        deltas = _mm_loadu_si128((const __m128i*)pCursor);
+        pCursor += CHUNK_VERTEX_NUM;
+        return true;
+    }
+    alignas(16) u8 unpacked[CHUNK_VERTEX_NUM];
+    if (!UnpackPlane(pCursor, pEnd, mode, unpacked))
+        return false;
+    deltas = _mm_load_si128((const __m128i*)unpacked);
+    return true;
+}
+
+__m128i FilterPlane(__m128i zigzag, u8& carry) {
+    const __m128i half = _mm_and_si128(_mm_srli_epi16(zigzag, 1), _mm_set1_epi8(0x7F));
+    const __m128i sign = _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(zigzag, _mm_set1_epi8(1)));
+    __m128i value = _mm_xor_si128(half, sign);
+
+    // Inclusive prefix sum over the 16 vertices, seeded with the last vertex of the previous chunk
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 1));
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 2));
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 4));
+    value = _mm_add_epi8(value, _mm_slli_si128(value, 8));
+    value = _mm_add_epi8(value, _mm_set1_epi8((char)carry));
+    carry = (u8)(_mm_extract_epi16(value, 7) >> 8);
+    return value;
+}
+
+// Interleaves four planes back into 4-byte columns of the 16 vertices
+void StoreColumns(__m128i p0, __m128i p1, __m128i p2, __m128i p3, u8* pChunk, u32 vertexSize) {
+    const __m128i lo01 = _mm_unpacklo_epi8(p0, p1);
+    const __m128i hi01 = _mm_unpackhi_epi8(p0, p1);
+    const __m128i lo23 = _mm_unpacklo_epi8(p2, p3);
+    const __m128i hi23 = _mm_unpackhi_epi8(p2, p3);
+    alignas(16) u32 columns[CHUNK_VERTEX_NUM];
+    _mm_store_si128((__m128i*)columns + 0, _mm_unpacklo_epi16(lo01, lo23));
+    _mm_store_si128((__m128i*)columns + 1, _mm_unpackhi_epi16(lo01, lo23));
+    _mm_store_si128((__m128i*)columns + 2, _mm_unpacklo_epi16(hi01, hi23));
+    _mm_store_si128((__m128i*)columns + 3, _mm_unpackhi_epi16(hi01, hi23));
+    for (u32 i = 0; i < CHUNK_VERTEX_NUM; i++)
+        SDL_memcpy(pChunk + i * vertexSize, &columns[i], 4);
+}
+#endif
+
+bool DecodeChunk(const u8*& pCursor, const u8* pEnd, u8* pCarries, u8* pChunk, u32 vertexSize) {
+    const u32 headerSize = GetChunkHeaderSize(vertexSize);
+    if ((u64)(pEnd - pCursor) < headerSize)
+        return false;
+    const u8* pModes = pCursor;
+    pCursor += headerSize;
+    auto GetMode = [&](u32 plane) { return (u32)(pModes[plane / 4] >> (plane % 4 * 2)) & 3; };
+
+    u32 plane = 0;
+#ifdef GEOMETRY_CODEC_SSE2
+    for (; plane + 4 <= vertexSize; plane += 4) {
+        __m128i deltas[4];
+        for (u32 i = 0; i < 4; i++) {
+            if (!UnpackPlane(pCursor, pEnd, GetMode(plane + i), deltas[i]))
+                return false;
+        }
+        StoreColumns(FilterPlane(deltas[0], pCarries[plane + 0]),
+                     FilterPlane(deltas[1], pCarries[plane + 1]),
+                     FilterPlane(deltas[2], pCarries[plane + 2]),
+                     FilterPlane(deltas[3], pCarries[plane + 3]),
+                     pChunk + plane, vertexSize);
+    }
+#endif
+    for (; plane < vertexSize; plane++) {
+        u8 deltas[CHUNK_VERTEX_NUM];
+        if (!UnpackPlane(pCursor, pEnd, GetMode(plane), deltas))
+            return false;
+        FilterPlaneScalar(deltas, pCarries[plane], pChunk + plane, vertexSize);
+    }
+    return true;
+}
+
+}
+
+u64 GetEncodedVertexBound(u32 vertexNum, u32 vertexSize) {
+    const u64 chunkNum = (vertexNum + CHUNK_VERTEX_NUM - 1) / CHUNK_VERTEX_NUM;
+    return chunkNum * (GetChunkHeaderSize(vertexSize) + (u64)vertexSize * CHUNK_VERTEX_NUM);
+}
+
+u64 GetEncodedIndexBound(u32 indexNum) {
+    return (u64)indexNum * 5;
+}
+
+// Every chunk has its header, every index at least one byte
+u64 GetEncodedVertexMinSize(u32 vertexNum, u32 vertexSize) {
+    const u64 chunkNum = (vertexNum + CHUNK_VERTEX_NUM - 1) / CHUNK_VERTEX_NUM;
+    return chunkNum * GetChunkHeaderSize(vertexSize);
+}
+
+u64 GetEncodedIndexMinSize(u32 indexNum) {
+    return indexNum;
+}
+
+void EncodeVertexBuffer(const void* pVertices, u32 vertexNum, u32 vertexSize, vector<u8>& out) {
+    const u8* pSrc = (const u8*)pVertices;
+    const u32 headerSize = GetChunkHeaderSize(vertexSize);
+    vector<u8> previous(vertexSize, 0);
+
+    out.reserve(out.size() + GetEncodedVertexBound(vertexNum, vertexSize));
+    for (u32 chunkBegin = 0; chunkBegin < vertexNum; chunkBegin += CHUNK_VERTEX_NUM) {
+        const u64 headerOffset = out.size();
+        out.resize(out.size() + headerSize, 0);
+
+        for (u32 plane = 0; plane < vertexSize; plane++) {
+            // Vertices past the end repeat the last one, so their deltas are zero
+            u8 deltas[CHUNK_VERTEX_NUM];
+            u8 maxDelta = 0;
+            for (u32 i = 0; i < CHUNK_VERTEX_NUM; i++) {
+                const u32 vertex = chunkBegin + i;
+                const u8 value = vertex < vertexNum ? pSrc[(u64)vertex * vertexSize + plane] : previous[plane];
+                deltas[i] = ZigzagEncode(value - previous[plane]);
+                maxDelta  = SDL_max(maxDelta, deltas[i]);
+                previous[plane] = value;
+            }
+
+            const u32 mode = maxDelta == 0 ? PlaneMode_Zero : maxDelta < 4 ? PlaneMode_Bits2 : maxDelta < 16 ? PlaneMode_Bits4 : PlaneMode_Bits8;
+            out[headerOffset + plane / 4] |= mode << (plane % 4 * 2);
+            switch (mode) {
+            case PlaneMode_Bits2:
+                for (u32 i = 0; i < CHUNK_VERTEX_NUM; i += 4)
+                    out.push_back(deltas[i] | deltas[i + 1] << 2 | deltas[i + 2] << 4 | deltas[i + 3] << 6);
+                break;
+            case PlaneMode_Bits4:
+                for (u32 i = 0; i < CHUNK_VERTEX_NUM; i += 2)
+                    out.push_back(deltas[i] | deltas[i + 1] << 4);
+                break;
+            case PlaneMode_Bits8:
+                out.insert(out.end(), deltas, deltas + CHUNK_VERTEX_NUM);
+                break;
+            }
+        }
+    }
+}
+
+bool DecodeVertexBuffer(const u8* pData, u64 size, void* pVertices, u32 vertexNum, u32 vertexSize) {
+    const u8* pCursor = pData;
+    const u8* pEnd    = pData + size;
+    u8* pDst = (u8*)pVertices;
+    vector<u8> carries(vertexSize, 0);
+
+    const u32 fullChunkNum = vertexNum / CHUNK_VERTEX_NUM;
+    for (u32 chunk = 0; chunk < fullChunkNum; chunk++) {
+        if (!DecodeChunk(pCursor, pEnd, carries.data(), pDst + (u64)chunk * CHUNK_VERTEX_NUM * vertexSize, vertexSize))
+            return false;
+    }
+
+    // The tail chunk goes through scratch memory so the padding vertices are not written
+    const u32 tailNum = vertexNum % CHUNK_VERTEX_NUM;
+    if (tailNum != 0) {
+        vector<u8> tail(CHUNK_VERTEX_NUM * vertexSize);
+        if (!DecodeChunk(pCursor, pEnd, carries.data(), tail.data(), vertexSize))
+            return false;
+        SDL_memcpy(pDst + (u64)fullChunkNum * CHUNK_VERTEX_NUM * vertexSize, tail.data(), tailNum * vertexSize);
+    }
+    return pCursor == pEnd;
+}
+
+void EncodeIndexBuffer(const u32* pIndices, u32 indexNum, vector<u8>& out) {
+    out.reserve(out.size() + GetEncodedIndexBound(indexNum));
+    u32 previous = 0;
+    for (u32 i = 0; i < indexNum; i++) {
+        const i32 delta = (i32)(pIndices[i] - previous);
+        u32 value = ((u32)delta << 1) ^ (u32)(delta >> 31);
+        previous = pIndices[i];
+        while (value >= 0x80) {
+            out.push_back((u8)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((u8)value);
+    }
+}
+
+bool DecodeIndexBuffer(const u8* pData, u64 size, u32* pIndices, u32 indexNum) {
+    const u8* pCursor = pData;
+    const u8* pEnd    = pData + size;
+    u32 previous = 0;
+    for (u32 i = 0; i < indexNum; i++) {
+        if (pCursor == pEnd)
+            return false;
+
+        // Single byte deltas are the common case after vertex cache optimization
+        u32 value = *pCursor++;
+        if (value >= 0x80) {
+            value &= 0x7F;
+            for (u32 shift = 7;; shift += 7) {
+                if (pCursor == pEnd || shift > 28)
+                    return false;
+                const u32 byte = *pCursor++;
+                value |= (byte & 0x7F) << shift;
+                if (byte < 0x80)
+                    break;
+            }
+        }
+        previous += (value >> 1) ^ (u32)-(i32)(value & 1);
+        pIndices[i] = previous;
+    }
+    return pCursor == pEnd;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../pch.h"
+
+// Lossless on-disk coding of vertex and index buffers, used by the mesh cache.
+//
+// Vertices are split into chunks of 16. Inside a chunk every byte position of the
+// vertex (a "byte plane") is delta coded against the previous vertex, zigzag mapped
+// and bit packed with 0, 2, 4 or 8 bits per byte. Neighbouring vertices after
+// OptimizeVertexFetch() share most of their high bytes, so those planes collapse.
+// Indices are delta coded against the previous index and written as zigzag varints.
+//
+// Decoders write straight into caller memory and return false on malformed input.
+
+// Worst-case encoded sizes
+u64 GetEncodedVertexBound(u32 vertexNum, u32 vertexSize);
+u64 GetEncodedIndexBound(u32 indexNum);
+// Smallest possible encoded sizes, counts read from disk are checked against them
+u64 GetEncodedVertexMinSize(u32 vertexNum, u32 vertexSize);
+u64 GetEncodedIndexMinSize(u32 indexNum);
+
+// Append the encoded stream to out
+void EncodeVertexBuffer(const void* pVertices, u32 vertexNum, u32 vertexSize, vector<u8>& out);
+void EncodeIndexBuffer(const u32* pIndices, u32 indexNum, vector<u8>& out);
+
+// pVertices / pIndices must hold exactly vertexNum / indexNum elements
+bool DecodeVertexBuffer(const u8* pData, u64 size, void* pVertices, u32 vertexNum, u32 vertexSize);
+bool DecodeIndexBuffer(const u8* pData, u64 size, u32* pIndices, u32 indexNum);
@@ -0,0 +1,440 @@
+#include "gltf.h"
+
+#include "../pch.h"
+#include "../job_system.h"
+#include "glm/gtc/quaternion.hpp"
+#include "json.h"
+#include "file_system.h"
+#include "tangents.h"
+
+namespace {
+
+constexpr u32 GLB_MAGIC      = 0x46546C67; // "glTF"
+constexpr u32 GLB_CHUNK_JSON = 0x4E4F534A;
+constexpr u32 GLB_CHUNK_BIN  = 0x004E4942;
+
+enum ComponentType {
+    ComponentType_I8  = 5120,
+    ComponentType_U8  = 5121,
+    ComponentType_I16 = 5122,
+    ComponentType_U16 = 5123,
+    ComponentType_U32 = 5125,
+    ComponentType_F32 = 5126
+};
+
+constexpr i64 PRIMITIVE_MODE_TRIANGLES = 4;
+
+struct GlbHeader {
+    u32 magic;
+    u32 version;
+    u32 length;
+};
+
+struct GlbChunkHeader {
+    u32 length;
+    u32 type;
+};
+
+struct BufferData {
+    const u8* pData = nullptr;
+    u64       size  = 0;
+};
+
+// Strided view of an accessor inside a mapped buffer
+struct Accessor {
+    const u8* pData         = nullptr;
+    u32       count         = 0;
+    u32       stride        = 0;
+    u32       componentType = 0;
+    u32       componentNum  = 0;
+    bool      normalized    = false;
+};
+
+struct PrimitiveInstance {
+    u32            meshIdx;
+    u32            primitiveIdx;
+    Renderer::Mat4 transform;
+    string         name;
+};
+
+u32 GetComponentSize(u32 componentType) {
+    switch (componentType) {
+        case ComponentType_I8:
+        case ComponentType_U8:  return 1;
+        case ComponentType_I16:
+        case ComponentType_U16: return 2;
+        case ComponentType_U32:
+        case ComponentType_F32: return 4;
+        default:                return 0;
+    }
+}
+
+u32 GetComponentNum(const string& type) {
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2")   return 2;
+    if (type == "VEC3")   return 3;
+    if (type == "VEC4")   return 4;
+    if (type == "MAT2")   return 4;
+    if (type == "MAT3")   return 9;
+    if (type == "MAT4")   return 16;
+    return 0;
+}
+
+float ReadComponent(const u8* pData, u32 componentType, bool normalized) {
+    switch (componentType) {
+        case ComponentType_F32: {
+            float value;
+            SDL_memcpy(&value, pData, sizeof(value));
+            return value;
+        }
+        case ComponentType_U8:  return normalized ? *pData / 255.0f : *pData;
+        case ComponentType_I8:  return normalized ? std::max(*(const i8*)pData / 127.0f, -1.0f) : *(const i8*)pData;
+        case ComponentType_U16: {
+            u16 value;
+            SDL_memcpy(&value, pData, sizeof(value));
+            return normalized ? value / 65535.0f : value;
+        }
+        case ComponentType_I16: {
+            i16 value;
+            SDL_memcpy(&value, pData, sizeof(value));
+            return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+        }
+        case ComponentType_U32: {
+            u32 value;
+            SDL_memcpy(&value, pData, sizeof(value));
+            return (float)value;
+        }
+        default:
+            return 0.0f;
+    }
+}
+
+// Reads the first N components of element idx; tightly packed floats take the memcpy path
+template<u32 N>
+void ReadElement(const Accessor& accessor, u32 idx, float* pDst) {
+    const u8* pElement = accessor.pData + (u64)idx * accessor.stride;
+    if (accessor.componentType == ComponentType_F32) {
+        SDL_memcpy(pDst, pElement, N * sizeof(float));
+        return;
+    }
+    const u32 componentSize = GetComponentSize(accessor.componentType);
+    for (u32 i = 0; i < N; i++)
+        pDst[i] = ReadComponent(pElement + i * componentSize, accessor.componentType, accessor.normalized);
+}
+
+string DecodeUri(const string& uri) {
+    string decoded;
+    decoded.reserve(uri.size());
+    for (u64 i = 0; i < uri.size(); i++) {
+        if (uri[i] == '%' && i + 2 < uri.size() && SDL_isxdigit(uri[i + 1]) && SDL_isxdigit(uri[i + 2])) {
+            const char hex[3] = { uri[i + 1], uri[i + 2], '\0' };
+            decoded += (char)SDL_strtol(hex, nullptr, 16);
+            i += 2;
+        }
+        else {
+            decoded += uri[i];
+        }
+    }
+    return decoded;
+}
+
+Renderer::Mat4 GetNodeTransform(const JsonValue& node) {
+    const JsonValue& matrix = node["matrix"];
+    if (matrix.GetSize() == 16) {
+        // Column-major, same as glm
+        Renderer::Mat4 result;
+        for (u32 i = 0; i < 16; i++)
+            result[i / 4][i % 4] = matrix[i].GetNumber();
+        return result;
+    }
+
+    const JsonValue& t = node["translation"];
+    const JsonValue& r = node["rotation"];
+    const JsonValue& s = node["scale"];
+    const Renderer::Vec3 translation = Renderer::Vec3(t[0u].GetNumber(0), t[1].GetNumber(0), t[2].GetNumber(0));
+    const glm::quat rotation = glm::quat(r[3].GetNumber(1), r[0u].GetNumber(0), r[1].GetNumber(0), r[2].GetNumber(0));
+    const Renderer::Vec3 scale = Renderer::Vec3(s[0u].GetNumber(1), s[1].GetNumber(1), s[2].GetNumber(1));
+    return glm::translate(Renderer::Mat4(1), translation) * glm::mat4_cast(rotation) * glm::scale(Renderer::Mat4(1), scale);
+}
+
+class GltfReader {
+public:
+    bool Load(const string& path, vector<MeshAsset>& meshes) {
+        m_path = path;
+        if (!FileSystem::GetInstance().ReadFile(path, m_file))
+            return Fail("could not open the file");
+
+        const char* pJson;
+        u64 jsonSize;
+        BufferData glbBinChunk;
+        if (!ParseContainer(pJson, jsonSize, glbBinChunk))
+            return false;
+
+        string error;
+        if (!ParseJson(pJson, jsonSize, m_doc, error))
+            return Fail(error.c_str());
+        if (!MapBuffers(glbBinChunk))
+            return false;
+
+        vector<PrimitiveInstance> instances;
+        if (!CollectInstances(instances))
+            return false;
+
+        meshes.resize(instances.size());
+        std::atomic<bool> succeeded = true;
+        JobSystem::GetInstance().ParallelFor(instances.size(), 1, [&](u32 begin, u32 end) {
+            for (u32 i = begin; i < end && succeeded; i++) {
+                if (!ConvertPrimitive(instances[i], meshes[i]))
+                    succeeded = false;
+            }
+        });
+        if (!succeeded)
+            return Fail("unsupported primitive");
+        return true;
+    }
+private:
+    bool Fail(const char* reason) const {
+        SDL_Log("Native glTF loader skipped %s: %s", m_path.c_str(), reason);
+        return false;
+    }
+
+    // Splits a GLB into its JSON and BIN chunks, plain .gltf files are all JSON
+    bool ParseContainer(const char*& pJson, u64& jsonSize, BufferData& binChunk) {
+        const u8* pData = m_file.GetData();
+        const u64 size  = m_file.GetSize();
+
+        GlbHeader header = {};
+        if (size >= sizeof(header))
+            SDL_memcpy(&header, pData, sizeof(header));
+        if (header.magic != GLB_MAGIC) {
+            pJson    = (const char*)pData;
+            jsonSize = size;
+            return true;
+        }
+        if (header.version != 2 || header.length > size)
+            return Fail("invalid GLB header");
+
+        pJson = nullptr;
+        u64 offset = sizeof(header);
+        while (offset + sizeof(GlbChunkHeader) <= header.length) {
+            GlbChunkHeader chunk;
+            SDL_memcpy(&chunk, pData + offset, sizeof(chunk));
+            offset += sizeof(chunk);
+            if (offset + chunk.length > header.length)
+                return Fail("truncated GLB chunk");
+
+            if (chunk.type == GLB_CHUNK_JSON && pJson == nullptr) {
+                pJson    = (const char*)pData + offset;
+                jsonSize = chunk.length;
+            }
+            else if (chunk.type == GLB_CHUNK_BIN && binChunk.pData == nullptr) {
+                binChunk = { pData + offset, chunk.length };
+            }
+            offset += (chunk.length + 3) & ~3u;
+        }
+        if (pJson == nullptr)
+            return Fail("GLB without a JSON chunk");
+        return true;
+    }
+
+    bool MapBuffers(const BufferData& glbBinChunk) {
+        const string directory = std::filesystem::path(m_path).parent_path().string();
+        const JsonValue& buffers = m_doc["buffers"];
+        m_buffers.resize(buffers.GetSize());
+        m_bufferFiles.resize(buffers.GetSize());
+
+        for (u32 i = 0; i < buffers.GetSize(); i++) {
+            const JsonValue& buffer = buffers[i];
+            if (!buffer.Contains("uri")) {
+                if (i != 0 || glbBinChunk.pData == nullptr)
+                    return Fail("buffer without data");
+                m_buffers[i] = glbBinChunk;
+            }
+            else {
+                const string& uri = buffer["uri"].GetString();
+                if (uri.starts_with("data:"))
+                    return Fail("data URIs are not supported");
+                m_bufferFiles[i] = std::make_unique<FileBuffer>();
+                if (!FileSystem::GetInstance().ReadFile(directory + "/" + DecodeUri(uri), *m_bufferFiles[i]))
+                    return Fail("could not read a buffer");
+                m_buffers[i] = { m_bufferFiles[i]->GetData(), m_bufferFiles[i]->GetSize() };
+            }
+            if ((u64)buffer["byteLength"].GetInt() > m_buffers[i].size)
+                return Fail("buffer is shorter than its byteLength");
+        }
+        return true;
+    }
+
+    bool GetAccessor(i64 accessorIdx, Accessor& accessor) const {
+        const JsonValue& json = m_doc["accessors"][(u32)accessorIdx];
+        if (accessorIdx < 0 || json.IsNull() || json.Contains("sparse") || !json.Contains("bufferView"))
+            return false;
+
+        accessor.count         = json["count"].GetInt();
+        accessor.componentType = json["componentType"].GetInt();
+        accessor.componentNum  = GetComponentNum(json["type"].GetString());
+        accessor.normalized    = json["normalized"].GetBool();
+
+        const u32 componentSize = GetComponentSize(accessor.componentType);
+        const u32 elementSize   = componentSize * accessor.componentNum;
+        if (elementSize == 0)
+            return false;
+
+        const JsonValue& view = m_doc["bufferViews"][(u32)json["bufferView"].GetInt()];
+        const u32 bufferIdx = view["buffer"].GetInt();
+        if (view.IsNull() || bufferIdx >= m_buffers.size())
+            return false;
+
+        accessor.stride = view["byteStride"].GetInt(elementSize);
+        const u64 viewOffset = view["byteOffset"].GetInt();
+        const u64 viewLength = view["byteLength"].GetInt();
+        const u64 offset     = json["byteOffset"].GetInt();
+        if (accessor.count > 0 && offset + (u64)accessor.stride * (accessor.count - 1) + elementSize > viewLength)
+            return false;
+        if (viewOffset + viewLength > m_buffers[bufferIdx].size)
+            return false;
+
+        accessor.pData = m_buffers[bufferIdx].pData + viewOffset + offset;
+        return true;
+    }
+
+    void CollectNode(u32 nodeIdx, const Renderer::Mat4& parentTransform, vector<PrimitiveInstance>& instances, u32 depth) const {
+        const JsonValue& node = m_doc["nodes"][nodeIdx];
+        if (node.IsNull() || depth > m_doc["nodes"].GetSize())
+            return;
+
+        const Renderer::Mat4 transform = parentTransform * GetNodeTransform(node);
+        if (node.Contains("mesh")) {
+            const u32 meshIdx = node["mesh"].GetInt();
+            const JsonValue& mesh = m_doc["meshes"][meshIdx];
+            const string nodeName = node["name"].GetString().empty() ? "node" + std::to_string(nodeIdx) : node["name"].GetString();
+            const string meshName = mesh["name"].GetString().empty() ? "mesh" + std::to_string(meshIdx) : mesh["name"].GetString();
+            const u32 primitiveNum = mesh["primitives"].GetSize();
+            for (u32 i = 0; i < primitiveNum; i++) {
+                instances.push_back({
+                    .meshIdx      = meshIdx,
+                    .primitiveIdx = i,
+                    .transform    = transform,
+                    .name         = nodeName + "/" + meshName + (primitiveNum > 1 ? "-" + std::to_string(i) : "")
+                });
+            }
+        }
+        for (const JsonValue& child : node["children"].GetElements())
+            CollectNode(child.GetInt(), transform, instances, depth + 1);
+    }
+
+    bool CollectInstances(vector<PrimitiveInstance>& instances) const {
+        const JsonValue& scene = m_doc["scenes"][(u32)m_doc["scene"].GetInt(0)];
+        for (const JsonValue& root : scene["nodes"].GetElements())
+            CollectNode(root.GetInt(), Renderer::Mat4(1), instances, 0);
+
+        // Names have to be unique for the renderer
+        umap<string, u32> nameCounts;
+        for (PrimitiveInstance& instance : instances) {
+            const u32 count = nameCounts[instance.name]++;
+            if (count > 0)
+                instance.name += "#" + std::to_string(count);
+        }
+
+        if (instances.empty())
+            return Fail("no meshes in the default scene");
+        return true;
+    }
+
+    // A missing texture leaves uri empty; false for images without a file of their own
+    bool GetImageUri(const JsonValue& textureInfo, string& uri) const {
+        uri.clear();
+        if (textureInfo.IsNull())
+            return true;
+        const JsonValue& texture = m_doc["textures"][(u32)textureInfo["index"].GetInt()];
+        const JsonValue& image = m_doc["images"][(u32)texture["source"].GetInt()];
+        const string imageUri = image["uri"].GetString();
+        if (imageUri.empty() || imageUri.starts_with("data:"))
+            return false;
+        uri = DecodeUri(imageUri);
+        return true;
+    }
+
+    bool ConvertPrimitive(const PrimitiveInstance& instance, MeshAsset& asset) const {
+        const JsonValue& primitive  = m_doc["meshes"][instance.meshIdx]["primitives"][instance.primitiveIdx];
+        const JsonValue& attributes = primitive["attributes"];
+        if (primitive["mode"].GetInt(PRIMITIVE_MODE_TRIANGLES) != PRIMITIVE_MODE_TRIANGLES)
+            return false;
+
+        Accessor positions, normals, tangents, texCoords, indices;
+        if (!GetAccessor(attributes["POSITION"].GetInt(-1), positions) || positions.componentNum != 3)
+            return false;
+        if (!GetAccessor(attributes["NORMAL"].GetInt(-1), normals) || normals.count != positions.count)
+            return false;
+        const bool hasTangents  = GetAccessor(attributes["TANGENT"].GetInt(-1), tangents) && tangents.count == positions.count;
+        const bool hasTexCoords = GetAccessor(attributes["TEXCOORD_0"].GetInt(-1), texCoords) && texCoords.count == positions.count;
+
+        asset.name = instance.name;
+        Renderer::MeshCreateInfo& createInfo = asset.createInfo;
+        createInfo.transform = instance.transform;
+
+        // Straight from the mapped buffers into the renderer's vertex layout
+        createInfo.vertices.resize(positions.count);
+        for (u32 i = 0; i < positions.count; i++) {
+            Renderer::Vertex& vertex = createInfo.vertices[i];
+            ReadElement<3>(positions, i, &vertex.pos.x);
+            ReadElement<3>(normals, i, &vertex.normal.x);
+            if (hasTangents)
+                ReadElement<3>(tangents, i, &vertex.tangent.x);
+            else
+                vertex.tangent = Renderer::Vec3(0);
+            if (hasTexCoords)
+                ReadElement<2>(texCoords, i, &vertex.texCoord.x);
+            else
+                vertex.texCoord = Renderer::Vec2(0);
+        }
+
+        if (primitive.Contains("indices")) {
+            if (!GetAccessor(primitive["indices"].GetInt(), indices) || indices.componentNum != 1)
+                return false;
+            createInfo.indices.resize(indices.count - indices.count % 3);
+            for (u32 i = 0; i < createInfo.indices.size(); i++) {
+                const u8* pElement = indices.pData + (u64)i * indices.stride;
+                switch (indices.componentType) {
+                    case ComponentType_U8:  createInfo.indices[i] = *pElement; break;
+                    case ComponentType_U16: { u16 index; SDL_memcpy(&index, pElement, sizeof(index)); createInfo.indices[i] = index; break; }
+                    case ComponentType_U32: SDL_memcpy(&createInfo.indices[i], pElement, sizeof(u32)); break;
+                    default: return false;
+                }
+                if (createInfo.indices[i] >= positions.count)
+                    return false;
+            }
+        }
+        else {
+            createInfo.indices.resize(positions.count - positions.count % 3);
+            for (u32 i = 0; i < createInfo.indices.size(); i++)
+                createInfo.indices[i] = i;
+        }
+
+        if (!hasTangents && hasTexCoords)
+            GenerateTangents(createInfo);
+
+        // NOTE: the order must match the order of the MeshData texture type enum.
+        // Maps the material lacks stay empty and are drawn with the renderer's placeholders
+        const JsonValue& material = m_doc["materials"][(u32)primitive["material"].GetInt(-1)];
+        const JsonValue& pbr = material["pbrMetallicRoughness"];
+        const JsonValue& armTexture = pbr.Contains("metallicRoughnessTexture") ? pbr["metallicRoughnessTexture"] : material["occlusionTexture"];
+        return GetImageUri(pbr["baseColorTexture"], asset.texturePaths[0]) &&
+               GetImageUri(material["normalTexture"], asset.texturePaths[1]) &&
+               GetImageUri(armTexture, asset.texturePaths[2]);
+    }
+
+    string                     m_path;
+    FileBuffer                 m_file;
+    JsonValue                  m_doc;
+    vector<BufferData>         m_buffers;
+    vector<unique<FileBuffer>> m_bufferFiles;
+};
+
+}
+
+bool LoadGltf(const string& path, vector<MeshAsset>& meshes) {
+    GltfReader reader;
+    return reader.Load(path, meshes);
+}
+
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "../pch.h"
+#include "mesh_cache.h"
+
+// Native glTF 2.0 / GLB reader. Buffers come through the virtual file system
+// (memory-mapped or from a mounted archive) and accessors are read straight into
+// Renderer::Vertex. Every primitive becomes one MeshAsset, placed by the node
+// hierarchy of the default scene. Returns false for files that use features this
+// reader does not handle (data URIs, sparse accessors, non-triangle primitives,
+// embedded images, missing normals); callers fall back to Assimp then.
+bool LoadGltf(const string& path, vector<MeshAsset>& meshes);
+
@@ -0,0 +1,412 @@
+#include "image_kernels.h"
+
+#include "../pch.h"
+#include "../job_system.h"
+#include "../arena.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define IMAGE_KERNELS_X86
+    #include <immintrin.h>
+    // MSVC compiles any intrinsic without target flags, the CPU check happens at runtime
+    #if defined(_MSC_VER) && !defined(__clang__)
+        #define IMAGE_KERNELS_TARGET(isa)
+    #else
+        #define IMAGE_KERNELS_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+namespace {
+
+constexpr float KAISER_RADIUS = 3.0f;
+constexpr float KAISER_ALPHA  = 4.0f;
+
+// Fine enough that every sRGB value survives a round trip through linear
+constexpr u32 LINEAR_TO_SRGB_SIZE = 16384;
+
+// Texels per batch of rows, so that small levels stay on one thread
+constexpr u32 ROW_BATCH_TEXELS = 64 * 1024;
+
+struct ColorTables {
+    // [0, 256) sRGB to linear, [256, 512) UNORM to float; Load() indexes both at once
+    float toFloat[512];
+    u8    linearToSrgb[LINEAR_TO_SRGB_SIZE];
+    ColorTables() {
+        for (u32 i = 0; i < 256; i++) {
+            const float value = i / 255.0f;
+            toFloat[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+            toFloat[256 + i] = value;
+        }
+        for (u32 i = 0; i < LINEAR_TO_SRGB_SIZE; i++) {
+            const float linear = (float)i / (LINEAR_TO_SRGB_SIZE - 1);
+            const float srgb = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+            linearToSrgb[i] = (u8)(srgb * 255.0f + 0.5f);
+        }
+    }
+};
+const ColorTables s_colorTables;
+
+// Per destination texel: tapNum source indices (clamped to the edge) and normalized weights
+struct FilterTaps {
+    u32           tapNum = 0;
+    vector<u32>   indices;
+    vector<float> weights;
+};
+
+float BesselI0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    for (u32 k = 1; k < 32 && term > sum * 1e-8f; k++) {
+        term *= (x * x * 0.25f) / (float)(k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+float GetFilterRadius(ImageFilter filter) {
+    switch (filter) {
+        case ImageFilter_Box:      return 0.5f;
+        case ImageFilter_Triangle: return 1.0f;
+        default:                   return KAISER_RADIUS;
+    }
+}
+
+float EvaluateFilter(ImageFilter filter, float x) {
+    x = std::abs(x);
+    switch (filter) {
+        case ImageFilter_Box:
+            return x <= 0.5f ? 1.0f : 0.0f;
+        case ImageFilter_Triangle:
+            return std::max(1.0f - x, 0.0f);
+        default: {
+            if (x >= KAISER_RADIUS)
+                return 0.0f;
+            const float sinc = x < 1e-6f ? 1.0f : std::sin(glm::pi<float>() * x) / (glm::pi<float>() * x);
+            const float t = x / KAISER_RADIUS;
+            return sinc * BesselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / BesselI0(KAISER_ALPHA);
+        }
+    }
+}
+
+FilterTaps ComputeTaps(u32 srcSize, u32 dstSize, ImageFilter filter) {
+    const float scale   = (float)srcSize / dstSize;
+    const float stretch = std::max(scale, 1.0f); // Minifying widens the filter to cover every source texel
+    const float radius  = GetFilterRadius(filter) * stretch;
+
+    // Source texel centers within the radius of each destination texel center
+    vector<i32> firsts(dstSize), lasts(dstSize);
+    FilterTaps taps;
+    for (u32 dst = 0; dst < dstSize; dst++) {
+        const float center = (dst + 0.5f) * scale;
+        firsts[dst] = (i32)std::ceil(center - radius - 0.5f);
+        lasts[dst]  = std::max((i32)std::floor(center + radius - 0.5f), firsts[dst]);
+        taps.tapNum = std::max(taps.tapNum, (u32)(lasts[dst] - firsts[dst] + 1));
+    }
+
+    taps.indices.resize(dstSize * taps.tapNum);
+    taps.weights.resize(dstSize * taps.tapNum);
+    for (u32 dst = 0; dst < dstSize; dst++) {
+        const float center = (dst + 0.5f) * scale;
+        u32*   pIndices = &taps.indices[dst * taps.tapNum];
+        float* pWeights = &taps.weights[dst * taps.tapNum];
+        float sum = 0.0f;
+        for (u32 k = 0; k < taps.tapNum; k++) {
+            const i32 src = firsts[dst] + (i32)k;
+            pIndices[k] = (u32)std::clamp(src, 0, (i32)srcSize - 1);
+            pWeights[k] = src <= lasts[dst] ? EvaluateFilter(filter, (src + 0.5f - center) / stretch) : 0.0f;
+            sum += pWeights[k];
+        }
+        if (sum == 0.0f) {
+            pIndices[0] = std::min((u32)center, srcSize - 1);
+            pWeights[0] = sum = 1.0f;
+        }
+        for (u32 k = 0; k < taps.tapNum; k++)
+            pWeights[k] /= sum;
+    }
+    return taps;
+}
+
+// Row kernels. Pixels are 4 floats; srgb applies to RGB only
+struct Kernels {
+    const char* pName;
+    void (*pLoad)(const u8* pSrc, float* pDst, u32 pixelNum, bool srgb);
+    void (*pAccumulate)(float* pAccum, const float* pRow, float weight, u32 floatNum);
+    void (*pFilterRow)(const float* pSrc, const FilterTaps& taps, float* pDst, u32 dstWidth);
+    void (*pRenormalize)(float* pPixels, u32 pixelNum);
+    void (*pStore)(const float* pSrc, u8* pDst, u32 pixelNum, bool srgb);
+};
+
+u8 ToUnorm8(float value) {
+    return (u8)(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+u8 ToSrgb8(float value) {
+    return s_colorTables.linearToSrgb[(u32)(std::clamp(value, 0.0f, 1.0f) * (LINEAR_TO_SRGB_SIZE - 1) + 0.5f)];
+}
+
+void LoadScalar(const u8* pSrc, float* pDst, u32 pixelNum, bool srgb) {
+    const u32 colorTable = srgb ? 0 : 256;
+    for (u32 i = 0; i < pixelNum; i++) {
+        for (u32 channel = 0; channel < 3; channel++)
+            pDst[i * 4 + channel] = s_colorTables.toFloat[colorTable + pSrc[i * 4 + channel]];
+        pDst[i * 4 + 3] = s_colorTables.toFloat[256 + pSrc[i * 4 + 3]];
+    }
+}
+
+void AccumulateScalar(float* pAccum, const float* pRow, float weight, u32 floatNum) {
+    for (u32 i = 0; i < floatNum; i++)
+        pAccum[i] += pRow[i] * weight;
+}
+
+void FilterRowScalar(const float* pSrc, const FilterTaps& taps, float* pDst, u32 dstWidth) {
+    for (u32 x = 0; x < dstWidth; x++) {
+        float sum[4] = {};
+        for (u32 k = 0; k < taps.tapNum; k++) {
+            const float* pPixel = pSrc + taps.indices[x * taps.tapNum + k] * 4;
+            const float weight = taps.weights[x * taps.tapNum + k];
+            for (u32 channel = 0; channel < 4; channel++)
+                sum[channel] += pPixel[channel] * weight;
+        }
+        SDL_memcpy(pDst + x * 4, sum, sizeof(sum));
+    }
+}
+
+void RenormalizeScalar(float* pPixels, u32 pixelNum) {
+    for (u32 i = 0; i < pixelNum; i++) {
+        float* pPixel = pPixels + i * 4;
+        const glm::vec3 normal = glm::vec3(pPixel[0], pPixel[1], pPixel[2]) * 2.0f - 1.0f;
+        const float length = glm::length(normal);
+        if (length == 0.0f)
+            continue;
+        for (u32 channel = 0; channel < 3; channel++)
+            pPixel[channel] = normal[channel] / length * 0.5f + 0.5f;
+    }
+}
+
+void StoreScalar(const float* pSrc, u8* pDst, u32 pixelNum, bool srgb) {
+    for (u32 i = 0; i < pixelNum; i++) {
+        for (u32 channel = 0; channel < 3; channel++)
+            pDst[i * 4 + channel] = srgb ? ToSrgb8(pSrc[i * 4 + channel]) : ToUnorm8(pSrc[i * 4 + channel]);
+        pDst[i * 4 + 3] = ToUnorm8(pSrc[i * 4 + 3]);
+    }
+}
+
+const Kernels SCALAR_KERNELS = { "scalar", LoadScalar, AccumulateScalar, FilterRowScalar, RenormalizeScalar, StoreScalar };
+
+#ifdef IMAGE_KERNELS_X86
+IMAGE_KERNELS_TARGET("sse4.1")
+void LoadSse41(const u8* pSrc, float* pDst, u32 pixelNum, bool srgb) {
+    // sRGB needs a table lookup per channel, there is no gather before AVX2
+    if (srgb) {
+        LoadScalar(pSrc, pDst, pixelNum, srgb);
+        return;
+    }
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+    for (u32 i = 0; i < pixelNum; i++) {
+        i32 pixel;
+        SDL_memcpy(&pixel, pSrc + i * 4, 4);
+        const __m128i values = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(pixel));
+        _mm_storeu_ps(pDst + i * 4, _mm_mul_ps(_mm_cvtepi32_ps(values), scale));
+    }
+}
+
+IMAGE_KERNELS_TARGET("sse4.1")
+void AccumulateSse41(float* pAccum, const float* pRow, float weight, u32 floatNum) {
+    const __m128 weights = _mm_set1_ps(weight);
+    u32 i = 0;
+    for (; i + 4 <= floatNum; i += 4)
+        _mm_storeu_ps(pAccum + i, _mm_add_ps(_mm_loadu_ps(pAccum + i), _mm_mul_ps(_mm_loadu_ps(pRow + i), weights)));
+    AccumulateScalar(pAccum + i, pRow + i, weight, floatNum - i);
+}
+
+IMAGE_KERNELS_TARGET("sse4.1")
+void FilterRowSse41(const float* pSrc, const FilterTaps& taps, float* pDst, u32 dstWidth) {
+    for (u32 x = 0; x < dstWidth; x++) {
+        const u32*   pIndices = &taps.indices[x * taps.tapNum];
+        const float* pWeights = &taps.weights[x * taps.tapNum];
+        __m128 sum = _mm_setzero_ps();
+        for (u32 k = 0; k < taps.tapNum; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pSrc + pIndices[k] * 4), _mm_set1_ps(pWeights[k])));
+        _mm_storeu_ps(pDst + x * 4, sum);
+    }
+}
+
+IMAGE_KERNELS_TARGET("sse4.1")
+void RenormalizeSse41(float* pPixels, u32 pixelNum) {
+    const __m128 two = _mm_set1_ps(2.0f), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+    for (u32 i = 0; i < pixelNum; i++) {
+        const __m128 pixel  = _mm_loadu_ps(pPixels + i * 4);
+        const __m128 normal = _mm_sub_ps(_mm_mul_ps(pixel, two), one);
+        const __m128 lengthSq = _mm_dp_ps(normal, normal, 0x7F); // XYZ only, broadcast
+        if (_mm_cvtss_f32(lengthSq) == 0.0f)
+            continue;
+        const __m128 unit = _mm_div_ps(normal, _mm_sqrt_ps(lengthSq));
+        _mm_storeu_ps(pPixels + i * 4, _mm_blend_ps(_mm_add_ps(_mm_mul_ps(unit, half), half), pixel, 0x8));
+    }
+}
+
+IMAGE_KERNELS_TARGET("sse4.1")
+void StoreSse41(const float* pSrc, u8* pDst, u32 pixelNum, bool srgb) {
+    if (srgb) {
+        StoreScalar(pSrc, pDst, pixelNum, srgb);
+        return;
+    }
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(255.0f);
+    u32 i = 0;
+    for (; i + 4 <= pixelNum; i += 4) {
+        __m128i values[4];
+        for (u32 j = 0; j < 4; j++) {
+            const __m128 clamped = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pSrc + (i + j) * 4), zero), one);
+            values[j] = _mm_cvtps_epi32(_mm_mul_ps(clamped, scale));
+        }
+        const __m128i packed = _mm_packus_epi16(_mm_packus_epi32(values[0], values[1]), _mm_packus_epi32(values[2], values[3]));
+        _mm_storeu_si128((__m128i*)(pDst + i * 4), packed);
+    }
+    StoreScalar(pSrc + i * 4, pDst + i * 4, pixelNum - i, srgb);
+}
+
+IMAGE_KERNELS_TARGET("avx2")
+void LoadAvx2(const u8* pSrc, float* pDst, u32 pixelNum, bool srgb) {
+    // Two pixels per register; the table offset picks sRGB or UNORM per lane, alpha is always UNORM
+    const __m256i tableOffsets = srgb ? _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256) : _mm256_set1_epi32(256);
+    u32 i = 0;
+    for (; i + 2 <= pixelNum; i += 2) {
+        const __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pSrc + i * 4)));
+        _mm256_storeu_ps(pDst + i * 4, _mm256_i32gather_ps(s_colorTables.toFloat, _mm256_add_epi32(bytes, tableOffsets), 4));
+    }
+    LoadScalar(pSrc + i * 4, pDst + i * 4, pixelNum - i, srgb);
+}
+
+// No FMA: SDL has no check for it, and unfused it rounds like the other kernels
+IMAGE_KERNELS_TARGET("avx2")
+void AccumulateAvx2(float* pAccum, const float* pRow, float weight, u32 floatNum) {
+    const __m256 weights = _mm256_set1_ps(weight);
+    u32 i = 0;
+    for (; i + 8 <= floatNum; i += 8)
+        _mm256_storeu_ps(pAccum + i, _mm256_add_ps(_mm256_loadu_ps(pAccum + i), _mm256_mul_ps(_mm256_loadu_ps(pRow + i), weights)));
+    AccumulateScalar(pAccum + i, pRow + i, weight, floatNum - i);
+}
+
+const Kernels SSE41_KERNELS = { "SSE4.1", LoadSse41, AccumulateSse41, FilterRowSse41, RenormalizeSse41, StoreSse41 };
+const Kernels AVX2_KERNELS  = { "AVX2", LoadAvx2, AccumulateAvx2, FilterRowSse41, RenormalizeSse41, StoreSse41 };
+#endif
+
+const Kernels& GetKernels() {
+    static const Kernels& kernels = []() -> const Kernels& {
+        const Kernels* pKernels = &SCALAR_KERNELS;
+#ifdef IMAGE_KERNELS_X86
+        if (SDL_HasAVX2() && SDL_HasSSE41())
+            pKernels = &AVX2_KERNELS;
+        else if (SDL_HasSSE41())
+            pKernels = &SSE41_KERNELS;
+#endif
+        SDL_Log("Image kernels: %s", pKernels->pName);
+        return *pKernels;
+    }();
+    return kernels;
+}
+
+u32 GetRowBatchSize(u32 width) {
+    return std::max(ROW_BATCH_TEXELS / std::max(width, 1u), 1u);
+}
+
+}
+
+void ResizeImage(const u8* pSrc, u32 srcWidth, u32 srcHeight, u8* pDst, u32 dstWidth, u32 dstHeight, ImageFilter filter, u32 flags) {
+    const FilterTaps horizontalTaps = ComputeTaps(srcWidth, dstWidth, filter);
+    const FilterTaps verticalTaps   = ComputeTaps(srcHeight, dstHeight, filter);
+    const Kernels& kernels = GetKernels();
+    const bool srgb = flags & ImageFlags_Srgb;
+
+    // Vertical pass into one linear source-wide row, then the horizontal pass straight to the output
+    JobSystem::GetInstance().ParallelFor(dstHeight, GetRowBatchSize(srcWidth), [&](u32 begin, u32 end) {
+        vector<float> sourceRow(srcWidth * 4), column(srcWidth * 4), filteredRow(dstWidth * 4);
+        for (u32 y = begin; y < end; y++) {
+            std::fill(column.begin(), column.end(), 0.0f);
+            for (u32 k = 0; k < verticalTaps.tapNum; k++) {
+                const float weight = verticalTaps.weights[y * verticalTaps.tapNum + k];
+                if (weight == 0.0f)
+                    continue;
+                const u32 srcY = verticalTaps.indices[y * verticalTaps.tapNum + k];
+                kernels.pLoad(pSrc + (u64)srcY * srcWidth * 4, sourceRow.data(), srcWidth, srgb);
+                kernels.pAccumulate(column.data(), sourceRow.data(), weight, srcWidth * 4);
+            }
+            kernels.pFilterRow(column.data(), horizontalTaps, filteredRow.data(), dstWidth);
+            if (flags & ImageFlags_NormalMap)
+                kernels.pRenormalize(filteredRow.data(), dstWidth);
+            kernels.pStore(filteredRow.data(), pDst + (u64)y * dstWidth * 4, dstWidth, srgb);
+        }
+    });
+}
+
+u32 GetMipLevelNum(u32 width, u32 height) {
+    u32 levelNum = 1;
+    while (std::max(width, height) >> levelNum)
+        levelNum++;
+    return levelNum;
+}
+
+u32 GetMipSize(u32 size, u32 mip) {
+    return std::max(size >> mip, 1u);
+}
+
+Renderer::TextureData GenerateMips(const Renderer::TextureData& rgba, ImageFilter filter, u32 flags) {
+    SDL_assert(rgba.format == SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM && rgba.mipLevelNum == 1);
+
+    Renderer::TextureData mips = rgba;
+    mips.mipLevelNum = GetMipLevelNum(rgba.width, rgba.height);
+    u8* pData = (u8*)ScopedAlloc(Renderer::GetTextureDataSize(mips));
+    mips.pPixels = pData;
+
+    // The output is only written, it may be mapped transfer memory; levels are filtered from a scratch copy
+    const u64 baseSize = (u64)rgba.width * rgba.height * 4;
+    SDL_memcpy(pData, rgba.pPixels, baseSize);
+    ScratchScope scratch;
+    const u8* pPrevious = (const u8*)rgba.pPixels;
+    u8* pLevels[2]; // Odd and even levels, sized for the largest of each
+    for (u32 i = 0; i < 2; i++)
+        pLevels[i] = (u8*)ScopedAlloc((u64)GetMipSize(rgba.width, i + 1) * GetMipSize(rgba.height, i + 1) * 4);
+    u8* pLevel = pData + baseSize;
+    for (u32 mip = 1; mip < mips.mipLevelNum; mip++) {
+        const u32 srcWidth  = GetMipSize(rgba.width, mip - 1), srcHeight = GetMipSize(rgba.height, mip - 1);
+        const u32 dstWidth  = GetMipSize(rgba.width, mip),     dstHeight = GetMipSize(rgba.height, mip);
+        const u64 levelSize = (u64)dstWidth * dstHeight * 4;
+        u8* pFiltered = pLevels[(mip - 1) % 2];
+        ResizeImage(pPrevious, srcWidth, srcHeight, pFiltered, dstWidth, dstHeight, filter, flags);
+        SDL_memcpy(pLevel, pFiltered, levelSize);
+        pPrevious = pFiltered;
+        pLevel += levelSize;
+    }
+    return mips;
+}
+
+void PackImageChannels(const array<const u8*, 4>& pSources, const array<u8, 4>& channels, u8* pDst, u64 pixelNum) {
+    JobSystem::GetInstance().ParallelFor((pixelNum + ROW_BATCH_TEXELS - 1) / ROW_BATCH_TEXELS, 1, [&](u32 begin, u32 end) {
+        const u64 first = (u64)begin * ROW_BATCH_TEXELS;
+        const u64 last  = std::min((u64)end * ROW_BATCH_TEXELS, pixelNum);
+        for (u32 channel = 0; channel < 4; channel++) {
+            const u8 source = channels[channel];
+            if (source >= ImageChannel_Zero || pSources[channel] == nullptr) {
+                const u8 value = source == ImageChannel_One ? 255 : 0;
+                for (u64 i = first; i < last; i++)
+                    pDst[i * 4 + channel] = value;
+                continue;
+            }
+            const u8* pSrc = pSources[channel];
+            for (u64 i = first; i < last; i++)
+                pDst[i * 4 + channel] = pSrc[i * 4 + source];
+        }
+    });
+}
+
+void RenormalizeNormals(u8* pPixels, u64 pixelNum) {
+    const Kernels& kernels = GetKernels();
+    JobSystem::GetInstance().ParallelFor((pixelNum + ROW_BATCH_TEXELS - 1) / ROW_BATCH_TEXELS, 1, [&](u32 begin, u32 end) {
+        vector<float> pixels(ROW_BATCH_TEXELS * 4);
+        for (u32 batch = begin; batch < end; batch++) {
+            const u64 first = (u64)batch * ROW_BATCH_TEXELS;
+            const u32 count = (u32)std::min<u64>(ROW_BATCH_TEXELS, pixelNum - first);
+            kernels.pLoad(pPixels + first * 4, pixels.data(), count, false);
+            kernels.pRenormalize(pixels.data(), count);
+            kernels.pStore(pixels.data(), pPixels + first * 4, count, false);
+        }
+    });
+}
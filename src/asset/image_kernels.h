@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+// CPU image processing on tightly packed RGBA8 images. Filtering happens in linear
+// float space one destination row at a time, rows are spread over the job system.
+// Kernels are picked at startup: AVX2, SSE4.1 or scalar.
+
+enum ImageFilter {
+    ImageFilter_Box = 0,  // 2x2 average for mips
+    ImageFilter_Triangle,
+    ImageFilter_Kaiser,   // Kaiser-windowed sinc (radius 3, alpha 4), sharper mips
+    ImageFilterCount
+};
+
+enum ImageFlags {
+    ImageFlags_None      = 0,
+    ImageFlags_Srgb      = 1 << 0, // RGB is sRGB encoded and filtered in linear space, alpha is linear
+    ImageFlags_NormalMap = 1 << 1, // XYZ in [0, 1] is renormalized after filtering
+};
+
+// Sources of PackImageChannels() without an image
+enum ImageChannel : u8 {
+    ImageChannel_Zero = 4,
+    ImageChannel_One  = 5,
+};
+
+// Separable resampling to any size; the filter widens when minifying
+void ResizeImage(const u8* pSrc, u32 srcWidth, u32 srcHeight, u8* pDst, u32 dstWidth, u32 dstHeight, ImageFilter filter, u32 flags);
+
+// Levels of a full chain down to 1x1, and the size of level mip
+u32 GetMipLevelNum(u32 width, u32 height);
+u32 GetMipSize(u32 size, u32 mip);
+
+// Full mip chain of an RGBA8 image in the TextureData layout (largest first, back to
+// back), every level filtered from the previous one. Allocated with ScopedAlloc()
+Renderer::TextureData GenerateMips(const Renderer::TextureData& rgba, ImageFilter filter, u32 flags);
+
+// pDst[i].channel[c] = pSources[c][i].channel[channels[c]], or the ImageChannel constant
+// when channels[c] is one; pSources entries may repeat or be null for constants.
+// Swizzling is packing from a single source
+void PackImageChannels(const array<const u8*, 4>& pSources, const array<u8, 4>& channels, u8* pDst, u64 pixelNum);
+
+// In place, for normal maps that were edited or resized without renormalizing
+void RenormalizeNormals(u8* pPixels, u64 pixelNum);
@@ -0,0 +1,299 @@
+#include "json.h"
+
+#include "../pch.h"
+
+namespace {
+
+const JsonValue& GetNullValue() {
+    static const JsonValue nullValue;
+    return nullValue;
+}
+
+const string& GetEmptyString() {
+    static const string emptyString;
+    return emptyString;
+}
+
+void AppendUtf8(string& str, u32 codepoint) {
+    if (codepoint < 0x80) {
+        str += (char)codepoint;
+    }
+    else if (codepoint < 0x800) {
+        str += (char)(0xC0 | (codepoint >> 6));
+        str += (char)(0x80 | (codepoint & 0x3F));
+    }
+    else if (codepoint < 0x10000) {
+        str += (char)(0xE0 | (codepoint >> 12));
+        str += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        str += (char)(0x80 | (codepoint & 0x3F));
+    }
+    else {
+        str += (char)(0xF0 | (codepoint >> 18));
+        str += (char)(0x80 | ((codepoint >> 12) & 0x3F));
+        str += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        str += (char)(0x80 | (codepoint & 0x3F));
+    }
+}
+
+}
+
+// Recursive descent over the whole text
+class JsonParser {
+public:
+    JsonParser(const char* pText, u64 size) : m_pCur(pText), m_pEnd(pText + size) {}
+
+    bool ParseDocument(JsonValue& root, string& error) {
+        SkipWhitespace();
+        if (!ParseValue(root, 0)) {
+            error = m_error;
+            return false;
+        }
+        SkipWhitespace();
+        if (m_pCur != m_pEnd) {
+            error = "Trailing characters after the JSON document";
+            return false;
+        }
+        return true;
+    }
+private:
+    static constexpr u32 MAX_DEPTH = 256;
+
+    bool Fail(const char* message) {
+        m_error = message;
+        return false;
+    }
+
+    void SkipWhitespace() {
+        while (m_pCur < m_pEnd && (*m_pCur == ' ' || *m_pCur == '\t' || *m_pCur == '\n' || *m_pCur == '\r'))
+            m_pCur++;
+    }
+
+    bool Consume(char c) {
+        SkipWhitespace();
+        if (m_pCur < m_pEnd && *m_pCur == c) {
+            m_pCur++;
+            return true;
+        }
+        return false;
+    }
+
+    bool ParseLiteral(const char* pLiteral) {
+        const u64 length = SDL_strlen(pLiteral);
+        if ((u64)(m_pEnd - m_pCur) < length || SDL_memcmp(m_pCur, pLiteral, length) != 0)
+            return Fail("Invalid literal");
+        m_pCur += length;
+        return true;
+    }
+
+    bool ParseValue(JsonValue& value, u32 depth) {
+        if (depth > MAX_DEPTH)
+            return Fail("JSON nesting too deep");
+        SkipWhitespace();
+        if (m_pCur == m_pEnd)
+            return Fail("Unexpected end of JSON");
+
+        switch (*m_pCur) {
+            case '{': return ParseObject(value, depth);
+            case '[': return ParseArray(value, depth);
+            case '"':
+                value.m_type = JsonValue::Type_String;
+                return ParseString(value.m_string);
+            case 't':
+                value.m_type = JsonValue::Type_Bool;
+                value.m_bool = true;
+                return ParseLiteral("true");
+            case 'f':
+                value.m_type = JsonValue::Type_Bool;
+                value.m_bool = false;
+                return ParseLiteral("false");
+            case 'n':
+                value.m_type = JsonValue::Type_Null;
+                return ParseLiteral("null");
+            default:
+                return ParseNumber(value);
+        }
+    }
+
+    bool ParseObject(JsonValue& value, u32 depth) {
+        value.m_type = JsonValue::Type_Object;
+        m_pCur++;
+        if (Consume('}'))
+            return true;
+        do {
+            SkipWhitespace();
+            if (m_pCur == m_pEnd || *m_pCur != '"')
+                return Fail("Expected an object key");
+            JsonValue::Member& member = value.m_members.emplace_back();
+            if (!ParseString(member.first))
+                return false;
+            if (!Consume(':'))
+                return Fail("Expected ':' after an object key");
+            if (!ParseValue(member.second, depth + 1))
+                return false;
+        } while (Consume(','));
+        return Consume('}') || Fail("Expected '}'");
+    }
+
+    bool ParseArray(JsonValue& value, u32 depth) {
+        value.m_type = JsonValue::Type_Array;
+        m_pCur++;
+        if (Consume(']'))
+            return true;
+        do {
+            if (!ParseValue(value.m_elements.emplace_back(), depth + 1))
+                return false;
+        } while (Consume(','));
+        return Consume(']') || Fail("Expected ']'");
+    }
+
+    bool ParseHex4(u32& codepoint) {
+        if (m_pEnd - m_pCur < 4)
+            return Fail("Truncated unicode escape");
+        codepoint = 0;
+        for (u32 i = 0; i < 4; i++) {
+            const char c = *m_pCur++;
+            codepoint <<= 4;
+            if (c >= '0' && c <= '9')      codepoint |= c - '0';
+            else if (c >= 'a' && c <= 'f') codepoint |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') codepoint |= c - 'A' + 10;
+            else return Fail("Invalid unicode escape");
+        }
+        return true;
+    }
+
+    bool ParseString(string& str) {
+        m_pCur++;
+        while (m_pCur < m_pEnd && *m_pCur != '"') {
+            if (*m_pCur != '\\') {
+                str += *m_pCur++;
+                continue;
+            }
+            if (++m_pCur == m_pEnd)
+                break;
+            const char escaped = *m_pCur++;
+            switch (escaped) {
+                case '"':  str += '"';  break;
+                case '\\': str += '\\'; break;
+                case '/':  str += '/';  break;
+                case 'b':  str += '\b'; break;
+                case 'f':  str += '\f'; break;
+                case 'n':  str += '\n'; break;
+                case 'r':  str += '\r'; break;
+                case 't':  str += '\t'; break;
+                case 'u': {
+                    u32 codepoint;
+                    if (!ParseHex4(codepoint))
+                        return false;
+                    // Surrogate pair
+                    if (codepoint >= 0xD800 && codepoint < 0xDC00 && m_pEnd - m_pCur >= 6 && m_pCur[0] == '\\' && m_pCur[1] == 'u') {
+                        m_pCur += 2;
+                        u32 low;
+                        if (!ParseHex4(low))
+                            return false;
+                        codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    AppendUtf8(str, codepoint);
+                    break;
+                }
+                default:
+                    return Fail("Invalid escape sequence");
+            }
+        }
+        if (m_pCur == m_pEnd)
+            return Fail("Unterminated string");
+        m_pCur++;
+        return true;
+    }
+
+    bool ParseNumber(JsonValue& value) {
+        // Copy the token out because the text is not null terminated
+        const char* pStart = m_pCur;
+        while (m_pCur < m_pEnd && (SDL_isdigit(*m_pCur) || *m_pCur == '-' || *m_pCur == '+' || *m_pCur == '.' || *m_pCur == 'e' || *m_pCur == 'E'))
+            m_pCur++;
+        if (m_pCur == pStart)
+            return Fail("Unexpected character");
+
+        char buffer[64];
+        const u64 length = std::min<u64>(m_pCur - pStart, sizeof(buffer) - 1);
+        SDL_memcpy(buffer, pStart, length);
+        buffer[length] = '\0';
+
+        char* pParseEnd;
+        value.m_type   = JsonValue::Type_Number;
+        value.m_number = SDL_strtod(buffer, &pParseEnd);
+        if (pParseEnd != buffer + length)
+            return Fail("Invalid number");
+        return true;
+    }
+
+    const char* m_pCur;
+    const char* m_pEnd;
+    string      m_error;
+};
+
+JsonValue::Type JsonValue::GetType() const {
+    return m_type;
+}
+
+bool JsonValue::IsNull() const {
+    return m_type == Type_Null;
+}
+
+bool JsonValue::GetBool(bool fallback) const {
+    return m_type == Type_Bool ? m_bool : fallback;
+}
+
+double JsonValue::GetNumber(double fallback) const {
+    return m_type == Type_Number ? m_number : fallback;
+}
+
+i64 JsonValue::GetInt(i64 fallback) const {
+    return m_type == Type_Number ? (i64)m_number : fallback;
+}
+
+const string& JsonValue::GetString() const {
+    return m_type == Type_String ? m_string : GetEmptyString();
+}
+
+u32 JsonValue::GetSize() const {
+    if (m_type == Type_Array)
+        return m_elements.size();
+    if (m_type == Type_Object)
+        return m_members.size();
+    return 0;
+}
+
+bool JsonValue::Contains(const string& key) const {
+    return !(*this)[key].IsNull();
+}
+
+const JsonValue& JsonValue::operator[](u32 idx) const {
+    if (m_type != Type_Array || idx >= m_elements.size())
+        return GetNullValue();
+    return m_elements[idx];
+}
+
+const JsonValue& JsonValue::operator[](const string& key) const {
+    if (m_type != Type_Object)
+        return GetNullValue();
+    for (const Member& member : m_members) {
+        if (member.first == key)
+            return member.second;
+    }
+    return GetNullValue();
+}
+
+const vector<JsonValue>& JsonValue::GetElements() const {
+    return m_elements;
+}
+
+const vector<JsonValue::Member>& JsonValue::GetMembers() const {
+    return m_members;
+}
+
+bool ParseJson(const char* pText, u64 size, JsonValue& root, string& error) {
+    root = JsonValue();
+    JsonParser parser(pText, size);
+    return parser.ParseDocument(root, error);
+}
+
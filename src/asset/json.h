@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../pch.h"
+
+// Minimal read-only JSON document, enough for asset manifests such as glTF.
+// Lookups of missing keys or out of range indices return a shared null value,
+// so chains like json["a"][0]["b"].GetNumber() never need intermediate checks.
+class JsonValue {
+public:
+    enum Type {
+        Type_Null = 0,
+        Type_Bool,
+        Type_Number,
+        Type_String,
+        Type_Array,
+        Type_Object
+    };
+    using Member = std::pair<string, JsonValue>;
+
+    Type GetType() const;
+    bool IsNull() const;
+    bool GetBool(bool fallback = false) const;
+    double GetNumber(double fallback = 0.0) const;
+    i64 GetInt(i64 fallback = 0) const;
+    const string& GetString() const;
+    u32 GetSize() const; // Elements of an array or members of an object
+    bool Contains(const string& key) const;
+    const JsonValue& operator[](u32 idx) const;
+    const JsonValue& operator[](const string& key) const;
+    const vector<JsonValue>& GetElements() const;
+    const vector<Member>& GetMembers() const;
+private:
+    friend class JsonParser;
+
+    Type              m_type   = Type_Null;
+    bool              m_bool   = false;
+    double            m_number = 0.0;
+    string            m_string;
+    vector<JsonValue> m_elements;
+    vector<Member>    m_members;
+};
+
+bool ParseJson(const char* pText, u64 size, JsonValue& root, string& error);
+
@@ -0,0 +1,177 @@
+#include "lz4.h"
+
+#include "../pch.h"
+
+namespace {
+
+constexpr u32 MIN_MATCH     = 4;
+constexpr u32 LAST_LITERALS = 5;  // The block always ends with at least this many literals
+constexpr u32 MATCH_LIMIT   = 12; // No match may start in the last 12 bytes
+constexpr u32 MAX_OFFSET    = 65535;
+constexpr u32 HASH_BITS     = 16;
+constexpr u32 SKIP_TRIGGER  = 6;  // Incompressible data is scanned with growing steps
+
+u32 Read32(const u8* p) {
+    u32 value;
+    SDL_memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+u32 Hash4(u32 sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Length fields above 15 continue in bytes of 255
+u8* WriteLength(u8* pOut, u64 length) {
+    while (length >= 255) {
+        *pOut++ = 255;
+        length -= 255;
+    }
+    *pOut++ = (u8)length;
+    return pOut;
+}
+
+bool ReadLength(const u8*& pIn, const u8* pInEnd, u64& length) {
+    u8 byte;
+    do {
+        if (pIn >= pInEnd)
+            return false;
+        byte = *pIn++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+}
+
+u64 Lz4CompressBound(u64 srcSize) {
+    return srcSize + srcSize / 255 + 16;
+}
+
+u64 Lz4Compress(const u8* pSrc, u64 srcSize, u8* pDst, u64 dstCapacity) {
+    // Positions plus one, 0 marks an empty slot
+    vector<u32> table(1 << HASH_BITS, 0);
+
+    const u8* pIn     = pSrc;
+    const u8* pAnchor = pSrc;
+    const u8* pEnd    = pSrc + srcSize;
+    u8*       pOut    = pDst;
+    u8* const pOutEnd = pDst + dstCapacity;
+
+    auto emitSequence = [&](const u8* pLiteralEnd, u32 offset, u64 matchLength) {
+        const u64 literalLength = pLiteralEnd - pAnchor;
+        const u64 worstSize = 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1;
+        if ((u64)(pOutEnd - pOut) < worstSize)
+            return false;
+
+        u8* pToken = pOut++;
+        *pToken = (u8)(std::min<u64>(literalLength, 15) << 4);
+        if (literalLength >= 15)
+            pOut = WriteLength(pOut, literalLength - 15);
+        SDL_memcpy(pOut, pAnchor, literalLength);
+        pOut += literalLength;
+
+        // The last sequence has literals only
+        if (matchLength == 0)
+            return true;
+        *pOut++ = (u8)(offset & 0xFF);
+        *pOut++ = (u8)(offset >> 8);
+        const u64 matchCode = matchLength - MIN_MATCH;
+        *pToken |= (u8)std::min<u64>(matchCode, 15);
+        if (matchCode >= 15)
+            pOut = WriteLength(pOut, matchCode - 15);
+        return true;
+    };
+
+    if (srcSize > MATCH_LIMIT) {
+        const u8* pMatchLimit = pEnd - MATCH_LIMIT;
+        const u8* pExtendLimit = pEnd - LAST_LITERALS;
+        u32 missNum = 0;
+        while (pIn < pMatchLimit) {
+            const u32 sequence = Read32(pIn);
+            const u32 hash = Hash4(sequence);
+            const u32 candidate = table[hash];
+            table[hash] = (u32)(pIn - pSrc) + 1;
+
+            const u8* pRef = pSrc + candidate - 1;
+            if (candidate == 0 || pIn - pRef > MAX_OFFSET || Read32(pRef) != sequence) {
+                pIn += 1 + (missNum++ >> SKIP_TRIGGER);
+                continue;
+            }
+            missNum = 0;
+
+            const u8* pMatchEnd = pIn + MIN_MATCH;
+            const u8* pRefEnd   = pRef + MIN_MATCH;
+            while (pMatchEnd < pExtendLimit && *pMatchEnd == *pRefEnd) {
+                pMatchEnd++;
+                pRefEnd++;
+            }
+            while (pIn > pAnchor && pRef > pSrc && pIn[-1] == pRef[-1]) {
+                pIn--;
+                pRef--;
+            }
+
+            if (!emitSequence(pIn, (u32)(pIn - pRef), pMatchEnd - pIn))
+                return 0;
+            pIn = pAnchor = pMatchEnd;
+            // Keep the table warm across the skipped match
+            if (pIn - 2 >= pSrc && pIn < pMatchLimit)
+                table[Hash4(Read32(pIn - 2))] = (u32)(pIn - 2 - pSrc) + 1;
+        }
+    }
+
+    if (!emitSequence(pEnd, 0, 0))
+        return 0;
+    return pOut - pDst;
+}
+
+bool Lz4Decompress(const u8* pSrc, u64 srcSize, u8* pDst, u64 dstSize) {
+    const u8*       pIn     = pSrc;
+    const u8* const pInEnd  = pSrc + srcSize;
+    u8*             pOut    = pDst;
+    u8* const       pOutEnd = pDst + dstSize;
+
+    while (true) {
+        if (pIn >= pInEnd)
+            return false;
+        const u8 token = *pIn++;
+
+        u64 literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(pIn, pInEnd, literalLength))
+            return false;
+        if (literalLength > (u64)(pInEnd - pIn) || literalLength > (u64)(pOutEnd - pOut))
+            return false;
+        SDL_memcpy(pOut, pIn, literalLength);
+        pIn  += literalLength;
+        pOut += literalLength;
+
+        if (pIn == pInEnd)
+            return pOut == pOutEnd;
+
+        if (pInEnd - pIn < 2)
+            return false;
+        const u32 offset = pIn[0] | pIn[1] << 8;
+        pIn += 2;
+        if (offset == 0 || offset > (u64)(pOut - pDst))
+            return false;
+
+        u64 matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(pIn, pInEnd, matchLength))
+            return false;
+        matchLength += MIN_MATCH;
+        if (matchLength > (u64)(pOutEnd - pOut))
+            return false;
+
+        const u8* pMatch = pOut - offset;
+        if (offset >= matchLength) {
+            SDL_memcpy(pOut, pMatch, matchLength);
+            pOut += matchLength;
+        }
+        else {
+            // Overlapping copy repeats the last offset bytes
+            for (u64 i = 0; i < matchLength; i++)
+                *pOut++ = pMatch[i];
+        }
+    }
+}
+
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "../pch.h"
+
+// LZ4 block format (no frame header), compatible with the reference decoder
+
+// Worst-case compressed size of srcSize bytes
+u64 Lz4CompressBound(u64 srcSize);
+// Returns the compressed size, 0 if it does not fit in dstCapacity
+u64 Lz4Compress(const u8* pSrc, u64 srcSize, u8* pDst, u64 dstCapacity);
+// dstSize is the exact decompressed size; returns false on malformed input
+bool Lz4Decompress(const u8* pSrc, u64 srcSize, u8* pDst, u64 dstSize);
+
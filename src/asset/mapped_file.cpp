@@ -0,0 +1,138 @@
+#include "mapped_file.h"
+
+#include "../pch.h"
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this == &other)
+        return *this;
+    Close();
+    m_pData = std::exchange(other.m_pData, nullptr);
+    m_size  = std::exchange(other.m_size, 0);
+#ifdef _WIN32
+    m_hFile    = std::exchange(other.m_hFile, nullptr);
+    m_hMapping = std::exchange(other.m_hMapping, nullptr);
+#else
+    m_fd = std::exchange(other.m_fd, -1);
+#endif
+    return *this;
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const string& path) {
+    Close();
+
+    HANDLE hFile = CreateFileA(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+    );
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (hMapping == nullptr) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    void* pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (pData == nullptr) {
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return false;
+    }
+
+    m_hFile    = hFile;
+    m_hMapping = hMapping;
+    m_pData    = (const u8*)pData;
+    m_size     = size.QuadPart;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (m_pData != nullptr)
+        UnmapViewOfFile(m_pData);
+    if (m_hMapping != nullptr)
+        CloseHandle(m_hMapping);
+    if (m_hFile != nullptr)
+        CloseHandle(m_hFile);
+    m_pData    = nullptr;
+    m_size     = 0;
+    m_hMapping = nullptr;
+    m_hFile    = nullptr;
+}
+#else
+bool MappedFile::Open(const string& path) {
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* pData = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pData == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    madvise(pData, st.st_size, MADV_SEQUENTIAL);
+
+    m_fd    = fd;
+    m_pData = (const u8*)pData;
+    m_size  = st.st_size;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (m_pData != nullptr)
+        munmap((void*)m_pData, m_size);
+    if (m_fd >= 0)
+        close(m_fd);
+    m_pData = nullptr;
+    m_size  = 0;
+    m_fd    = -1;
+}
+#endif
+
+bool MappedFile::IsOpen() const {
+    return m_pData != nullptr;
+}
+
+const u8* MappedFile::GetData() const {
+    return m_pData;
+}
+
+u64 MappedFile::GetSize() const {
+    return m_size;
+}
+
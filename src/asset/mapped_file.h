@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../pch.h"
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    void operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    bool Open(const string& path);
+    void Close();
+    bool IsOpen() const;
+    const u8* GetData() const;
+    u64 GetSize() const;
+private:
+    const u8* m_pData = nullptr;
+    u64       m_size  = 0;
+#ifdef _WIN32
+    void* m_hFile    = nullptr;
+    void* m_hMapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
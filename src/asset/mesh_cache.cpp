@@ -0,0 +1,311 @@
+#include "mesh_cache.h"
+
+#include "../pch.h"
+#include "file_system.h"
+#include "geometry_codec.h"
+#include "../job_system.h"
+#include "../hash.h"
+
+namespace {
+
+struct FileHeader {
+    u32 magic;
+    u32 version;
+    u64 sourceSize;
+    i64 sourceTime;
+    u32 meshNum;
+    u32 bakeFlags;
+};
+
+struct MeshHeader {
+    Renderer::Mat4 transform;
+    Renderer::Vec3 boundsCenter;
+    float boundsRadius;
+    u32 vertexNum;
+    u32 indexNum;
+    u32 meshletNum;
+    u32 lodNum;
+    u32 encodedVertexSize; // Vertex and index sections are stored with asset/geometry_codec.h
+    u32 encodedIndexSize;
+    u32 nameLength;
+    u32 texturePathLengths[Renderer::TextureCount];
+    u32 instanceNum;
+    u64 geometryKey; // Renderer::GetGeometryKey() of the full precision geometry, as the import path hashes it
+};
+
+struct InstanceHeader {
+    Renderer::Mat4 transform;
+    u32 nameLength;
+};
+
+constexpr u64 SECTION_ALIGNMENT = 8;
+
+u64 AlignUp(u64 value, u64 alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool GetSourceStamp(const string& modelPath, u64& size, i64& time) {
+    std::error_code error;
+    size = std::filesystem::file_size(modelPath, error);
+    if (error)
+        return false;
+    time = std::filesystem::last_write_time(modelPath, error).time_since_epoch().count();
+    return !error;
+}
+
+// Bounds-checked cursor over the mapped cache
+class Reader {
+public:
+    Reader(const u8* pData, u64 size) : m_pData(pData), m_size(size) {}
+    bool Read(void* pDst, u64 byteSize) {
+        if (m_offset + byteSize > m_size)
+            return false;
+        SDL_memcpy(pDst, m_pData + m_offset, byteSize);
+        m_offset += byteSize;
+        return true;
+    }
+    // Returns the section in place, the decoders read straight from the mapping
+    const u8* Skip(u64 byteSize) {
+        if (m_offset + byteSize > m_size)
+            return nullptr;
+        const u8* pSection = m_pData + m_offset;
+        m_offset += byteSize;
+        return pSection;
+    }
+    bool Align() {
+        m_offset = AlignUp(m_offset, SECTION_ALIGNMENT);
+        return m_offset <= m_size;
+    }
+    u64 GetRemaining() const {
+        return m_size - m_offset;
+    }
+private:
+    const u8* m_pData;
+    u64       m_size;
+    u64       m_offset = 0;
+};
+
+class Writer {
+public:
+    void Write(const void* pSrc, u64 byteSize) {
+        m_data.insert(m_data.end(), (const u8*)pSrc, (const u8*)pSrc + byteSize);
+    }
+    void Align() {
+        m_data.resize(AlignUp(m_data.size(), SECTION_ALIGNMENT), 0);
+    }
+    const vector<u8>& GetData() const {
+        return m_data;
+    }
+private:
+    vector<u8> m_data;
+};
+
+}
+
+string GetMeshCachePath(const string& modelPath) {
+    return modelPath + ".meshcache";
+}
+
+bool ReadMeshCache(const string& modelPath, u32 bakeFlags, vector<MeshAsset>& meshes, bool stageGeometry) {
+    FileBuffer file;
+    if (!FileSystem::GetInstance().ReadFile(GetMeshCachePath(modelPath), file))
+        return false;
+    return ReadMeshCache(modelPath, file, bakeFlags, meshes, stageGeometry);
+}
+
+bool ReadMeshCache(const string& modelPath, const FileBuffer& file, u32 bakeFlags, vector<MeshAsset>& meshes, bool stageGeometry) {
+    // Without the source on disk (a deployment reading baked caches from an archive) the cache is trusted
+    u64 sourceSize;
+    i64 sourceTime;
+    const bool hasSource = GetSourceStamp(modelPath, sourceSize, sourceTime);
+
+    Reader reader(file.GetData(), file.GetSize());
+
+    FileHeader header;
+    if (!reader.Read(&header, sizeof(header)))
+        return false;
+    if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION)
+        return false;
+    if (hasSource && (header.sourceSize != sourceSize || header.sourceTime != sourceTime))
+        return false;
+    if (header.bakeFlags != bakeFlags)
+        return false;
+    // Counts are checked against the bytes left before anything is allocated, a corrupt cache
+    // fails instead of throwing
+    if (header.meshNum > reader.GetRemaining() / sizeof(MeshHeader))
+        return false;
+
+    struct EncodedSections {
+        const u8* pVertices;
+        const u8* pIndices;
+        u32       vertexSize;
+        u32       indexSize;
+        u32       vertexNum;
+        u32       indexNum;
+    };
+    vector<EncodedSections> sections(header.meshNum);
+
+    meshes.resize(header.meshNum);
+    for (u32 meshIdx = 0; meshIdx < header.meshNum; meshIdx++) {
+        MeshAsset& asset = meshes[meshIdx];
+        MeshHeader meshHeader;
+        if (!reader.Read(&meshHeader, sizeof(meshHeader)))
+            return false;
+        u64 contentSize = (u64)meshHeader.nameLength + meshHeader.encodedVertexSize + meshHeader.encodedIndexSize +
+                          (u64)meshHeader.meshletNum * sizeof(Renderer::Meshlet) + (u64)meshHeader.lodNum * sizeof(Renderer::MeshLod) +
+                          (u64)meshHeader.instanceNum * sizeof(InstanceHeader);
+        for (u32 length : meshHeader.texturePathLengths)
+            contentSize += length;
+        if (contentSize > reader.GetRemaining() ||
+            meshHeader.encodedVertexSize < GetEncodedVertexMinSize(meshHeader.vertexNum, sizeof(Renderer::Vertex)) ||
+            meshHeader.encodedIndexSize < GetEncodedIndexMinSize(meshHeader.indexNum))
+            return false;
+
+        asset.name.resize(meshHeader.nameLength);
+        if (!reader.Read(asset.name.data(), meshHeader.nameLength))
+            return false;
+        for (i32 i = 0; i < Renderer::TextureCount; i++) {
+            asset.texturePaths[i].resize(meshHeader.texturePathLengths[i]);
+            if (!reader.Read(asset.texturePaths[i].data(), meshHeader.texturePathLengths[i]))
+                return false;
+        }
+        asset.instances.resize(meshHeader.instanceNum);
+        for (MeshAssetInstance& instance : asset.instances) {
+            InstanceHeader instanceHeader;
+            if (!reader.Read(&instanceHeader, sizeof(instanceHeader)) || instanceHeader.nameLength > reader.GetRemaining())
+                return false;
+            instance.transform = instanceHeader.transform;
+            instance.name.resize(instanceHeader.nameLength);
+            if (!reader.Read(instance.name.data(), instanceHeader.nameLength))
+                return false;
+        }
+
+        Renderer::MeshCreateInfo& createInfo = asset.createInfo;
+        createInfo.transform    = meshHeader.transform;
+        createInfo.boundsCenter = meshHeader.boundsCenter;
+        createInfo.boundsRadius = meshHeader.boundsRadius;
+        if (stageGeometry) {
+            createInfo.stagedVertexNum = meshHeader.vertexNum;
+            createInfo.stagedIndexNum  = meshHeader.indexNum;
+        }
+        else {
+            createInfo.vertices.resize(meshHeader.vertexNum);
+            createInfo.indices.resize(meshHeader.indexNum);
+        }
+        createInfo.meshlets.resize(meshHeader.meshletNum);
+        createInfo.lods.resize(meshHeader.lodNum);
+
+        if (stageGeometry)
+            createInfo.geometryKey = meshHeader.geometryKey;
+
+        EncodedSections& encoded = sections[meshIdx];
+        encoded.vertexSize = meshHeader.encodedVertexSize;
+        encoded.indexSize  = meshHeader.encodedIndexSize;
+        encoded.vertexNum  = meshHeader.vertexNum;
+        encoded.indexNum   = meshHeader.indexNum;
+        if (!reader.Align() || !(encoded.pVertices = reader.Skip(encoded.vertexSize)))
+            return false;
+        if (!reader.Align() || !(encoded.pIndices = reader.Skip(encoded.indexSize)))
+            return false;
+        if (!reader.Align() || !reader.Read(createInfo.meshlets.data(), createInfo.meshlets.size() * sizeof(Renderer::Meshlet)))
+            return false;
+        if (!reader.Align() || !reader.Read(createInfo.lods.data(), createInfo.lods.size() * sizeof(Renderer::MeshLod)))
+            return false;
+        if (!reader.Align())
+            return false;
+    }
+
+    // Decode straight into the create infos that feed the GPU upload, or into the transfer memory itself
+    std::atomic<bool> succeeded = true;
+    JobSystem::GetInstance().ParallelFor(meshes.size(), 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end && succeeded; i++) {
+            Renderer::MeshCreateInfo& createInfo = meshes[i].createInfo;
+            const EncodedSections& encoded = sections[i];
+            const u32 vertexNum = encoded.vertexNum;
+            const u32 indexNum  = encoded.indexNum;
+            void* pVertices = createInfo.vertices.data();
+            u32*  pIndices  = createInfo.indices.data();
+            if (stageGeometry) {
+                const u32 vertexDataSize = vertexNum * sizeof(Renderer::Vertex);
+                createInfo.pStaging = Renderer::CreateStagingBuffer(vertexDataSize + indexNum * sizeof(Renderer::Index));
+                pVertices = createInfo.pStaging->Map();
+                pIndices  = (u32*)(createInfo.pStaging->Map() + vertexDataSize);
+            }
+            if (!DecodeVertexBuffer(encoded.pVertices, encoded.vertexSize, pVertices, vertexNum, sizeof(Renderer::Vertex)) ||
+                !DecodeIndexBuffer(encoded.pIndices, encoded.indexSize, pIndices, indexNum))
+                succeeded = false;
+        }
+    });
+    return succeeded;
+}
+
+bool WriteMeshCache(const string& modelPath, u32 bakeFlags, const vector<MeshAsset>& meshes) {
+    FileHeader header = {
+        .magic   = MESH_CACHE_MAGIC,
+        .version = MESH_CACHE_VERSION,
+        .meshNum   = (u32)meshes.size(),
+        .bakeFlags = bakeFlags
+    };
+    if (!GetSourceStamp(modelPath, header.sourceSize, header.sourceTime))
+        return false;
+
+    Writer writer;
+    writer.Write(&header, sizeof(header));
+
+    for (const MeshAsset& asset : meshes) {
+        const Renderer::MeshCreateInfo& createInfo = asset.createInfo;
+        MeshHeader meshHeader = {
+            .transform    = createInfo.transform,
+            .boundsCenter = createInfo.boundsCenter,
+            .boundsRadius = createInfo.boundsRadius,
+            .vertexNum    = (u32)createInfo.vertices.size(),
+            .indexNum     = (u32)createInfo.indices.size(),
+            .meshletNum   = (u32)createInfo.meshlets.size(),
+            .lodNum       = (u32)createInfo.lods.size(),
+            .nameLength   = (u32)asset.name.size(),
+            .instanceNum  = (u32)asset.instances.size(),
+            .geometryKey  = Renderer::GetGeometryKey(createInfo)
+        };
+        for (i32 i = 0; i < Renderer::TextureCount; i++)
+            meshHeader.texturePathLengths[i] = asset.texturePaths[i].size();
+
+        vector<u8> encodedVertices, encodedIndices;
+        EncodeVertexBuffer(createInfo.vertices.data(), createInfo.vertices.size(), sizeof(Renderer::Vertex), encodedVertices);
+        EncodeIndexBuffer(createInfo.indices.data(), createInfo.indices.size(), encodedIndices);
+        meshHeader.encodedVertexSize = encodedVertices.size();
+        meshHeader.encodedIndexSize  = encodedIndices.size();
+
+        writer.Write(&meshHeader, sizeof(meshHeader));
+        writer.Write(asset.name.data(), asset.name.size());
+        for (const string& texturePath : asset.texturePaths)
+            writer.Write(texturePath.data(), texturePath.size());
+        for (const MeshAssetInstance& instance : asset.instances) {
+            const InstanceHeader instanceHeader = {
+                .transform  = instance.transform,
+                .nameLength = (u32)instance.name.size()
+            };
+            writer.Write(&instanceHeader, sizeof(instanceHeader));
+            writer.Write(instance.name.data(), instance.name.size());
+        }
+        writer.Align();
+        writer.Write(encodedVertices.data(), encodedVertices.size());
+        writer.Align();
+        writer.Write(encodedIndices.data(), encodedIndices.size());
+        writer.Align();
+        writer.Write(createInfo.meshlets.data(), createInfo.meshlets.size() * sizeof(Renderer::Meshlet));
+        writer.Align();
+        writer.Write(createInfo.lods.data(), createInfo.lods.size() * sizeof(Renderer::MeshLod));
+        writer.Align();
+    }
+
+    // Write to a temporary file first so that a crash never leaves a truncated cache behind
+    const string cachePath = GetMeshCachePath(modelPath);
+    const string tempPath  = cachePath + ".tmp";
+    if (!SDL_SaveFile(tempPath.c_str(), writer.GetData().data(), writer.GetData().size()))
+        return false;
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, cachePath, error);
+    return !error;
+}
+
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+class FileBuffer;
+
+// Placement of a mesh by a node of the model
+struct MeshAssetInstance {
+    string         name;
+    Renderer::Mat4 transform;
+};
+
+// Geometry of one mesh of a model as it comes out of the import path, before texture decoding.
+// A mesh referenced by several nodes is converted, processed and cached once
+struct MeshAsset {
+    string                   name;
+    Renderer::MeshCreateInfo createInfo;
+    array<string, Renderer::TextureCount> texturePaths; // Relative to the model's directory
+    vector<MeshAssetInstance> instances; // Empty when the mesh is placed once, by name and createInfo.transform
+};
+
+constexpr u32 MESH_CACHE_MAGIC   = 0x4D524250; // "PBRM"
+constexpr u32 MESH_CACHE_VERSION = 10;
+
+// The cache lives next to the source model and is invalidated when the source
+// file's size or modification time change, when the import-time processing
+// (bakeFlags) differs, or when MESH_CACHE_VERSION is bumped. Caches are read through
+// the virtual file system; when the source is not on disk the stamp is not checked.
+// stageGeometry decodes the vertices and indices straight into mapped transfer memory
+// (MeshCreateInfo::pStaging) instead of the vectors, it needs the renderer to be initialized
+string GetMeshCachePath(const string& modelPath);
+bool ReadMeshCache(const string& modelPath, u32 bakeFlags, vector<MeshAsset>& meshes, bool stageGeometry = false);
+// From the contents of GetMeshCachePath() read elsewhere, e.g. by FileSystem::ReadFiles()
+bool ReadMeshCache(const string& modelPath, const FileBuffer& file, u32 bakeFlags, vector<MeshAsset>& meshes, bool stageGeometry = false);
+bool WriteMeshCache(const string& modelPath, u32 bakeFlags, const vector<MeshAsset>& meshes);
+
@@ -0,0 +1,315 @@
+#include "mesh_optimizer.h"
+
+#include "../pch.h"
+
+namespace {
+
+using Index  = Renderer::Index;
+using Vertex = Renderer::Vertex;
+
+constexpr u32 INVALID_INDEX = ~0u;
+
+// Tunables from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+constexpr u32   FORSYTH_CACHE_SIZE   = 32;
+constexpr u32   FORSYTH_MAX_VALENCE  = 32;
+constexpr float FORSYTH_LAST_TRI     = 0.75f;
+constexpr float FORSYTH_CACHE_DECAY  = 1.5f;
+constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+struct ForsythTables {
+    array<float, FORSYTH_CACHE_SIZE + 1>  cache;   // Indexed by cache position + 1, 0 means not cached
+    array<float, FORSYTH_MAX_VALENCE + 1> valence;
+
+    ForsythTables() {
+        cache[0] = 0.0f;
+        for (u32 i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+            if (i < 3)
+                cache[i + 1] = FORSYTH_LAST_TRI;
+            else
+                cache[i + 1] = powf(1.0f - (float)(i - 3) / (FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY);
+        }
+        valence[0] = 0.0f;
+        for (u32 i = 1; i <= FORSYTH_MAX_VALENCE; i++)
+            valence[i] = FORSYTH_VALENCE_BOOST_SCALE * powf((float)i, -FORSYTH_VALENCE_BOOST_POWER);
+    }
+};
+
+float GetVertexScore(const ForsythTables& tables, i32 cachePos, u32 remainingTris) {
+    if (remainingTris == 0)
+        return -1.0f;
+    return tables.cache[cachePos + 1] + tables.valence[std::min(remainingTris, FORSYTH_MAX_VALENCE)];
+}
+
+u64 HashVertex(const Vertex& vertex) {
+    // FNV-1a over the raw bytes, welding is bitwise anyway
+    const u8* pBytes = (const u8*)&vertex;
+    u64 hash = 0xcbf29ce484222325ull;
+    for (u32 i = 0; i < sizeof(Vertex); i++)
+        hash = (hash ^ pBytes[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+}
+
+float ComputeACMR(const vector<Index>& indices, u32 vertexNum, u32 cacheSize) {
+    if (indices.empty())
+        return 0.0f;
+
+    // Timestamp based FIFO: a vertex is cached if it was inserted less than cacheSize misses ago
+    vector<u32> insertionTimes(vertexNum, 0);
+    u32 time = cacheSize + 1;
+    u32 missNum = 0;
+    for (Index index : indices) {
+        if (time - insertionTimes[index] > cacheSize) {
+            insertionTimes[index] = time++;
+            missNum++;
+        }
+    }
+    return (float)missNum / (indices.size() / 3);
+}
+
+void WeldVertices(Renderer::MeshCreateInfo& createInfo) {
+    vector<Vertex>& vertices = createInfo.vertices;
+
+    u32 tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    vector<u32> table(tableSize, INVALID_INDEX);
+
+    vector<u32> remap(vertices.size());
+    vector<Vertex> weldedVertices;
+    weldedVertices.reserve(vertices.size());
+
+    for (u32 i = 0; i < vertices.size(); i++) {
+        // Open addressing with linear probing
+        u32 slot = HashVertex(vertices[i]) & (tableSize - 1);
+        while (table[slot] != INVALID_INDEX && SDL_memcmp(&weldedVertices[table[slot]], &vertices[i], sizeof(Vertex)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+
+        if (table[slot] == INVALID_INDEX) {
+            table[slot] = weldedVertices.size();
+            weldedVertices.push_back(vertices[i]);
+        }
+        remap[i] = table[slot];
+    }
+
+    for (Index& index : createInfo.indices)
+        index = remap[index];
+    vertices = std::move(weldedVertices);
+}
+
+void OptimizeVertexCache(vector<Index>& indices, u32 vertexNum) {
+    static const ForsythTables tables;
+    const u32 triNum = indices.size() / 3;
+    if (triNum == 0)
+        return;
+
+    // Vertex to triangle adjacency; the first remainingTris[v] entries are the triangles not emitted yet
+    vector<u32> adjacencyOffsets(vertexNum + 1, 0);
+    for (Index index : indices)
+        adjacencyOffsets[index + 1]++;
+    for (u32 i = 0; i < vertexNum; i++)
+        adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+    vector<u32> remainingTris(vertexNum);
+    for (u32 i = 0; i < vertexNum; i++)
+        remainingTris[i] = adjacencyOffsets[i + 1] - adjacencyOffsets[i];
+    vector<u32> adjacency(indices.size());
+    {
+        vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (u32 i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    vector<i32> cachePositions(vertexNum, -1);
+    vector<float> vertexScores(vertexNum);
+    for (u32 i = 0; i < vertexNum; i++)
+        vertexScores[i] = GetVertexScore(tables, -1, remainingTris[i]);
+
+    vector<float> triScores(triNum);
+    vector<bool> triEmitted(triNum, false);
+    u32 bestTri = 0;
+    for (u32 i = 0; i < triNum; i++) {
+        triScores[i] = vertexScores[indices[i * 3]] + vertexScores[indices[i * 3 + 1]] + vertexScores[indices[i * 3 + 2]];
+        if (triScores[i] > triScores[bestTri])
+            bestTri = i;
+    }
+
+    array<u32, FORSYTH_CACHE_SIZE + 3> cache;
+    array<u32, FORSYTH_CACHE_SIZE + 3> newCache;
+    u32 cacheNum = 0;
+
+    vector<Index> result;
+    result.reserve(indices.size());
+    u32 nextUnemittedTri = 0;
+
+    for (u32 emittedNum = 0; emittedNum < triNum; emittedNum++) {
+        if (bestTri == INVALID_INDEX) {
+            // Nothing adjacent to the cache is left, continue with any remaining triangle
+            while (triEmitted[nextUnemittedTri])
+                nextUnemittedTri++;
+            bestTri = nextUnemittedTri;
+        }
+
+        const Index* pTri = &indices[bestTri * 3];
+        triEmitted[bestTri] = true;
+        result.insert(result.end(), pTri, pTri + 3);
+
+        u32 newCacheNum = 0;
+        for (u32 i = 0; i < 3; i++) {
+            const Index vertex = pTri[i];
+            newCache[newCacheNum++] = vertex;
+
+            // Remove the triangle from the vertex's remaining list
+            u32* pAdjacency = &adjacency[adjacencyOffsets[vertex]];
+            for (u32 j = 0; j < remainingTris[vertex]; j++) {
+                if (pAdjacency[j] == bestTri) {
+                    std::swap(pAdjacency[j], pAdjacency[remainingTris[vertex] - 1]);
+                    break;
+                }
+            }
+            remainingTris[vertex]--;
+        }
+        for (u32 i = 0; i < cacheNum; i++) {
+            if (cache[i] != pTri[0] && cache[i] != pTri[1] && cache[i] != pTri[2])
+                newCache[newCacheNum++] = cache[i];
+        }
+
+        // Rescore every vertex whose cache position changed, including the evicted ones
+        for (u32 i = 0; i < newCacheNum; i++) {
+            const u32 vertex = newCache[i];
+            cachePositions[vertex] = i < FORSYTH_CACHE_SIZE ? i : -1;
+            vertexScores[vertex] = GetVertexScore(tables, cachePositions[vertex], remainingTris[vertex]);
+        }
+
+        bestTri = INVALID_INDEX;
+        float bestScore = -1.0f;
+        for (u32 i = 0; i < newCacheNum; i++) {
+            const u32 vertex = newCache[i];
+            const u32* pAdjacency = &adjacency[adjacencyOffsets[vertex]];
+            for (u32 j = 0; j < remainingTris[vertex]; j++) {
+                const u32 tri = pAdjacency[j];
+                const float score =
+                    vertexScores[indices[tri * 3]] +
+                    vertexScores[indices[tri * 3 + 1]] +
+                    vertexScores[indices[tri * 3 + 2]];
+                triScores[tri] = score;
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTri = tri;
+                }
+            }
+        }
+
+        cacheNum = std::min(newCacheNum, FORSYTH_CACHE_SIZE);
+        std::copy(newCache.begin(), newCache.begin() + cacheNum, cache.begin());
+    }
+
+    indices = std::move(result);
+}
+
+void OptimizeOverdraw(vector<Index>& indices, const vector<Vertex>& vertices) {
+    const u32 triNum = indices.size() / 3;
+    if (triNum == 0)
+        return;
+
+    // Cluster boundaries are the triangles that miss the cache on all three vertices
+    vector<u32> clusterStarts;
+    {
+        vector<u32> insertionTimes(vertices.size(), 0);
+        u32 time = VERTEX_CACHE_SIZE + 1;
+        for (u32 tri = 0; tri < triNum; tri++) {
+            u32 missNum = 0;
+            for (u32 i = 0; i < 3; i++) {
+                const Index index = indices[tri * 3 + i];
+                if (time - insertionTimes[index] > VERTEX_CACHE_SIZE) {
+                    insertionTimes[index] = time++;
+                    missNum++;
+                }
+            }
+            if (tri == 0 || missNum == 3)
+                clusterStarts.push_back(tri);
+        }
+    }
+    clusterStarts.push_back(triNum);
+    const u32 clusterNum = clusterStarts.size() - 1;
+
+    glm::vec3 meshCentroid = glm::vec3(0);
+    float meshArea = 0.0f;
+    vector<glm::vec3> clusterCentroids(clusterNum);
+    vector<glm::vec3> clusterNormals(clusterNum);
+    for (u32 cluster = 0; cluster < clusterNum; cluster++) {
+        glm::vec3 centroid = glm::vec3(0);
+        glm::vec3 normal   = glm::vec3(0);
+        float area = 0.0f;
+        for (u32 tri = clusterStarts[cluster]; tri < clusterStarts[cluster + 1]; tri++) {
+            const glm::vec3& p0 = vertices[indices[tri * 3 + 0]].pos;
+            const glm::vec3& p1 = vertices[indices[tri * 3 + 1]].pos;
+            const glm::vec3& p2 = vertices[indices[tri * 3 + 2]].pos;
+            const glm::vec3 triNormal = glm::cross(p1 - p0, p2 - p0); // Length is twice the area
+            const float triArea = glm::length(triNormal);
+            centroid += (p0 + p1 + p2) * (triArea / 3.0f);
+            normal   += triNormal;
+            area     += triArea;
+        }
+        meshCentroid += centroid;
+        meshArea     += area;
+        clusterCentroids[cluster] = area > 0.0f ? centroid / area : vertices[indices[clusterStarts[cluster] * 3]].pos;
+        const float normalLength = glm::length(normal);
+        clusterNormals[cluster] = normalLength > 0.0f ? normal / normalLength : glm::vec3(0);
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // Clusters facing away from the mesh center are the likely occluders, draw them first
+    vector<float> sortKeys(clusterNum);
+    for (u32 cluster = 0; cluster < clusterNum; cluster++)
+        sortKeys[cluster] = glm::dot(clusterCentroids[cluster] - meshCentroid, clusterNormals[cluster]);
+
+    vector<u32> clusterOrder(clusterNum);
+    for (u32 i = 0; i < clusterNum; i++)
+        clusterOrder[i] = i;
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](u32 a, u32 b) {
+        return sortKeys[a] > sortKeys[b];
+    });
+
+    vector<Index> result;
+    result.reserve(indices.size());
+    for (u32 cluster : clusterOrder)
+        result.insert(result.end(), indices.begin() + clusterStarts[cluster] * 3, indices.begin() + clusterStarts[cluster + 1] * 3);
+    indices = std::move(result);
+}
+
+void OptimizeVertexFetch(Renderer::MeshCreateInfo& createInfo) {
+    vector<u32> remap(createInfo.vertices.size(), INVALID_INDEX);
+    vector<Vertex> orderedVertices;
+    orderedVertices.reserve(createInfo.vertices.size());
+
+    // Unreferenced vertices are dropped
+    for (Index& index : createInfo.indices) {
+        if (remap[index] == INVALID_INDEX) {
+            remap[index] = orderedVertices.size();
+            orderedVertices.push_back(createInfo.vertices[index]);
+        }
+        index = remap[index];
+    }
+    createInfo.vertices = std::move(orderedVertices);
+}
+
+MeshOptimizationStats OptimizeMesh(Renderer::MeshCreateInfo& createInfo) {
+    SDL_assert(createInfo.vertexFormat == Renderer::VertexFormat_Full);
+
+    MeshOptimizationStats stats;
+    stats.vertexNumBefore = createInfo.vertices.size();
+    stats.acmrBefore      = ComputeACMR(createInfo.indices, createInfo.vertices.size());
+
+    WeldVertices(createInfo);
+    OptimizeVertexCache(createInfo.indices, createInfo.vertices.size());
+    OptimizeOverdraw(createInfo.indices, createInfo.vertices);
+    OptimizeVertexFetch(createInfo);
+
+    stats.vertexNumAfter = createInfo.vertices.size();
+    stats.acmrAfter      = ComputeACMR(createInfo.indices, createInfo.vertices.size());
+    return stats;
+}
+
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+// All passes work on VertexFormat_Full meshes and run at import time
+
+constexpr u32 VERTEX_CACHE_SIZE = 16; // FIFO size used when measuring ACMR
+
+struct MeshOptimizationStats {
+    u32   vertexNumBefore = 0;
+    u32   vertexNumAfter  = 0;
+    float acmrBefore      = 0.0f;
+    float acmrAfter       = 0.0f;
+};
+
+// Average number of post-transform cache misses per triangle with a FIFO cache
+float ComputeACMR(const vector<Renderer::Index>& indices, u32 vertexNum, u32 cacheSize = VERTEX_CACHE_SIZE);
+
+// Merges bitwise identical vertices and rewrites the indices accordingly
+void WeldVertices(Renderer::MeshCreateInfo& createInfo);
+// Reorders triangles for post-transform cache locality (Forsyth)
+void OptimizeVertexCache(vector<Renderer::Index>& indices, u32 vertexNum);
+// Reorders clusters of cache-optimized triangles so that outward facing ones come first.
+// Clusters end where the order restarts with a full miss, which keeps the ACMR intact
+void OptimizeOverdraw(vector<Renderer::Index>& indices, const vector<Renderer::Vertex>& vertices);
+// Renumbers vertices in order of first use so vertex fetch is sequential
+void OptimizeVertexFetch(Renderer::MeshCreateInfo& createInfo);
+
+// Runs all of the above in order
+MeshOptimizationStats OptimizeMesh(Renderer::MeshCreateInfo& createInfo);
+
@@ -0,0 +1,102 @@
+#include "meshlets.h"
+
+#include "../pch.h"
+
+namespace {
+
+using Index = Renderer::Index;
+
+void ComputeMeshletBounds(const Renderer::MeshCreateInfo& createInfo, Renderer::Meshlet& meshlet) {
+    const Index* pIndices = &createInfo.indices[meshlet.indexOffset];
+    const u32 indexNum = meshlet.triangleNum * 3;
+
+    // Sphere around the AABB center
+    glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (u32 i = 0; i < indexNum; i++) {
+        boundsMin = glm::min(boundsMin, createInfo.vertices[pIndices[i]].pos);
+        boundsMax = glm::max(boundsMax, createInfo.vertices[pIndices[i]].pos);
+    }
+    meshlet.center = (boundsMin + boundsMax) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (u32 i = 0; i < indexNum; i++)
+        meshlet.radius = glm::max(meshlet.radius, glm::distance(meshlet.center, createInfo.vertices[pIndices[i]].pos));
+
+    // Normal cone from the face normals, degenerate triangles are ignored
+    vector<glm::vec3> normals;
+    normals.reserve(meshlet.triangleNum);
+    glm::vec3 normalSum = glm::vec3(0);
+    for (u32 i = 0; i < indexNum; i += 3) {
+        const glm::vec3& p0 = createInfo.vertices[pIndices[i + 0]].pos;
+        const glm::vec3& p1 = createInfo.vertices[pIndices[i + 1]].pos;
+        const glm::vec3& p2 = createInfo.vertices[pIndices[i + 2]].pos;
+        const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        const float length = glm::length(normal);
+        if (length > 0.0f) {
+            normals.push_back(normal / length);
+            normalSum += normal / length;
+        }
+    }
+
+    // A cutoff of 1 never passes the culling test
+    meshlet.coneAxis   = glm::vec3(0, 0, 1);
+    meshlet.coneCutoff = 1.0f;
+    const float sumLength = glm::length(normalSum);
+    if (sumLength == 0.0f)
+        return;
+    meshlet.coneAxis = normalSum / sumLength;
+
+    float minDot = 1.0f;
+    for (const glm::vec3& normal : normals)
+        minDot = glm::min(minDot, glm::dot(meshlet.coneAxis, normal));
+    // Normals spread over more than a hemisphere, some triangle always faces the camera
+    if (minDot <= 0.0f)
+        return;
+    // The normal cone has half-angle acos(minDot); the cone of view directions for which every
+    // triangle is backfacing is its complement, whose half-angle has sine sqrt(1 - minDot^2)
+    meshlet.coneCutoff = glm::sqrt(1.0f - minDot * minDot);
+}
+
+}
+
+void BuildMeshlets(Renderer::MeshCreateInfo& createInfo) {
+    SDL_assert(createInfo.vertexFormat == Renderer::VertexFormat_Full);
+    createInfo.meshlets.clear();
+
+    // Tracks which vertices the current meshlet already references
+    vector<u32> meshletOfVertex(createInfo.vertices.size(), ~0u);
+    // Only LOD 0 is split, the coarser levels are drawn whole
+    const u32 triNum = (createInfo.lods.empty() ? createInfo.indices.size() : createInfo.lods[0].indexNum) / 3;
+
+    Renderer::Meshlet meshlet = {};
+    u32 vertexNum = 0;
+    for (u32 tri = 0; tri < triNum; tri++) {
+        const Index* pTri = &createInfo.indices[tri * 3];
+        u32 meshletIdx = createInfo.meshlets.size();
+
+        u32 newVertexNum = 0;
+        for (u32 i = 0; i < 3; i++)
+            newVertexNum += meshletOfVertex[pTri[i]] != meshletIdx;
+        if (vertexNum + newVertexNum > MESHLET_MAX_VERTICES || meshlet.triangleNum == MESHLET_MAX_TRIANGLES) {
+            ComputeMeshletBounds(createInfo, meshlet);
+            createInfo.meshlets.push_back(meshlet);
+            meshlet = { .indexOffset = tri * 3 };
+            meshletIdx++;
+            vertexNum = 0;
+        }
+
+        for (u32 i = 0; i < 3; i++) {
+            if (meshletOfVertex[pTri[i]] != meshletIdx) {
+                meshletOfVertex[pTri[i]] = meshletIdx;
+                vertexNum++;
+            }
+        }
+        meshlet.triangleNum++;
+    }
+
+    if (meshlet.triangleNum > 0) {
+        ComputeMeshletBounds(createInfo, meshlet);
+        createInfo.meshlets.push_back(meshlet);
+    }
+}
+
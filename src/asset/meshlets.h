@@ -0,0 +1,13 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+constexpr u32 MESHLET_MAX_VERTICES  = 64;
+constexpr u32 MESHLET_MAX_TRIANGLES = 124;
+
+// Splits the LOD 0 range of createInfo.indices into consecutive clusters and fills createInfo.meshlets.
+// The index order is kept, so run it after the mesh optimizer: a cache-coherent
+// order is also a spatially coherent one.
+void BuildMeshlets(Renderer::MeshCreateInfo& createInfo);
+
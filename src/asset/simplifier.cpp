@@ -0,0 +1,396 @@
+#include "simplifier.h"
+
+#include "../pch.h"
+#include "mesh_optimizer.h"
+#include <unordered_set>
+
+namespace {
+
+using Index  = Renderer::Index;
+using Vertex = Renderer::Vertex;
+
+constexpr u32 INVALID_INDEX = ~0u;
+// Border edges get a plane perpendicular to their face so they can only slide along themselves
+constexpr double BORDER_WEIGHT = 10.0;
+// A level has to remove at least this fraction of the previous level's triangles to be kept
+constexpr float MIN_LOD_REDUCTION = 0.1f;
+
+// Symmetric 4x4 matrix of the plane equations' outer products, weighted by area
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33 = 0;
+    double weight = 0;
+
+    void AddPlane(const glm::dvec3& normal, double d, double planeWeight) {
+        a00 += planeWeight * normal.x * normal.x;
+        a01 += planeWeight * normal.x * normal.y;
+        a02 += planeWeight * normal.x * normal.z;
+        a03 += planeWeight * normal.x * d;
+        a11 += planeWeight * normal.y * normal.y;
+        a12 += planeWeight * normal.y * normal.z;
+        a13 += planeWeight * normal.y * d;
+        a22 += planeWeight * normal.z * normal.z;
+        a23 += planeWeight * normal.z * d;
+        a33 += planeWeight * d * d;
+        weight += planeWeight;
+    }
+    void Add(const Quadric& other) {
+        a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+        a11 += other.a11; a12 += other.a12; a13 += other.a13;
+        a22 += other.a22; a23 += other.a23;
+        a33 += other.a33;
+        weight += other.weight;
+    }
+    // Weighted sum of squared distances to the planes
+    double Evaluate(const glm::dvec3& p) const {
+        return
+            a00 * p.x * p.x + 2 * a01 * p.x * p.y + 2 * a02 * p.x * p.z + 2 * a03 * p.x +
+            a11 * p.y * p.y + 2 * a12 * p.y * p.z + 2 * a13 * p.y +
+            a22 * p.z * p.z + 2 * a23 * p.z +
+            a33;
+    }
+};
+
+struct Collapse {
+    u32   from; // Position ids
+    u32   to;
+    float cost; // Mean squared distance
+};
+
+u64 GetEdgeKey(u32 a, u32 b) {
+    return a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a;
+}
+
+u64 HashPosition(const glm::vec3& pos) {
+    u32 bits[3];
+    SDL_memcpy(bits, &pos, sizeof(bits));
+    return (bits[0] * 73856093ull) ^ (bits[1] * 19349663ull) ^ (bits[2] * 83492791ull);
+}
+
+// Maps every vertex to the first vertex with a bitwise equal position
+vector<u32> BuildPositionIds(const vector<Vertex>& vertices) {
+    u32 tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    vector<u32> table(tableSize, INVALID_INDEX);
+
+    vector<u32> positionIds(vertices.size());
+    for (u32 i = 0; i < vertices.size(); i++) {
+        u32 slot = HashPosition(vertices[i].pos) & (tableSize - 1);
+        while (table[slot] != INVALID_INDEX && vertices[table[slot]].pos != vertices[i].pos)
+            slot = (slot + 1) & (tableSize - 1);
+        if (table[slot] == INVALID_INDEX)
+            table[slot] = i;
+        positionIds[i] = table[slot];
+    }
+    return positionIds;
+}
+
+// Position id to triangle adjacency in CSR form
+struct Adjacency {
+    vector<u32> offsets;
+    vector<u32> triangles;
+
+    void Build(const vector<Index>& indices, const vector<u32>& positionIds) {
+        offsets.assign(positionIds.size() + 1, 0);
+        for (Index index : indices)
+            offsets[positionIds[index] + 1]++;
+        for (u32 i = 0; i < positionIds.size(); i++)
+            offsets[i + 1] += offsets[i];
+        triangles.resize(indices.size());
+        vector<u32> fill(offsets.begin(), offsets.end() - 1);
+        for (u32 i = 0; i < indices.size(); i++)
+            triangles[fill[positionIds[indices[i]]]++] = i / 3;
+    }
+    span<const u32, std::dynamic_extent> Get(u32 positionId) const {
+        return { triangles.data() + offsets[positionId], offsets[positionId + 1] - offsets[positionId] };
+    }
+};
+
+class Simplifier {
+public:
+    Simplifier(const vector<Vertex>& vertices, const vector<Index>& indices)
+        : m_vertices(vertices), m_indices(indices), m_positionIds(BuildPositionIds(vertices)) {}
+
+    vector<Index> Run(u32 targetIndexNum, float& error) {
+        ComputeQuadrics();
+
+        double maxCost = 0.0;
+        while (m_indices.size() > targetIndexNum) {
+            const u32 collapsedNum = RunPass(targetIndexNum, maxCost);
+            if (collapsedNum == 0)
+                break;
+        }
+
+        error = (float)glm::sqrt(maxCost);
+        return m_indices;
+    }
+private:
+    const glm::vec3& GetPos(u32 positionId) const {
+        return m_vertices[positionId].pos;
+    }
+
+    void ComputeQuadrics() {
+        m_quadrics.assign(m_vertices.size(), Quadric());
+
+        // Edge use counts in position space find the open borders
+        umap<u64, u32> edgeUses;
+        for (u32 i = 0; i < m_indices.size(); i += 3) {
+            for (u32 j = 0; j < 3; j++)
+                edgeUses[GetEdgeKey(m_positionIds[m_indices[i + j]], m_positionIds[m_indices[i + (j + 1) % 3]])]++;
+        }
+
+        m_isBorder.assign(m_vertices.size(), false);
+        m_borderEdges.clear();
+        for (u32 i = 0; i < m_indices.size(); i += 3) {
+            const u32 p[3] = {
+                m_positionIds[m_indices[i]],
+                m_positionIds[m_indices[i + 1]],
+                m_positionIds[m_indices[i + 2]]
+            };
+            const glm::dvec3 p0 = GetPos(p[0]), p1 = GetPos(p[1]), p2 = GetPos(p[2]);
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const double doubleArea = glm::length(normal);
+            if (doubleArea == 0.0)
+                continue;
+            normal /= doubleArea;
+
+            for (u32 j = 0; j < 3; j++)
+                m_quadrics[p[j]].AddPlane(normal, -glm::dot(normal, p0), doubleArea * 0.5);
+
+            for (u32 j = 0; j < 3; j++) {
+                const u32 a = p[j], b = p[(j + 1) % 3];
+                if (edgeUses[GetEdgeKey(a, b)] != 1)
+                    continue;
+                m_isBorder[a] = m_isBorder[b] = true;
+                m_borderEdges.insert(GetEdgeKey(a, b));
+
+                const glm::dvec3 pa = GetPos(a), pb = GetPos(b);
+                const glm::dvec3 edge = pb - pa;
+                const double edgeLength = glm::length(edge);
+                if (edgeLength == 0.0)
+                    continue;
+                const glm::dvec3 borderNormal = glm::normalize(glm::cross(edge, normal));
+                const double borderWeight = BORDER_WEIGHT * edgeLength * edgeLength;
+                m_quadrics[a].AddPlane(borderNormal, -glm::dot(borderNormal, pa), borderWeight);
+                m_quadrics[b].AddPlane(borderNormal, -glm::dot(borderNormal, pa), borderWeight);
+            }
+        }
+    }
+
+    float GetCollapseCost(u32 from, u32 to) const {
+        Quadric quadric = m_quadrics[from];
+        quadric.Add(m_quadrics[to]);
+        if (quadric.weight == 0.0)
+            return 0.0f;
+        return (float)glm::max(quadric.Evaluate(GetPos(to)) / quadric.weight, 0.0);
+    }
+
+    bool IsValidBorderCollapse(u32 from, u32 to) const {
+        // Border vertices may only slide along the border
+        return !m_isBorder[from] || m_borderEdges.contains(GetEdgeKey(from, to));
+    }
+
+    // Every attribute copy of the source has to land on exactly one copy of the target,
+    // otherwise the collapse would tear a UV seam. Fills copyPairs with (source copy, target copy).
+    bool MatchCopies(u32 from, u32 to, vector<std::pair<Index, Index>>& copyPairs) const {
+        copyPairs.clear();
+        for (u32 tri : m_adjacency.Get(from)) {
+            const Index* pTri = &m_indices[tri * 3];
+            Index fromCopy = INVALID_INDEX, toCopy = INVALID_INDEX;
+            for (u32 i = 0; i < 3; i++) {
+                if (m_positionIds[pTri[i]] == from)
+                    fromCopy = pTri[i];
+                else if (m_positionIds[pTri[i]] == to)
+                    toCopy = pTri[i];
+            }
+
+            auto it = std::find_if(copyPairs.begin(), copyPairs.end(), [&](const auto& pair) { return pair.first == fromCopy; });
+            if (it == copyPairs.end())
+                copyPairs.push_back({ fromCopy, toCopy });
+            else if (it->second == INVALID_INDEX)
+                it->second = toCopy;
+            else if (toCopy != INVALID_INDEX && it->second != toCopy)
+                return false;
+        }
+        for (const auto& pair : copyPairs) {
+            if (pair.second == INVALID_INDEX)
+                return false;
+        }
+        return true;
+    }
+
+    // Rejects collapses that would flip a remaining triangle
+    bool FlipsTriangles(u32 from, u32 to) const {
+        const glm::vec3& target = GetPos(to);
+        for (u32 tri : m_adjacency.Get(from)) {
+            const Index* pTri = &m_indices[tri * 3];
+            u32 p[3];
+            bool containsTarget = false;
+            for (u32 i = 0; i < 3; i++) {
+                p[i] = m_positionIds[pTri[i]];
+                containsTarget |= p[i] == to;
+            }
+            if (containsTarget)
+                continue;
+
+            const glm::vec3 before = glm::cross(GetPos(p[1]) - GetPos(p[0]), GetPos(p[2]) - GetPos(p[0]));
+            glm::vec3 moved[3];
+            for (u32 i = 0; i < 3; i++)
+                moved[i] = p[i] == from ? target : GetPos(p[i]);
+            const glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+            if (glm::dot(before, after) <= 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    u32 CountSharedTriangles(u32 from, u32 to) const {
+        u32 count = 0;
+        for (u32 tri : m_adjacency.Get(from)) {
+            for (u32 i = 0; i < 3; i++)
+                count += m_positionIds[m_indices[tri * 3 + i]] == to;
+        }
+        return count;
+    }
+
+    // Collapses a set of independent edges in order of increasing cost
+    u32 RunPass(u32 targetIndexNum, double& maxCost) {
+        m_adjacency.Build(m_indices, m_positionIds);
+
+        vector<u64> edges;
+        edges.reserve(m_indices.size());
+        for (u32 i = 0; i < m_indices.size(); i += 3) {
+            for (u32 j = 0; j < 3; j++)
+                edges.push_back(GetEdgeKey(m_positionIds[m_indices[i + j]], m_positionIds[m_indices[i + (j + 1) % 3]]));
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        vector<Collapse> collapses;
+        collapses.reserve(edges.size());
+        for (u64 edge : edges) {
+            const u32 a = edge >> 32;
+            const u32 b = (u32)edge;
+            const float costAB = IsValidBorderCollapse(a, b) ? GetCollapseCost(a, b) : FLT_MAX;
+            const float costBA = IsValidBorderCollapse(b, a) ? GetCollapseCost(b, a) : FLT_MAX;
+            if (costAB == FLT_MAX && costBA == FLT_MAX)
+                continue;
+            if (costAB <= costBA)
+                collapses.push_back({ a, b, costAB });
+            else
+                collapses.push_back({ b, a, costBA });
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+            return a.cost < b.cost;
+        });
+
+        vector<bool> locked(m_vertices.size(), false);
+        vector<Index> remap(m_vertices.size());
+        for (u32 i = 0; i < remap.size(); i++)
+            remap[i] = i;
+
+        vector<std::pair<Index, Index>> copyPairs;
+        u32 removedIndexNum = 0;
+        u32 collapsedNum = 0;
+        const u32 indexNumToRemove = m_indices.size() - targetIndexNum;
+
+        for (const Collapse& collapse : collapses) {
+            if (removedIndexNum >= indexNumToRemove)
+                break;
+            if (locked[collapse.from] || locked[collapse.to])
+                continue;
+            if (!MatchCopies(collapse.from, collapse.to, copyPairs) || FlipsTriangles(collapse.from, collapse.to))
+                continue;
+
+            for (const auto& pair : copyPairs)
+                remap[pair.first] = pair.second;
+            m_quadrics[collapse.to].Add(m_quadrics[collapse.from]);
+            removedIndexNum += CountSharedTriangles(collapse.from, collapse.to) * 3;
+            maxCost = glm::max(maxCost, (double)collapse.cost);
+            collapsedNum++;
+
+            // The one-ring of the source changed shape, nothing in it may move again this pass
+            for (u32 tri : m_adjacency.Get(collapse.from)) {
+                for (u32 i = 0; i < 3; i++)
+                    locked[m_positionIds[m_indices[tri * 3 + i]]] = true;
+            }
+        }
+
+        // Apply the collapses and drop the triangles that became degenerate
+        u32 writeIdx = 0;
+        for (u32 i = 0; i < m_indices.size(); i += 3) {
+            const Index a = remap[m_indices[i]], b = remap[m_indices[i + 1]], c = remap[m_indices[i + 2]];
+            const u32 pa = m_positionIds[a], pb = m_positionIds[b], pc = m_positionIds[c];
+            if (pa == pb || pb == pc || pa == pc)
+                continue;
+            m_indices[writeIdx++] = a;
+            m_indices[writeIdx++] = b;
+            m_indices[writeIdx++] = c;
+        }
+        m_indices.resize(writeIdx);
+
+        return collapsedNum;
+    }
+
+    const vector<Vertex>& m_vertices;
+    vector<Index>         m_indices;
+    vector<u32>           m_positionIds;
+    vector<Quadric>       m_quadrics;
+    vector<bool>          m_isBorder;
+    std::unordered_set<u64> m_borderEdges;
+    Adjacency             m_adjacency;
+};
+
+}
+
+vector<Renderer::Index> SimplifyMesh(
+    const vector<Renderer::Vertex>& vertices,
+    const vector<Renderer::Index>& indices,
+    u32 targetIndexNum,
+    float& error
+) {
+    Simplifier simplifier(vertices, indices);
+    return simplifier.Run(targetIndexNum, error);
+}
+
+void BuildLods(Renderer::MeshCreateInfo& createInfo, u32 lodNum) {
+    SDL_assert(createInfo.vertexFormat == Renderer::VertexFormat_Full);
+
+    // Bounding sphere around the AABB center
+    glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const Vertex& vertex : createInfo.vertices) {
+        boundsMin = glm::min(boundsMin, vertex.pos);
+        boundsMax = glm::max(boundsMax, vertex.pos);
+    }
+    createInfo.boundsCenter = createInfo.vertices.empty() ? glm::vec3(0) : (boundsMin + boundsMax) * 0.5f;
+    createInfo.boundsRadius = 0.0f;
+    for (const Vertex& vertex : createInfo.vertices)
+        createInfo.boundsRadius = glm::max(createInfo.boundsRadius, glm::distance(createInfo.boundsCenter, vertex.pos));
+
+    createInfo.lods.clear();
+    createInfo.lods.push_back({ .indexOffset = 0, .indexNum = (u32)createInfo.indices.size(), .error = 0.0f });
+
+    vector<Index> lodIndices = createInfo.indices;
+    for (u32 lod = 1; lod < lodNum; lod++) {
+        const u32 targetIndexNum = (lodIndices.size() / 6) * 3;
+        float error;
+        vector<Index> simplified = SimplifyMesh(createInfo.vertices, lodIndices, targetIndexNum, error);
+        if (simplified.empty() || simplified.size() > lodIndices.size() * (1.0f - MIN_LOD_REDUCTION))
+            break;
+
+        OptimizeVertexCache(simplified, createInfo.vertices.size());
+        createInfo.lods.push_back({
+            .indexOffset = (u32)createInfo.indices.size(),
+            .indexNum    = (u32)simplified.size(),
+            // Each level is simplified from the previous one, so the errors add up
+            .error       = createInfo.lods.back().error + error
+        });
+        createInfo.indices.insert(createInfo.indices.end(), simplified.begin(), simplified.end());
+        lodIndices = std::move(simplified);
+    }
+}
+
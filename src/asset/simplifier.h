@@ -0,0 +1,21 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+// Quadric error metric simplification by half-edge collapses: every remaining
+// vertex is one of the input vertices, so all levels share one vertex buffer.
+// UV seams and open borders are preserved. Returns the simplified index list;
+// error receives the largest collapse error as an object space distance.
+vector<Renderer::Index> SimplifyMesh(
+    const vector<Renderer::Vertex>& vertices,
+    const vector<Renderer::Index>& indices,
+    u32 targetIndexNum,
+    float& error
+);
+
+// Appends up to lodNum - 1 simplified levels (each targeting half the triangles of the
+// previous one) to createInfo.indices and describes all levels in createInfo.lods.
+// Also computes the bounding sphere used for LOD selection.
+void BuildLods(Renderer::MeshCreateInfo& createInfo, u32 lodNum);
+
@@ -0,0 +1,93 @@
+#include "tangents.h"
+
+#include "../pch.h"
+#include "../job_system.h"
+
+namespace {
+
+// Triangles and vertices per job, small meshes stay on the calling thread
+constexpr u32 TANGENT_BATCH_SIZE = 16 * 1024;
+
+glm::vec3 ProjectOntoPlane(const glm::vec3& v, const glm::vec3& normal) {
+    return v - normal * glm::dot(normal, v);
+}
+
+glm::vec3 SafeNormalize(const glm::vec3& v) {
+    const float length = glm::length(v);
+    return length > 0.0f ? v / length : glm::vec3(0);
+}
+
+// Any unit vector perpendicular to the normal, for vertices without a usable UV gradient
+glm::vec3 GetPerpendicular(const glm::vec3& normal) {
+    const glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+    return SafeNormalize(glm::cross(normal, axis));
+}
+
+}
+
+void GenerateTangents(Renderer::MeshCreateInfo& createInfo) {
+    vector<Renderer::Vertex>& vertices = createInfo.vertices;
+    const vector<Renderer::Index>& indices = createInfo.indices;
+    const u32 triangleNum = indices.size() / 3;
+    JobSystem& jobSystem = JobSystem::GetInstance();
+
+    // Per corner contributions as in MikkTSpace: the normalized UV gradient of the face, projected
+    // onto the tangent plane of the corner's normal and weighted by the corner angle in that plane
+    vector<glm::vec3> cornerTangents(triangleNum * 3);
+    jobSystem.ParallelFor(triangleNum, TANGENT_BATCH_SIZE, [&](u32 begin, u32 end) {
+        for (u32 triangle = begin; triangle < end; triangle++) {
+            const Renderer::Index* pCorners = &indices[triangle * 3];
+            const Renderer::Vertex& v0 = vertices[pCorners[0]];
+            const Renderer::Vertex& v1 = vertices[pCorners[1]];
+            const Renderer::Vertex& v2 = vertices[pCorners[2]];
+
+            const glm::vec3 edge1 = v1.pos - v0.pos;
+            const glm::vec3 edge2 = v2.pos - v0.pos;
+            const glm::vec2 deltaUV1 = v1.texCoord - v0.texCoord;
+            const glm::vec2 deltaUV2 = v2.texCoord - v0.texCoord;
+
+            // The sign of the UV area keeps mirrored faces pointing along +u
+            const float signedArea = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+            const glm::vec3 faceTangent = SafeNormalize(edge1 * deltaUV2.y - edge2 * deltaUV1.y) * (signedArea < 0.0f ? -1.0f : 1.0f);
+            if (signedArea == 0.0f || faceTangent == glm::vec3(0)) {
+                for (u32 i = 0; i < 3; i++)
+                    cornerTangents[triangle * 3 + i] = glm::vec3(0);
+                continue;
+            }
+
+            for (u32 i = 0; i < 3; i++) {
+                const Renderer::Vertex& vertex = vertices[pCorners[i]];
+                const Renderer::Vertex& next   = vertices[pCorners[(i + 1) % 3]];
+                const Renderer::Vertex& prev   = vertices[pCorners[(i + 2) % 3]];
+                const glm::vec3 toNext = SafeNormalize(ProjectOntoPlane(next.pos - vertex.pos, vertex.normal));
+                const glm::vec3 toPrev = SafeNormalize(ProjectOntoPlane(prev.pos - vertex.pos, vertex.normal));
+                const float angle = std::acos(glm::clamp(glm::dot(toNext, toPrev), -1.0f, 1.0f));
+                cornerTangents[triangle * 3 + i] = SafeNormalize(ProjectOntoPlane(faceTangent, vertex.normal)) * angle;
+            }
+        }
+    });
+
+    // Corners grouped by vertex (counting sort), so the sums below need no atomics and are deterministic
+    vector<u32> cornerOffsets(vertices.size() + 1, 0);
+    for (u32 i = 0; i < triangleNum * 3; i++)
+        cornerOffsets[indices[i] + 1]++;
+    for (u32 i = 0; i < vertices.size(); i++)
+        cornerOffsets[i + 1] += cornerOffsets[i];
+    vector<u32> vertexCorners(triangleNum * 3);
+    vector<u32> cursors(cornerOffsets.begin(), cornerOffsets.end() - 1);
+    for (u32 i = 0; i < triangleNum * 3; i++)
+        vertexCorners[cursors[indices[i]]++] = i;
+
+    jobSystem.ParallelFor(vertices.size(), TANGENT_BATCH_SIZE, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            glm::vec3 sum(0);
+            for (u32 corner = cornerOffsets[i]; corner < cornerOffsets[i + 1]; corner++)
+                sum += cornerTangents[vertexCorners[corner]];
+
+            // Gram-Schmidt against the normal
+            const glm::vec3& normal = vertices[i].normal;
+            const glm::vec3 tangent = SafeNormalize(ProjectOntoPlane(sum, normal));
+            vertices[i].tangent = tangent != glm::vec3(0) ? tangent : GetPerpendicular(normal);
+        }
+    });
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+// Fills Vertex::tangent from positions, normals and UVs of the triangles around each vertex.
+// Follows MikkTSpace: per face UV gradients are projected onto each vertex's tangent plane
+// and weighted by the corner angle. Without a bitangent sign in Renderer::Vertex, mirrored
+// faces sharing a vertex are averaged instead of split. Large meshes are spread over the
+// job system. Importers skip this when the source already ships tangents (glTF TANGENT)
+void GenerateTangents(Renderer::MeshCreateInfo& createInfo);
+
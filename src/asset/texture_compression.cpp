@@ -0,0 +1,423 @@
+#include "texture_compression.h"
+
+#include "../pch.h"
+#include "../job_system.h"
+#include "../arena.h"
+#include "image_kernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define TEXTURE_COMPRESSION_SSE2
+    #include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr u32 BLOCK_PIXEL_NUM = 16;
+
+// BC7 4-bit index interpolation weights, out of 64
+constexpr array<u32, 16> BC7_WEIGHTS = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Block pixels as floats, one row of 16 per channel so that 4 pixels fit a register
+struct alignas(16) BlockChannels {
+    float values[4][BLOCK_PIXEL_NUM];
+};
+
+void LoadBlock(const u8* pPixels, u32 channelNum, BlockChannels& block) {
+    for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++) {
+        for (u32 channel = 0; channel < channelNum; channel++)
+            block.values[channel][i] = pPixels[i * 4 + channel];
+    }
+}
+
+// pT[i] = dot(pixel i - origin, axis)
+void ProjectBlock(const BlockChannels& block, u32 channelNum, const float* pOrigin, const float* pAxis, float* pT) {
+#ifdef TEXTURE_COMPRESSION_SSE2
+    for (u32 i = 0; i < BLOCK_PIXEL_NUM; i += 4) {
+        __m128 t = _mm_setzero_ps();
+        for (u32 channel = 0; channel < channelNum; channel++) {
+            const __m128 delta = _mm_sub_ps(_mm_load_ps(&block.values[channel][i]), _mm_set1_ps(pOrigin[channel]));
+            t = _mm_add_ps(t, _mm_mul_ps(delta, _mm_set1_ps(pAxis[channel])));
+        }
+        _mm_storeu_ps(pT + i, t);
+    }
+#else
+    for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++) {
+        pT[i] = 0.0f;
+        for (u32 channel = 0; channel < channelNum; channel++)
+            pT[i] += (block.values[channel][i] - pOrigin[channel]) * pAxis[channel];
+    }
+#endif
+}
+
+#ifdef TEXTURE_COMPRESSION_SSE2
+float HorizontalSum(__m128 v) {
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+#endif
+
+// Mean and dominant direction of the block colors, found by power iteration on the covariance
+void ComputePrincipalAxis(const BlockChannels& block, u32 channelNum, float* pMean, float* pAxis) {
+    float covariance[4][4] = {};
+#ifdef TEXTURE_COMPRESSION_SSE2
+    __m128 centered[4][4];
+    for (u32 channel = 0; channel < channelNum; channel++) {
+        __m128 sum = _mm_setzero_ps();
+        for (u32 i = 0; i < BLOCK_PIXEL_NUM; i += 4)
+            sum = _mm_add_ps(sum, _mm_load_ps(&block.values[channel][i]));
+        pMean[channel] = HorizontalSum(sum) / BLOCK_PIXEL_NUM;
+
+        const __m128 mean = _mm_set1_ps(pMean[channel]);
+        for (u32 i = 0; i < 4; i++)
+            centered[channel][i] = _mm_sub_ps(_mm_load_ps(&block.values[channel][i * 4]), mean);
+    }
+    for (u32 a = 0; a < channelNum; a++) {
+        for (u32 b = a; b < channelNum; b++) {
+            __m128 sum = _mm_setzero_ps();
+            for (u32 i = 0; i < 4; i++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(centered[a][i], centered[b][i]));
+            covariance[a][b] = covariance[b][a] = HorizontalSum(sum);
+        }
+    }
+#else
+    for (u32 channel = 0; channel < channelNum; channel++) {
+        float sum = 0.0f;
+        for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++)
+            sum += block.values[channel][i];
+        pMean[channel] = sum / BLOCK_PIXEL_NUM;
+    }
+    for (u32 a = 0; a < channelNum; a++) {
+        for (u32 b = a; b < channelNum; b++) {
+            float sum = 0.0f;
+            for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++)
+                sum += (block.values[a][i] - pMean[a]) * (block.values[b][i] - pMean[b]);
+            covariance[a][b] = covariance[b][a] = sum;
+        }
+    }
+#endif
+
+    // Start from the row of the channel with the largest variance
+    u32 start = 0;
+    for (u32 channel = 1; channel < channelNum; channel++) {
+        if (covariance[channel][channel] > covariance[start][start])
+            start = channel;
+    }
+    float axis[4];
+    for (u32 channel = 0; channel < channelNum; channel++)
+        axis[channel] = covariance[start][channel];
+
+    constexpr u32 ITERATION_NUM = 8;
+    for (u32 iteration = 0; iteration < ITERATION_NUM; iteration++) {
+        float next[4] = {};
+        float maxComponent = 0.0f;
+        for (u32 a = 0; a < channelNum; a++) {
+            for (u32 b = 0; b < channelNum; b++)
+                next[a] += covariance[a][b] * axis[b];
+            maxComponent = std::max(maxComponent, std::abs(next[a]));
+        }
+        if (maxComponent == 0.0f)
+            break;
+        for (u32 channel = 0; channel < channelNum; channel++)
+            axis[channel] = next[channel] / maxComponent;
+    }
+
+    float lengthSq = 0.0f;
+    for (u32 channel = 0; channel < channelNum; channel++)
+        lengthSq += axis[channel] * axis[channel];
+    // Flat block, any direction works
+    const float invLength = lengthSq > 0.0f ? 1.0f / std::sqrt(lengthSq) : 0.0f;
+    for (u32 channel = 0; channel < channelNum; channel++)
+        pAxis[channel] = axis[channel] * invLength;
+}
+
+// Extremes of the block along its principal axis
+void FindEndpoints(const BlockChannels& block, u32 channelNum, float* pStart, float* pEnd) {
+    float mean[4], axis[4], t[BLOCK_PIXEL_NUM];
+    ComputePrincipalAxis(block, channelNum, mean, axis);
+    ProjectBlock(block, channelNum, mean, axis, t);
+
+    float minT = t[0], maxT = t[0];
+    for (u32 i = 1; i < BLOCK_PIXEL_NUM; i++) {
+        minT = std::min(minT, t[i]);
+        maxT = std::max(maxT, t[i]);
+    }
+    for (u32 channel = 0; channel < channelNum; channel++) {
+        pStart[channel] = std::clamp(mean[channel] + axis[channel] * minT, 0.0f, 255.0f);
+        pEnd[channel]   = std::clamp(mean[channel] + axis[channel] * maxT, 0.0f, 255.0f);
+    }
+}
+
+u16 PackRgb565(const float* pColor) {
+    const u32 r = (u32)std::lround(pColor[0] * 31.0f / 255.0f);
+    const u32 g = (u32)std::lround(pColor[1] * 63.0f / 255.0f);
+    const u32 b = (u32)std::lround(pColor[2] * 31.0f / 255.0f);
+    return (u16)(r << 11 | g << 5 | b);
+}
+
+void UnpackRgb565(u16 packed, float* pColor) {
+    const u32 r = packed >> 11;
+    const u32 g = (packed >> 5) & 0x3F;
+    const u32 b = packed & 0x1F;
+    pColor[0] = (float)(r << 3 | r >> 2);
+    pColor[1] = (float)(g << 2 | g >> 4);
+    pColor[2] = (float)(b << 3 | b >> 2);
+}
+
+// Little-endian bit stream of one 128-bit block
+class BlockWriter {
+public:
+    void Put(u32 value, u32 bitNum) {
+        for (u32 i = 0; i < bitNum; i++, m_bitPos++) {
+            if (value >> i & 1)
+                m_bytes[m_bitPos / 8] |= (u8)(1 << (m_bitPos % 8));
+        }
+    }
+    void Store(u8* pBlock) const {
+        SDL_memcpy(pBlock, m_bytes.data(), m_bytes.size());
+    }
+private:
+    array<u8, 16> m_bytes = {};
+    u32           m_bitPos = 0;
+};
+
+u32 GetBlockSize(SDL_GPUTextureFormat format) {
+    return format == SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM ? 8 : 16;
+}
+
+void EncodeBlock(SDL_GPUTextureFormat format, const u8* pPixels, u8* pBlock) {
+    switch (format) {
+        case SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM: EncodeBC1(pPixels, pBlock); break;
+        case SDL_GPU_TEXTUREFORMAT_BC5_RG_UNORM:   EncodeBC5(pPixels, pBlock); break;
+        case SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM: EncodeBC7(pPixels, pBlock); break;
+        default: SDL_assert(false);
+    }
+}
+
+}
+
+SDL_GPUTextureFormat GetCompressedFormat(Renderer::TexIdx texIdx) {
+    switch (texIdx) {
+        case Renderer::TexIdx_Albedo: return SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM;
+        case Renderer::TexIdx_Normal: return SDL_GPU_TEXTUREFORMAT_BC5_RG_UNORM;
+        default:                      return SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM;
+    }
+}
+
+u32 GetImageFlags(Renderer::TexIdx texIdx) {
+    switch (texIdx) {
+        case Renderer::TexIdx_Albedo: return ImageFlags_Srgb;
+        case Renderer::TexIdx_Normal: return ImageFlags_NormalMap;
+        default:                      return ImageFlags_None;
+    }
+}
+
+Renderer::TextureData CompressTexture(const Renderer::TextureData& rgba, Renderer::TexIdx texIdx, ImageFilter mipFilter) {
+    SDL_assert(rgba.format == SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM);
+    SDL_assert(rgba.mipLevelNum == 1 || rgba.mipLevelNum == GetMipLevelNum(rgba.width, rgba.height));
+
+    // D3D12 needs the top level of a BC texture in whole blocks, other sizes are resized up to them
+    const u32 baseWidth  = (rgba.width + 3) & ~3u;
+    const u32 baseHeight = (rgba.height + 3) & ~3u;
+    Renderer::TextureData compressed = {
+        .width       = baseWidth,
+        .height      = baseHeight,
+        .format      = GetCompressedFormat(texIdx),
+        .mipLevelNum = GetMipLevelNum(baseWidth, baseHeight)
+    };
+
+    u64 compressedSize = 0;
+    for (u32 mip = 0; mip < compressed.mipLevelNum; mip++) {
+        const u32 width  = GetMipSize(baseWidth, mip);
+        const u32 height = GetMipSize(baseHeight, mip);
+        compressedSize += (u64)((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(compressed.format);
+    }
+    u8* pCompressed = (u8*)ScopedAlloc(compressedSize);
+    compressed.pPixels = pCompressed;
+
+    // The RGBA chain is a temporary of this call, images that ship with mips are encoded as they are
+    // unless they had to be resized
+    ScratchScope scratch;
+    Renderer::TextureData base = rgba;
+    if (baseWidth != rgba.width || baseHeight != rgba.height) {
+        u8* pResized = (u8*)ScopedAlloc((u64)baseWidth * baseHeight * 4);
+        ResizeImage((const u8*)rgba.pPixels, rgba.width, rgba.height, pResized, baseWidth, baseHeight, ImageFilter_Triangle, GetImageFlags(texIdx));
+        base = {
+            .pPixels = pResized,
+            .width   = baseWidth,
+            .height  = baseHeight
+        };
+    }
+    const Renderer::TextureData mips = base.mipLevelNum == 1 ? GenerateMips(base, mipFilter, GetImageFlags(texIdx)) : base;
+    const u8* pLevel = (const u8*)mips.pPixels;
+    const u32 blockSize = GetBlockSize(compressed.format);
+    for (u32 mip = 0; mip < compressed.mipLevelNum; mip++) {
+        const u32 width  = GetMipSize(baseWidth, mip);
+        const u32 height = GetMipSize(baseHeight, mip);
+        const u32 blockColumnNum = (width + 3) / 4;
+        const u32 blockNum = blockColumnNum * ((height + 3) / 4);
+
+        JobSystem::GetInstance().ParallelFor(blockNum, 256, [&](u32 begin, u32 end) {
+            array<u8, BLOCK_PIXEL_NUM * 4> pixels;
+            for (u32 blockIdx = begin; blockIdx < end; blockIdx++) {
+                const u32 blockX = blockIdx % blockColumnNum * 4;
+                const u32 blockY = blockIdx / blockColumnNum * 4;
+                // Edge blocks repeat the last row and column
+                for (u32 y = 0; y < 4; y++) {
+                    for (u32 x = 0; x < 4; x++) {
+                        const u32 srcX = std::min(blockX + x, width - 1);
+                        const u32 srcY = std::min(blockY + y, height - 1);
+                        SDL_memcpy(&pixels[(y * 4 + x) * 4], &pLevel[((u64)srcY * width + srcX) * 4], 4);
+                    }
+                }
+                EncodeBlock(compressed.format, pixels.data(), pCompressed + (u64)blockIdx * blockSize);
+            }
+        });
+        pCompressed += (u64)blockNum * blockSize;
+        pLevel += (u64)width * height * 4;
+    }
+
+    return compressed;
+}
+
+void EncodeBC1(const u8* pPixels, u8* pBlock) {
+    BlockChannels block;
+    LoadBlock(pPixels, 3, block);
+
+    float start[3], end[3];
+    FindEndpoints(block, 3, start, end);
+    u16 color0 = PackRgb565(end);
+    u16 color1 = PackRgb565(start);
+    // color0 > color1 selects the four color mode
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    u32 indices = 0;
+    if (color0 != color1) {
+        float palette0[3], palette1[3], axis[3];
+        UnpackRgb565(color0, palette0);
+        UnpackRgb565(color1, palette1);
+        float lengthSq = 0.0f;
+        for (u32 channel = 0; channel < 3; channel++) {
+            axis[channel] = palette1[channel] - palette0[channel];
+            lengthSq += axis[channel] * axis[channel];
+        }
+
+        float t[BLOCK_PIXEL_NUM];
+        ProjectBlock(block, 3, palette0, axis, t);
+        // Palette order is color0, color1, 2/3 color0 + 1/3 color1, 1/3 color0 + 2/3 color1
+        static constexpr array<u32, 4> stepToIndex = { 0, 2, 3, 1 };
+        for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++) {
+            const u32 step = (u32)(std::clamp(t[i] / lengthSq, 0.0f, 1.0f) * 3.0f + 0.5f);
+            indices |= stepToIndex[step] << (i * 2);
+        }
+    }
+
+    SDL_memcpy(pBlock + 0, &color0, sizeof(color0));
+    SDL_memcpy(pBlock + 2, &color1, sizeof(color1));
+    SDL_memcpy(pBlock + 4, &indices, sizeof(indices));
+}
+
+void EncodeBC4(const u8* pPixels, u32 channel, u8* pBlock) {
+    u32 minValue = 255, maxValue = 0;
+    for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++) {
+        minValue = std::min<u32>(minValue, pPixels[i * 4 + channel]);
+        maxValue = std::max<u32>(maxValue, pPixels[i * 4 + channel]);
+    }
+
+    // Eight value mode (endpoint 0 > endpoint 1); a flat block keeps all indices at 0
+    u64 indices = 0;
+    if (maxValue > minValue) {
+        // Palette order is max, min, then the six interpolated values from max down to min
+        static constexpr array<u32, 8> stepToIndex = { 1, 7, 6, 5, 4, 3, 2, 0 };
+        const u32 range = maxValue - minValue;
+        for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++) {
+            const u32 step = ((pPixels[i * 4 + channel] - minValue) * 7 + range / 2) / range;
+            indices |= (u64)stepToIndex[step] << (i * 3);
+        }
+    }
+
+    pBlock[0] = (u8)maxValue;
+    pBlock[1] = (u8)minValue;
+    SDL_memcpy(pBlock + 2, &indices, 6);
+}
+
+void EncodeBC5(const u8* pPixels, u8* pBlock) {
+    EncodeBC4(pPixels, 0, pBlock);
+    EncodeBC4(pPixels, 1, pBlock + 8);
+}
+
+void EncodeBC7(const u8* pPixels, u8* pBlock) {
+    BlockChannels block;
+    LoadBlock(pPixels, 4, block);
+
+    float endpoints[2][4];
+    FindEndpoints(block, 4, endpoints[0], endpoints[1]);
+
+    // 7 bits per channel plus one p-bit shared by the channels of each endpoint
+    u32 quantized[2][4], pBits[2];
+    float reconstructed[2][4];
+    for (u32 e = 0; e < 2; e++) {
+        float bestError = FLT_MAX;
+        for (u32 pBit = 0; pBit < 2; pBit++) {
+            u32 candidate[4];
+            float error = 0.0f;
+            for (u32 channel = 0; channel < 4; channel++) {
+                candidate[channel] = (u32)std::clamp(std::lround((endpoints[e][channel] - pBit) * 0.5f), 0l, 127l);
+                const float delta = (float)(candidate[channel] << 1 | pBit) - endpoints[e][channel];
+                error += delta * delta;
+            }
+            if (error < bestError) {
+                bestError = error;
+                pBits[e] = pBit;
+                for (u32 channel = 0; channel < 4; channel++) {
+                    quantized[e][channel] = candidate[channel];
+                    reconstructed[e][channel] = (float)(candidate[channel] << 1 | pBit);
+                }
+            }
+        }
+    }
+
+    array<u32, BLOCK_PIXEL_NUM> indices = {};
+    float axis[4];
+    float lengthSq = 0.0f;
+    for (u32 channel = 0; channel < 4; channel++) {
+        axis[channel] = reconstructed[1][channel] - reconstructed[0][channel];
+        lengthSq += axis[channel] * axis[channel];
+    }
+    if (lengthSq > 0.0f) {
+        float t[BLOCK_PIXEL_NUM];
+        ProjectBlock(block, 4, reconstructed[0], axis, t);
+        for (u32 i = 0; i < BLOCK_PIXEL_NUM; i++) {
+            const float weight = std::clamp(t[i] / lengthSq, 0.0f, 1.0f) * 64.0f;
+            u32 best = 0;
+            while (best + 1 < BC7_WEIGHTS.size() && std::abs(BC7_WEIGHTS[best + 1] - weight) < std::abs(BC7_WEIGHTS[best] - weight))
+                best++;
+            indices[i] = best;
+        }
+    }
+
+    // The anchor index has an implicit 0 high bit; the weights are symmetric, so swapping
+    // the endpoints and mirroring the indices is lossless
+    if (indices[0] >= 8) {
+        for (u32 channel = 0; channel < 4; channel++)
+            std::swap(quantized[0][channel], quantized[1][channel]);
+        std::swap(pBits[0], pBits[1]);
+        for (u32& index : indices)
+            index = 15 - index;
+    }
+
+    BlockWriter writer;
+    writer.Put(1 << 6, 7); // Mode 6
+    for (u32 channel = 0; channel < 4; channel++) {
+        writer.Put(quantized[0][channel], 7);
+        writer.Put(quantized[1][channel], 7);
+    }
+    writer.Put(pBits[0], 1);
+    writer.Put(pBits[1], 1);
+    writer.Put(indices[0], 3);
+    for (u32 i = 1; i < BLOCK_PIXEL_NUM; i++)
+        writer.Put(indices[i], 4);
+    writer.Store(pBlock);
+}
+
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+#include "image_kernels.h"
+
+// Block-compressed format per material slot: BC7 albedo, BC5 normal (z is rebuilt in
+// the shader), BC1 ARM
+SDL_GPUTextureFormat GetCompressedFormat(Renderer::TexIdx texIdx);
+
+// ImageFlags of the material slot: sRGB albedo, renormalized normals, linear ARM
+u32 GetImageFlags(Renderer::TexIdx texIdx);
+
+// Encodes every level of the full mip chain of an RGBA8 image; a single level gets its
+// chain built with mipFilter first. Blocks are spread over the job system. The result is
+// allocated with ScopedAlloc() (see arena.h), the source pixels are left alone. Sizes that are
+// not multiples of 4 are resized up to the next ones first
+Renderer::TextureData CompressTexture(const Renderer::TextureData& rgba, Renderer::TexIdx texIdx, ImageFilter mipFilter = ImageFilter_Box);
+
+// Single 4x4 block encoders, pPixels is 16 RGBA8 pixels row by row
+void EncodeBC1(const u8* pPixels, u8* pBlock);              // 8 bytes, RGB
+void EncodeBC4(const u8* pPixels, u32 channel, u8* pBlock); // 8 bytes, one channel
+void EncodeBC5(const u8* pPixels, u8* pBlock);              // 16 bytes, red and green
+void EncodeBC7(const u8* pPixels, u8* pBlock);              // 16 bytes, mode 6 (RGBA, one subset)
+
@@ -0,0 +1,453 @@
+#include "texture_file.h"
+
+#include "../pch.h"
+#include "file_system.h"
+#include "../arena.h"
+#include "image_kernels.h"
+
+namespace {
+
+constexpr array<u8, 12> KTX2_IDENTIFIER = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct Ktx2Header {
+    u8  identifier[12];
+    u32 vkFormat;
+    u32 typeSize;
+    u32 pixelWidth;
+    u32 pixelHeight;
+    u32 pixelDepth;
+    u32 layerCount;
+    u32 faceCount;
+    u32 levelCount;
+    u32 supercompressionScheme;
+    u32 dfdByteOffset;
+    u32 dfdByteLength;
+    u32 kvdByteOffset;
+    u32 kvdByteLength;
+    u64 sgdByteOffset;
+    u64 sgdByteLength;
+};
+
+struct Ktx2Level {
+    u64 byteOffset;
+    u64 byteLength;
+    u64 uncompressedByteLength;
+};
+
+constexpr u32 DDS_MAGIC        = 0x20534444; // "DDS "
+constexpr u32 DDS_FOURCC_DX10  = 0x30315844;
+constexpr u32 DDSD_MIPMAPCOUNT = 0x20000;
+constexpr u32 DDPF_FOURCC      = 0x4;
+constexpr u32 DDPF_RGB         = 0x40;
+constexpr u32 DDSCAPS2_CUBEMAP = 0x200;
+constexpr u32 DDSCAPS2_VOLUME  = 0x200000;
+constexpr u32 DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+constexpr u32 DDS_DIMENSION_TEXTURE2D = 3;
+
+struct DdsPixelFormat {
+    u32 size;
+    u32 flags;
+    u32 fourCC;
+    u32 rgbBitCount;
+    u32 rBitMask;
+    u32 gBitMask;
+    u32 bBitMask;
+    u32 aBitMask;
+};
+
+struct DdsHeader {
+    u32            size;
+    u32            flags;
+    u32            height;
+    u32            width;
+    u32            pitchOrLinearSize;
+    u32            depth;
+    u32            mipMapCount;
+    u32            reserved1[11];
+    DdsPixelFormat pixelFormat;
+    u32            caps;
+    u32            caps2;
+    u32            caps3;
+    u32            caps4;
+    u32            reserved2;
+};
+
+struct DdsHeaderDx10 {
+    u32 dxgiFormat;
+    u32 resourceDimension;
+    u32 miscFlag;
+    u32 arraySize;
+    u32 miscFlags2;
+};
+
+constexpr u32 MakeFourCC(char a, char b, char c, char d) {
+    return (u32)a | (u32)b << 8 | (u32)c << 16 | (u32)d << 24;
+}
+
+SDL_GPUTextureFormat VkFormatToGpuFormat(u32 vkFormat) {
+    switch (vkFormat) {
+        case 9:   return SDL_GPU_TEXTUREFORMAT_R8_UNORM;
+        case 16:  return SDL_GPU_TEXTUREFORMAT_R8G8_UNORM;
+        case 37:  return SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM;
+        case 43:  return SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM_SRGB;
+        case 44:  return SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM;
+        case 50:  return SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM_SRGB;
+        case 97:  return SDL_GPU_TEXTUREFORMAT_R16G16B16A16_FLOAT;
+        case 109: return SDL_GPU_TEXTUREFORMAT_R32G32B32A32_FLOAT;
+        case 131: // BC1_RGB, same blocks
+        case 133: return SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM;
+        case 132:
+        case 134: return SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM_SRGB;
+        case 135: return SDL_GPU_TEXTUREFORMAT_BC2_RGBA_UNORM;
+        case 136: return SDL_GPU_TEXTUREFORMAT_BC2_RGBA_UNORM_SRGB;
+        case 137: return SDL_GPU_TEXTUREFORMAT_BC3_RGBA_UNORM;
+        case 138: return SDL_GPU_TEXTUREFORMAT_BC3_RGBA_UNORM_SRGB;
+        case 139: return SDL_GPU_TEXTUREFORMAT_BC4_R_UNORM;
+        case 141: return SDL_GPU_TEXTUREFORMAT_BC5_RG_UNORM;
+        case 143: return SDL_GPU_TEXTUREFORMAT_BC6H_RGB_UFLOAT;
+        case 144: return SDL_GPU_TEXTUREFORMAT_BC6H_RGB_FLOAT;
+        case 145: return SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM;
+        case 146: return SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM_SRGB;
+        default:  return SDL_GPU_TEXTUREFORMAT_INVALID;
+    }
+}
+
+// Data format descriptor of the formats written by WriteKtx2()
+struct Ktx2FormatInfo {
+    u32 vkFormat;
+    u8  colorModel;
+    u8  bytesPerBlock;
+    u8  blockDimension; // Texel block width and height minus one
+    u8  channelNum;
+    u8  channelIds[4];
+};
+
+constexpr u8 KHR_DF_MODEL_RGBSDA = 1;
+constexpr u8 KHR_DF_MODEL_BC1A   = 128;
+constexpr u8 KHR_DF_MODEL_BC4    = 131;
+constexpr u8 KHR_DF_MODEL_BC5    = 132;
+constexpr u8 KHR_DF_MODEL_BC7    = 134;
+constexpr u8 KHR_DF_PRIMARIES_BT709 = 1;
+constexpr u8 KHR_DF_TRANSFER_LINEAR = 1;
+
+bool GetKtx2FormatInfo(SDL_GPUTextureFormat format, Ktx2FormatInfo& info) {
+    switch (format) {
+        case SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM: info = { 37,  KHR_DF_MODEL_RGBSDA, 4,  0, 4, { 0, 1, 2, 15 } }; return true;
+        case SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM: info = { 133, KHR_DF_MODEL_BC1A,   8,  3, 1, { 0 } };          return true;
+        case SDL_GPU_TEXTUREFORMAT_BC4_R_UNORM:    info = { 139, KHR_DF_MODEL_BC4,    8,  3, 1, { 0 } };          return true;
+        case SDL_GPU_TEXTUREFORMAT_BC5_RG_UNORM:   info = { 141, KHR_DF_MODEL_BC5,    16, 3, 2, { 0, 1 } };       return true;
+        case SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM: info = { 145, KHR_DF_MODEL_BC7,    16, 3, 1, { 0 } };          return true;
+        default:                                   return false;
+    }
+}
+
+SDL_GPUTextureFormat DxgiFormatToGpuFormat(u32 dxgiFormat) {
+    switch (dxgiFormat) {
+        case 2:  return SDL_GPU_TEXTUREFORMAT_R32G32B32A32_FLOAT;
+        case 10: return SDL_GPU_TEXTUREFORMAT_R16G16B16A16_FLOAT;
+        case 28: return SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM;
+        case 29: return SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM_SRGB;
+        case 49: return SDL_GPU_TEXTUREFORMAT_R8G8_UNORM;
+        case 61: return SDL_GPU_TEXTUREFORMAT_R8_UNORM;
+        case 71: return SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM;
+        case 72: return SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM_SRGB;
+        case 74: return SDL_GPU_TEXTUREFORMAT_BC2_RGBA_UNORM;
+        case 75: return SDL_GPU_TEXTUREFORMAT_BC2_RGBA_UNORM_SRGB;
+        case 77: return SDL_GPU_TEXTUREFORMAT_BC3_RGBA_UNORM;
+        case 78: return SDL_GPU_TEXTUREFORMAT_BC3_RGBA_UNORM_SRGB;
+        case 80: return SDL_GPU_TEXTUREFORMAT_BC4_R_UNORM;
+        case 83: return SDL_GPU_TEXTUREFORMAT_BC5_RG_UNORM;
+        case 87: return SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM;
+        case 91: return SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM_SRGB;
+        case 95: return SDL_GPU_TEXTUREFORMAT_BC6H_RGB_UFLOAT;
+        case 96: return SDL_GPU_TEXTUREFORMAT_BC6H_RGB_FLOAT;
+        case 98: return SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM;
+        case 99: return SDL_GPU_TEXTUREFORMAT_BC7_RGBA_UNORM_SRGB;
+        default: return SDL_GPU_TEXTUREFORMAT_INVALID;
+    }
+}
+
+// Pre-DX10 headers describe the format with a FourCC code or channel masks
+SDL_GPUTextureFormat LegacyDdsFormatToGpuFormat(const DdsPixelFormat& pixelFormat) {
+    if (pixelFormat.flags & DDPF_FOURCC) {
+        switch (pixelFormat.fourCC) {
+            case MakeFourCC('D', 'X', 'T', '1'): return SDL_GPU_TEXTUREFORMAT_BC1_RGBA_UNORM;
+            case MakeFourCC('D', 'X', 'T', '2'):
+            case MakeFourCC('D', 'X', 'T', '3'): return SDL_GPU_TEXTUREFORMAT_BC2_RGBA_UNORM;
+            case MakeFourCC('D', 'X', 'T', '4'):
+            case MakeFourCC('D', 'X', 'T', '5'): return SDL_GPU_TEXTUREFORMAT_BC3_RGBA_UNORM;
+            case MakeFourCC('A', 'T', 'I', '1'):
+            case MakeFourCC('B', 'C', '4', 'U'): return SDL_GPU_TEXTUREFORMAT_BC4_R_UNORM;
+            case MakeFourCC('A', 'T', 'I', '2'):
+            case MakeFourCC('B', 'C', '5', 'U'): return SDL_GPU_TEXTUREFORMAT_BC5_RG_UNORM;
+            default:                             return SDL_GPU_TEXTUREFORMAT_INVALID;
+        }
+    }
+    if ((pixelFormat.flags & DDPF_RGB) && pixelFormat.rgbBitCount == 32) {
+        if (pixelFormat.rBitMask == 0x000000FF && pixelFormat.gBitMask == 0x0000FF00 && pixelFormat.bBitMask == 0x00FF0000)
+            return SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM;
+        if (pixelFormat.rBitMask == 0x00FF0000 && pixelFormat.gBitMask == 0x0000FF00 && pixelFormat.bBitMask == 0x000000FF)
+            return SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM;
+    }
+    return SDL_GPU_TEXTUREFORMAT_INVALID;
+}
+
+SDL_GPUTextureType GetTextureType(bool isCube, bool isArray) {
+    if (isCube)
+        return isArray ? SDL_GPU_TEXTURETYPE_CUBE_ARRAY : SDL_GPU_TEXTURETYPE_CUBE;
+    return isArray ? SDL_GPU_TEXTURETYPE_2D_ARRAY : SDL_GPU_TEXTURETYPE_2D;
+}
+
+u32 GetLayerSize(const Renderer::TextureData& texture, u32 mip) {
+    return SDL_CalculateGPUTextureFormatSize(
+        texture.format,
+        std::max(texture.width >> mip, 1u),
+        std::max(texture.height >> mip, 1u),
+        1
+    );
+}
+
+bool Fail(const string& path, const char* reason) {
+    SDL_Log("Could not load texture %s: %s", path.c_str(), reason);
+    return false;
+}
+
+}
+
+bool LoadKtx2(const string& path, Renderer::TextureData& texture) {
+    FileBuffer file;
+    if (!FileSystem::GetInstance().ReadFile(path, file))
+        return Fail(path, "could not open the file");
+    return LoadKtx2(path, file, texture);
+}
+
+bool LoadKtx2(const string& path, const FileBuffer& file, Renderer::TextureData& texture) {
+    Ktx2Header header;
+    if (file.GetSize() < sizeof(header))
+        return Fail(path, "truncated header");
+    SDL_memcpy(&header, file.GetData(), sizeof(header));
+    if (SDL_memcmp(header.identifier, KTX2_IDENTIFIER.data(), KTX2_IDENTIFIER.size()) != 0)
+        return Fail(path, "not a KTX2 file");
+    if (header.supercompressionScheme != 0)
+        return Fail(path, "supercompression is not supported");
+    if (header.pixelDepth > 1 || header.pixelHeight == 0)
+        return Fail(path, "only 2D textures are supported");
+    if (header.faceCount != 1 && header.faceCount != 6)
+        return Fail(path, "invalid face count");
+
+    texture = {
+        .width       = header.pixelWidth,
+        .height      = header.pixelHeight,
+        .format      = VkFormatToGpuFormat(header.vkFormat),
+        .mipLevelNum = std::max(header.levelCount, 1u), // 0 asks for runtime generation, only the base level is stored then
+        .layerNum    = std::max(header.layerCount, 1u) * header.faceCount,
+        .type        = GetTextureType(header.faceCount == 6, header.layerCount > 0)
+    };
+    if (texture.format == SDL_GPU_TEXTUREFORMAT_INVALID)
+        return Fail(path, "unsupported format");
+    if (texture.mipLevelNum > GetMipLevelNum(texture.width, texture.height))
+        return Fail(path, "invalid level count");
+
+    const u64 levelIndexOffset = sizeof(header);
+    if (levelIndexOffset + texture.mipLevelNum * sizeof(Ktx2Level) > file.GetSize())
+        return Fail(path, "truncated level index");
+
+    // Levels are stored smallest first with their own alignment, repack them largest first and tight
+    const u32 dataSize = Renderer::GetTextureDataSize(texture);
+    u8* pData = (u8*)ScopedAlloc(dataSize);
+    u64 offset = 0;
+    for (u32 mip = 0; mip < texture.mipLevelNum; mip++) {
+        Ktx2Level level;
+        SDL_memcpy(&level, file.GetData() + levelIndexOffset + mip * sizeof(Ktx2Level), sizeof(level));
+        const u64 levelSize = (u64)GetLayerSize(texture, mip) * texture.layerNum;
+        if (level.byteLength != levelSize || level.byteOffset + level.byteLength > file.GetSize()) {
+            ScopedFree(pData);
+            return Fail(path, "invalid level size");
+        }
+        SDL_memcpy(pData + offset, file.GetData() + level.byteOffset, levelSize);
+        offset += levelSize;
+    }
+
+    texture.pPixels = pData;
+    return true;
+}
+
+bool LoadDds(const string& path, Renderer::TextureData& texture) {
+    FileBuffer file;
+    if (!FileSystem::GetInstance().ReadFile(path, file))
+        return Fail(path, "could not open the file");
+    return LoadDds(path, file, texture);
+}
+
+bool LoadDds(const string& path, const FileBuffer& file, Renderer::TextureData& texture) {
+    u32 magic;
+    DdsHeader header;
+    if (file.GetSize() < sizeof(magic) + sizeof(header))
+        return Fail(path, "truncated header");
+    SDL_memcpy(&magic, file.GetData(), sizeof(magic));
+    SDL_memcpy(&header, file.GetData() + sizeof(magic), sizeof(header));
+    if (magic != DDS_MAGIC || header.size != sizeof(header))
+        return Fail(path, "not a DDS file");
+    if (header.caps2 & DDSCAPS2_VOLUME)
+        return Fail(path, "volume textures are not supported");
+
+    u64 dataOffset = sizeof(magic) + sizeof(header);
+    bool isCube = (header.caps2 & DDSCAPS2_CUBEMAP) != 0;
+    u32 arraySize = 1;
+    SDL_GPUTextureFormat format;
+    if ((header.pixelFormat.flags & DDPF_FOURCC) && header.pixelFormat.fourCC == DDS_FOURCC_DX10) {
+        DdsHeaderDx10 headerDx10;
+        if (file.GetSize() < dataOffset + sizeof(headerDx10))
+            return Fail(path, "truncated DX10 header");
+        SDL_memcpy(&headerDx10, file.GetData() + dataOffset, sizeof(headerDx10));
+        dataOffset += sizeof(headerDx10);
+        if (headerDx10.resourceDimension != DDS_DIMENSION_TEXTURE2D)
+            return Fail(path, "only 2D textures are supported");
+
+        format    = DxgiFormatToGpuFormat(headerDx10.dxgiFormat);
+        isCube    = (headerDx10.miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE) != 0;
+        arraySize = std::max(headerDx10.arraySize, 1u);
+    }
+    else {
+        format = LegacyDdsFormatToGpuFormat(header.pixelFormat);
+    }
+    if (format == SDL_GPU_TEXTUREFORMAT_INVALID)
+        return Fail(path, "unsupported format");
+
+    texture = {
+        .width       = header.width,
+        .height      = header.height,
+        .format      = format,
+        .mipLevelNum = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(header.mipMapCount, 1u) : 1u,
+        .layerNum    = arraySize * (isCube ? 6 : 1),
+        .type        = GetTextureType(isCube, arraySize > 1)
+    };
+
+    // A bogus count would overflow the size sum before the truncation check
+    if (texture.mipLevelNum > GetMipLevelNum(texture.width, texture.height))
+        return Fail(path, "invalid mip count");
+    const u32 dataSize = Renderer::GetTextureDataSize(texture);
+    if (dataOffset + dataSize > file.GetSize())
+        return Fail(path, "truncated image data");
+
+    // DDS stores each layer with its whole mip chain, the canonical layout is level by level
+    vector<u64> mipOffsets(texture.mipLevelNum);
+    u64 layerChainSize = 0;
+    u64 canonicalOffset = 0;
+    for (u32 mip = 0; mip < texture.mipLevelNum; mip++) {
+        mipOffsets[mip] = canonicalOffset;
+        canonicalOffset += (u64)GetLayerSize(texture, mip) * texture.layerNum;
+        layerChainSize += GetLayerSize(texture, mip);
+    }
+
+    u8* pData = (u8*)ScopedAlloc(dataSize);
+    const u8* pSrc = file.GetData() + dataOffset;
+    for (u32 layer = 0; layer < texture.layerNum; layer++) {
+        u64 srcOffset = layer * layerChainSize;
+        for (u32 mip = 0; mip < texture.mipLevelNum; mip++) {
+            const u32 layerSize = GetLayerSize(texture, mip);
+            SDL_memcpy(pData + mipOffsets[mip] + (u64)layer * layerSize, pSrc + srcOffset, layerSize);
+            srcOffset += layerSize;
+        }
+    }
+
+    texture.pPixels = pData;
+    return true;
+}
+
+bool IsTextureContainer(const string& path) {
+    const string extension = std::filesystem::path(path).extension().string();
+    return extension == ".ktx2" || extension == ".dds";
+}
+
+bool LoadTextureContainer(const string& path, Renderer::TextureData& texture) {
+    if (std::filesystem::path(path).extension() == ".ktx2")
+        return LoadKtx2(path, texture);
+    return LoadDds(path, texture);
+}
+
+bool LoadTextureContainer(const string& path, const FileBuffer& file, Renderer::TextureData& texture) {
+    if (std::filesystem::path(path).extension() == ".ktx2")
+        return LoadKtx2(path, file, texture);
+    return LoadDds(path, file, texture);
+}
+
+
+bool WriteKtx2(const string& path, const Renderer::TextureData& texture) {
+    Ktx2FormatInfo info;
+    if (!GetKtx2FormatInfo(texture.format, info) || texture.type != SDL_GPU_TEXTURETYPE_2D || texture.layerNum != 1) {
+        SDL_Log("Could not write texture %s: unsupported format or type", path.c_str());
+        return false;
+    }
+
+    // Basic descriptor block: 24 bytes plus one 16 byte sample per channel, samples split the block evenly
+    const u32 sampleBits = info.bytesPerBlock * 8 / info.channelNum;
+    const u32 dfdBlockSize = 24 + 16 * info.channelNum;
+    vector<u8> dfd(4 + dfdBlockSize, 0);
+    const u32 dfdTotalSize = dfd.size();
+    const u32 dfdVersionAndSize = 2 | dfdBlockSize << 16;
+    SDL_memcpy(dfd.data(), &dfdTotalSize, 4);
+    SDL_memcpy(dfd.data() + 8, &dfdVersionAndSize, 4);
+    dfd[12] = info.colorModel;
+    dfd[13] = KHR_DF_PRIMARIES_BT709;
+    dfd[14] = KHR_DF_TRANSFER_LINEAR;
+    dfd[16] = info.blockDimension;
+    dfd[17] = info.blockDimension;
+    dfd[20] = info.bytesPerBlock;
+    for (u32 i = 0; i < info.channelNum; i++) {
+        u8* pSample = dfd.data() + 28 + i * 16;
+        const u16 bitOffset = i * sampleBits;
+        const u32 upper = sampleBits >= 32 ? 0xFFFFFFFF : (1u << sampleBits) - 1;
+        SDL_memcpy(pSample, &bitOffset, 2);
+        pSample[2] = sampleBits - 1;
+        pSample[3] = info.channelIds[i];
+        SDL_memcpy(pSample + 12, &upper, 4);
+    }
+
+    Ktx2Header header = {
+        .vkFormat    = info.vkFormat,
+        .typeSize    = 1,
+        .pixelWidth  = texture.width,
+        .pixelHeight = texture.height,
+        .faceCount   = 1,
+        .levelCount  = texture.mipLevelNum,
+        .dfdByteOffset = (u32)(sizeof(Ktx2Header) + texture.mipLevelNum * sizeof(Ktx2Level)),
+        .dfdByteLength = dfdTotalSize
+    };
+    SDL_memcpy(header.identifier, KTX2_IDENTIFIER.data(), KTX2_IDENTIFIER.size());
+
+    // Levels are stored smallest first, aligned to lcm(block size, 4); all block sizes here are multiples of 4
+    const u64 levelAlignment = std::max<u64>(info.bytesPerBlock, 4);
+    vector<u64> mipOffsets(texture.mipLevelNum);
+    vector<Ktx2Level> levels(texture.mipLevelNum);
+    u64 srcOffset = 0;
+    for (u32 mip = 0; mip < texture.mipLevelNum; mip++) {
+        mipOffsets[mip] = srcOffset;
+        srcOffset += GetLayerSize(texture, mip);
+    }
+    u64 fileSize = header.dfdByteOffset + header.dfdByteLength;
+    for (i32 mip = texture.mipLevelNum - 1; mip >= 0; mip--) {
+        fileSize = (fileSize + levelAlignment - 1) / levelAlignment * levelAlignment;
+        levels[mip] = {
+            .byteOffset = fileSize,
+            .byteLength = GetLayerSize(texture, mip),
+            .uncompressedByteLength = GetLayerSize(texture, mip)
+        };
+        fileSize += levels[mip].byteLength;
+    }
+
+    vector<u8> file(fileSize, 0);
+    SDL_memcpy(file.data(), &header, sizeof(header));
+    SDL_memcpy(file.data() + sizeof(header), levels.data(), levels.size() * sizeof(Ktx2Level));
+    SDL_memcpy(file.data() + header.dfdByteOffset, dfd.data(), dfd.size());
+    for (u32 mip = 0; mip < texture.mipLevelNum; mip++)
+        SDL_memcpy(file.data() + levels[mip].byteOffset, (const u8*)texture.pPixels + mipOffsets[mip], levels[mip].byteLength);
+
+    // Same temporary file and rename as the mesh cache, readers never see a partial file
+    const string tempPath = path + ".tmp";
+    if (!SDL_SaveFile(tempPath.c_str(), file.data(), file.size()))
+        return false;
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    return !error;
+}
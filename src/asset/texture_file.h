@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+class FileBuffer;
+
+// Readers for GPU-ready texture containers with prebuilt mip chains, cubemap faces
+// and array layers. The result uses the canonical TextureData layout (mip levels
+// largest first, every layer of a level back to back, cube faces as consecutive
+// layers) in one ScopedAlloc() allocation (see arena.h). Supercompressed KTX2
+// (Basis, Zstd) and volume textures are not supported.
+bool LoadKtx2(const string& path, Renderer::TextureData& texture);
+bool LoadDds(const string& path, Renderer::TextureData& texture);
+// From file contents read elsewhere (FileSystem::ReadFiles()), path only names them
+bool LoadKtx2(const string& path, const FileBuffer& file, Renderer::TextureData& texture);
+bool LoadDds(const string& path, const FileBuffer& file, Renderer::TextureData& texture);
+
+// True for the extensions handled above
+bool IsTextureContainer(const string& path);
+bool LoadTextureContainer(const string& path, Renderer::TextureData& texture);
+bool LoadTextureContainer(const string& path, const FileBuffer& file, Renderer::TextureData& texture);
+
+
+// Writes a single layer 2D texture with its mip chain; RGBA8 and the BC formats produced by
+// asset/texture_compression.h. Used by the bake tool, see tools/bake.cpp
+bool WriteKtx2(const string& path, const Renderer::TextureData& texture);
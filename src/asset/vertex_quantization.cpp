@@ -0,0 +1,86 @@
+#include "vertex_quantization.h"
+
+#include "../pch.h"
+#include "glm/gtc/packing.hpp"
+
+namespace {
+
+glm::vec2 SignNotZero(const glm::vec2& v) {
+    return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+i16 PackSnorm16(float value) {
+    return (i16)glm::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+u16 PackUnorm16(float value) {
+    return (u16)glm::round(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+}
+
+glm::vec2 OctEncode(const glm::vec3& n) {
+    const float sum = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if (sum == 0.0f)
+        return glm::vec2(0);
+    glm::vec2 e = glm::vec2(n) / sum;
+    if (n.z < 0.0f)
+        e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * SignNotZero(e);
+    return e;
+}
+
+glm::vec3 OctDecode(const glm::vec2& e) {
+    glm::vec3 n = glm::vec3(e, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+    const float t = glm::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+void QuantizeVertices(Renderer::MeshCreateInfo& createInfo, Renderer::CompactVertex* pDst) {
+    SDL_assert(createInfo.vertexFormat == Renderer::VertexFormat_Full);
+
+    glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+    for (const Renderer::Vertex& vertex : createInfo.vertices) {
+        boundsMin = glm::min(boundsMin, vertex.pos);
+        boundsMax = glm::max(boundsMax, vertex.pos);
+    }
+    if (createInfo.vertices.empty())
+        boundsMin = boundsMax = glm::vec3(0);
+    // Flat meshes still need a non-zero range on every axis
+    const glm::vec3 boundsExtent = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+
+    if (pDst == nullptr) {
+        createInfo.compactVertices.resize(createInfo.vertices.size());
+        pDst = createInfo.compactVertices.data();
+    }
+    for (size_t i = 0; i < createInfo.vertices.size(); i++) {
+        const Renderer::Vertex& vertex = createInfo.vertices[i];
+        Renderer::CompactVertex compactVertex;
+
+        const glm::vec3 pos = (vertex.pos - boundsMin) / boundsExtent;
+        compactVertex.pos[0] = PackUnorm16(pos.x);
+        compactVertex.pos[1] = PackUnorm16(pos.y);
+        compactVertex.pos[2] = PackUnorm16(pos.z);
+        compactVertex.pos[3] = 0;
+
+        const glm::vec2 normal = OctEncode(vertex.normal);
+        compactVertex.normal[0] = PackSnorm16(normal.x);
+        compactVertex.normal[1] = PackSnorm16(normal.y);
+
+        const glm::vec2 tangent = OctEncode(vertex.tangent);
+        compactVertex.tangent[0] = PackSnorm16(tangent.x);
+        compactVertex.tangent[1] = PackSnorm16(tangent.y);
+
+        compactVertex.texCoord[0] = glm::packHalf1x16(vertex.texCoord.x);
+        compactVertex.texCoord[1] = glm::packHalf1x16(vertex.texCoord.y);
+        pDst[i] = compactVertex; // One store per vertex
+    }
+
+    createInfo.vertexFormat = Renderer::VertexFormat_Compact;
+    createInfo.boundsMin    = boundsMin;
+    createInfo.boundsExtent = boundsExtent;
+    createInfo.vertices     = {};
+}
+
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "../pch.h"
+#include "../renderer/renderer.h"
+
+// Converts createInfo.vertices to createInfo.compactVertices and switches the
+// mesh to VertexFormat_Compact. The full precision vertices are released.
+// With pDst the compact vertices are written there instead (e.g. mapped staging
+// memory, written sequentially) and compactVertices stays empty
+void QuantizeVertices(Renderer::MeshCreateInfo& createInfo, Renderer::CompactVertex* pDst = nullptr);
+
+// Octahedral mapping of a unit vector to [-1, 1]^2
+glm::vec2 OctEncode(const glm::vec3& n);
+glm::vec3 OctDecode(const glm::vec2& e);
+
@@ -19,8 +19,13 @@ constexpr float TARGET_FPS = 60.0f;
 int main() {
     Platform platform("PBR Renderer", WND_W, WND_H);
 
+    // Packed assets take priority over loose files when present
+    FileSystem::GetInstance().Mount("C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/assets.pbrarchive", "C:/Users/Bogdan/Documents/C_Projects/PbrRenderer");
+
     Renderer& renderer = Renderer::GetInstance();
     renderer.Initialize(platform.GetSDLWindow(), WND_W, WND_H);
+    // Materials of equal size and format share texture arrays, so their meshes share draws
+    renderer.SetMaterialBatching(true);
 
     platform.SetQuitCallback([](const auto& evt) { exit(0); });
     platform.SetResizeCallback([&](const SDL_Event& evt) {
@@ -38,8 +43,10 @@ int main() {
 
     Camera camera;
 
-    Renderer::MeshCreateInfo meshCreateInfo = LoadMesh("C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/res/axe/wooden_axe_03_1k.gltf");
-    renderer.CreateMesh(meshCreateInfo, "axe");
+    // Streamed in while the window keeps rendering
+    LoadModelAsync("C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/res/axe/wooden_axe_03_1k.gltf", "axe/", {}, []() {
+        SDL_Log("Axe loaded");
+    });
 
     float angle = 0.0f;
 
@@ -0,0 +1,72 @@
+#include "hash.h"
+
+#include "pch.h"
+
+namespace {
+
+constexpr u64 GOLDEN_RATIO = 0x9E3779B97F4A7C15;
+
+// MurmurHash3 finalizer
+u64 Mix(u64 x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCD;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53;
+    x ^= x >> 33;
+    return x;
+}
+
+u64 ReadWord(const u8* pData) {
+    u64 word;
+    SDL_memcpy(&word, pData, sizeof(word));
+    return word;
+}
+
+}
+
+u64 HashBytes(const void* pData, u64 size, u64 seed) {
+    const u8* pBytes = (const u8*)pData;
+    const u64 totalSize = size;
+
+    // Four independent lanes so that the multiplies of consecutive words overlap
+    u64 lanes[4] = { seed, seed + GOLDEN_RATIO, seed + 2 * GOLDEN_RATIO, seed + 3 * GOLDEN_RATIO };
+    while (size >= 32) {
+        for (u32 i = 0; i < 4; i++)
+            lanes[i] = Mix(lanes[i] ^ ReadWord(pBytes + i * 8)) * GOLDEN_RATIO;
+        pBytes += 32;
+        size   -= 32;
+    }
+
+    u64 hash = Mix(totalSize ^ lanes[0]);
+    for (u32 i = 1; i < 4; i++)
+        hash = HashCombine(hash, lanes[i]);
+    while (size >= 8) {
+        hash = HashCombine(hash, ReadWord(pBytes));
+        pBytes += 8;
+        size   -= 8;
+    }
+    if (size > 0) {
+        u64 tail = 0;
+        SDL_memcpy(&tail, pBytes, size);
+        hash = HashCombine(hash, tail);
+    }
+    return hash;
+}
+
+u64 HashCombine(u64 a, u64 b) {
+    return Mix(a ^ (b + GOLDEN_RATIO + (a << 6) + (a >> 2)));
+}
+
+u64 GetFileKey(const string& path) {
+    std::error_code error;
+    const std::filesystem::path canonicalPath = std::filesystem::canonical(path, error);
+    if (error)
+        return 0;
+    const i64 time = std::filesystem::last_write_time(canonicalPath, error).time_since_epoch().count();
+    if (error)
+        return 0;
+
+    const string canonicalString = canonicalPath.generic_string();
+    return HashCombine(HashBytes(canonicalString.data(), canonicalString.size()), (u64)time);
+}
+
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "pch.h"
+
+// 64-bit non-cryptographic hashing for content keys (resource sharing, caches)
+u64 HashBytes(const void* pData, u64 size, u64 seed = 0);
+u64 HashCombine(u64 a, u64 b);
+
+// Identifies a file by its canonical path and modification time; 0 if it does not exist
+u64 GetFileKey(const string& path);
+
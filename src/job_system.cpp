@@ -0,0 +1,117 @@
+#include "job_system.h"
+
+#include "pch.h"
+
+JobSystem::JobSystem() {
+    const u32 workerNum = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    for (u32 i = 0; i < workerNum; i++)
+        m_workers.emplace_back([this]() { WorkerLoop(); });
+    m_backgroundThread = std::thread([this]() { BackgroundLoop(); });
+}
+
+JobSystem& JobSystem::GetInstance() {
+    static JobSystem instance;
+    return instance;
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_all();
+    m_backgroundCondition.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+    m_backgroundThread.join();
+}
+
+u32 JobSystem::GetThreadNum() const {
+    return m_workers.size() + 1;
+}
+
+void JobSystem::Submit(Group& group, Job job) {
+    {
+        std::lock_guard lock(m_mutex);
+        group.m_pendingNum++;
+        m_queue.push_back({ std::move(job), &group });
+    }
+    m_condition.notify_one();
+}
+
+void JobSystem::Wait(Group& group) {
+    std::unique_lock lock(m_mutex);
+    while (group.m_pendingNum > 0) {
+        if (!m_queue.empty())
+            Run(lock);
+        else
+            m_condition.wait(lock);
+    }
+}
+
+void JobSystem::ParallelFor(u32 count, u32 minBatchSize, const RangeFunction& function) {
+    if (count == 0)
+        return;
+
+    // A few batches per thread so that uneven batches still balance out
+    const u32 batchSize = std::max(std::max(minBatchSize, 1u), count / (GetThreadNum() * 4) + 1);
+    if (batchSize >= count) {
+        function(0, count);
+        return;
+    }
+
+    Group group;
+    for (u32 begin = 0; begin < count; begin += batchSize) {
+        const u32 end = std::min(begin + batchSize, count);
+        Submit(group, [&function, begin, end]() { function(begin, end); });
+    }
+    Wait(group);
+}
+
+void JobSystem::SubmitBackground(Job job) {
+    {
+        std::lock_guard lock(m_mutex);
+        m_backgroundQueue.push_back(std::move(job));
+    }
+    m_backgroundCondition.notify_one();
+}
+
+void JobSystem::WorkerLoop() {
+    std::unique_lock lock(m_mutex);
+    while (true) {
+        m_condition.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+        if (m_quit)
+            return;
+        Run(lock);
+    }
+}
+
+// Pending background jobs are dropped on shutdown
+void JobSystem::BackgroundLoop() {
+    std::unique_lock lock(m_mutex);
+    while (true) {
+        m_backgroundCondition.wait(lock, [this]() { return m_quit || !m_backgroundQueue.empty(); });
+        if (m_quit)
+            return;
+
+        Job job = std::move(m_backgroundQueue.front());
+        m_backgroundQueue.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+// Pops one job and runs it with the lock released
+void JobSystem::Run(std::unique_lock<std::mutex>& lock) {
+    QueuedJob queuedJob = std::move(m_queue.front());
+    m_queue.pop_front();
+
+    lock.unlock();
+    queuedJob.job();
+    lock.lock();
+
+    if (--queuedJob.pGroup->m_pendingNum == 0)
+        m_condition.notify_all();
+}
+
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "pch.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+
+// Fixed pool of worker threads fed from a single queue. Threads that wait on a
+// group keep executing queued jobs, so jobs may submit and wait on nested groups.
+// Long-running work (streaming) goes to a separate background thread instead, so
+// it neither blocks the caller nor starves the pool
+class JobSystem {
+private:
+    JobSystem();
+public:
+    using Job = std::function<void()>;
+    using RangeFunction = std::function<void(u32 begin, u32 end)>;
+
+    class Group {
+    public:
+        Group() = default;
+        Group(const Group&) = delete;
+        void operator=(const Group&) = delete;
+    private:
+        friend class JobSystem;
+        u32 m_pendingNum = 0;
+    };
+
+    static JobSystem& GetInstance();
+    JobSystem(const JobSystem&) = delete;
+    void operator=(const JobSystem&) = delete;
+    ~JobSystem();
+    u32 GetThreadNum() const; // Workers plus the calling thread
+    void Submit(Group& group, Job job);
+    void Wait(Group& group);
+    // Splits [0, count) into batches of at least minBatchSize and blocks until all are done
+    void ParallelFor(u32 count, u32 minBatchSize, const RangeFunction& function);
+    // Runs the job on the background thread, jobs start in submission order
+    void SubmitBackground(Job job);
+private:
+    struct QueuedJob {
+        Job    job;
+        Group* pGroup;
+    };
+
+    void WorkerLoop();
+    void BackgroundLoop();
+    void Run(std::unique_lock<std::mutex>& lock);
+
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    std::deque<QueuedJob>   m_queue;
+    vector<std::thread>     m_workers;
+    std::condition_variable m_backgroundCondition;
+    std::deque<Job>         m_backgroundQueue;
+    std::thread             m_backgroundThread;
+    bool                    m_quit = false;
+};
+
@@ -2,91 +2,582 @@
 
 #include "pch.h"
 #include "renderer/renderer.h"
+#include "asset/mesh_cache.h"
+#include "asset/vertex_quantization.h"
+#include "asset/mesh_optimizer.h"
+#include "asset/meshlets.h"
+#include "asset/simplifier.h"
+#include "asset/gltf.h"
+#include "asset/tangents.h"
+#include "asset/texture_compression.h"
+#include "asset/texture_file.h"
+#include "asset/file_system.h"
+#include "job_system.h"
+#include "hash.h"
+#include "arena.h"
 
-Renderer::MeshCreateInfo LoadMesh(const string& path) {
-    Renderer::MeshCreateInfo meshCreateInfo;
+struct ModelLoadSettings {
+    bool compactVertices = false; // Renderer::VertexFormat_Compact
+    bool optimizeMeshes  = true;  // Welding and cache/overdraw/fetch reordering, see asset/mesh_optimizer.h
+    bool buildMeshlets   = false; // Cluster culling, see asset/meshlets.h
+    u32  lodNum          = 1;     // Levels of detail including the full mesh, see asset/simplifier.h
+    bool compressTextures = true; // BC1/BC5/BC7 with mips, see asset/texture_compression.h; prebaked by tools/bake.cpp
+    ImageFilter mipFilter = ImageFilter_Box; // For images without mips, see asset/image_kernels.h
+    bool stageUploads     = true; // Decode into mapped GPU transfer memory, see Renderer::CreateStagingBuffer(); needs the renderer
+};
 
+// Settings that change the baked geometry, the mesh cache is keyed on them
+enum BakeFlags {
+    BakeFlags_OptimizeMeshes = 1 << 0,
+    BakeFlags_BuildMeshlets  = 1 << 1,
+    BakeFlags_LodNumShift    = 8, // 8 bits of LOD count
+};
+
+u32 GetBakeFlags(const ModelLoadSettings& settings) {
+    u32 flags = 0;
+    if (settings.optimizeMeshes)
+        flags |= BakeFlags_OptimizeMeshes;
+    if (settings.buildMeshlets)
+        flags |= BakeFlags_BuildMeshlets;
+    flags |= (settings.lodNum & 0xFF) << BakeFlags_LodNumShift;
+    return flags;
+}
+
+// One reference from the node hierarchy to an aiMesh
+struct MeshInstance {
+    u32            meshIdx;
+    Renderer::Mat4 transform;
+    string         name;
+};
+
+Renderer::Mat4 ToMat4(const aiMatrix4x4& m) {
+    // Assimp matrices are row-major, glm's are column-major
+    return Renderer::Mat4(
+        m.a1, m.b1, m.c1, m.d1,
+        m.a2, m.b2, m.c2, m.d2,
+        m.a3, m.b3, m.c3, m.d3,
+        m.a4, m.b4, m.c4, m.d4
+    );
+}
+
+void CollectMeshInstances(const aiNode* pNode, const Renderer::Mat4& parentTransform, vector<MeshInstance>& instances) {
+    const Renderer::Mat4 transform = parentTransform * ToMat4(pNode->mTransformation);
+    for (u32 i = 0; i < pNode->mNumMeshes; i++) {
+        instances.push_back({
+            .meshIdx   = pNode->mMeshes[i],
+            .transform = transform,
+            .name      = string(pNode->mName.C_Str())
+        });
+    }
+    for (u32 i = 0; i < pNode->mNumChildren; i++)
+        CollectMeshInstances(pNode->mChildren[i], transform, instances);
+}
+
+void ConvertMesh(const aiMesh* pMesh, Renderer::MeshCreateInfo& meshCreateInfo) {
+    meshCreateInfo.vertices.resize(pMesh->mNumVertices);
+    meshCreateInfo.indices.resize(pMesh->mNumFaces * 3);
+
+    // Meshes without UVs have no tangents either; those attributes are left zeroed.
+    // Missing tangents are generated afterwards by GenerateTangents()
+    const bool hasTexCoords = pMesh->mTextureCoords[0] != nullptr;
+    const bool hasTangents  = pMesh->mTangents != nullptr;
+
+    for (i32 i = 0; i < pMesh->mNumVertices; i++) {
+        Renderer::Vertex& vertex = meshCreateInfo.vertices[i];
+        vertex.pos = glm::vec3(
+            pMesh->mVertices[i].x,
+            pMesh->mVertices[i].y,
+            pMesh->mVertices[i].z
+        );
+        vertex.normal = glm::vec3(
+            pMesh->mNormals[i].x,
+            pMesh->mNormals[i].y,
+            pMesh->mNormals[i].z
+        );
+        vertex.tangent = hasTangents ? glm::vec3(
+            pMesh->mTangents[i].x,
+            pMesh->mTangents[i].y,
+            pMesh->mTangents[i].z
+        ) : glm::vec3(0);
+        vertex.texCoord = hasTexCoords ? glm::vec2(
+            pMesh->mTextureCoords[0][i].x,
+            pMesh->mTextureCoords[0][i].y
+        ) : glm::vec2(0);
+    }
+
+    for (i32 i = 0; i < pMesh->mNumFaces; i++) {
+        SDL_assert(pMesh->mFaces[i].mNumIndices == 3);
+        meshCreateInfo.indices[i * 3 + 0] = pMesh->mFaces[i].mIndices[0];
+        meshCreateInfo.indices[i * 3 + 1] = pMesh->mFaces[i].mIndices[1];
+        meshCreateInfo.indices[i * 3 + 2] = pMesh->mFaces[i].mIndices[2];
+    }
+}
+
+// NOTE: the order must match the order of the MeshData texture type enum
+array<string, Renderer::TextureCount> GetMaterialTexturePaths(const aiMaterial* pMaterial) {
+    aiString aiDiffusePath;
+    pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &aiDiffusePath);
+    aiString aiNormalPath;
+    pMaterial->GetTexture(aiTextureType_NORMALS, 0, &aiNormalPath);
+    aiString aiArmPath;
+    pMaterial->GetTexture(aiTextureType_UNKNOWN, 0, &aiArmPath);
+
+    return {
+        aiDiffusePath.C_Str(),
+        aiNormalPath.C_Str(),
+        aiArmPath.C_Str(),
+    };
+}
+
+// Bakes optimized index order, LODs and meshlets; runs on the output of both importers
+void ProcessMeshes(vector<MeshAsset>& meshes, const ModelLoadSettings& settings) {
+    JobSystem::GetInstance().ParallelFor(meshes.size(), 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            if (settings.optimizeMeshes) {
+                const MeshOptimizationStats stats = OptimizeMesh(meshes[i].createInfo);
+                SDL_Log(
+                    "Optimized %s: %u -> %u vertices, ACMR %.3f -> %.3f",
+                    meshes[i].name.c_str(),
+                    stats.vertexNumBefore, stats.vertexNumAfter,
+                    stats.acmrBefore, stats.acmrAfter
+                );
+            }
+
+            if (settings.lodNum > 1)
+                BuildLods(meshes[i].createInfo, settings.lodNum);
+            if (settings.buildMeshlets)
+                BuildMeshlets(meshes[i].createInfo);
+        }
+    });
+}
+
+// Slow path: runs the full Assimp import; its output is baked into the mesh cache
+vector<MeshAsset> ImportModel(const string& path) {
     Assimp::Importer importer;
     const aiScene *pScene = importer.ReadFile(
         path,
         aiProcess_Triangulate |
-        aiProcess_CalcTangentSpace |
+        aiProcess_GenSmoothNormals |
         aiProcess_FlipUVs |
         aiProcess_OptimizeGraph
     );
 
     if (pScene == nullptr || pScene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !pScene->mRootNode)
-        FatalError("Could not load mesh: " + path);
+        FatalError("Could not load model: " + path);
 
-    SDL_assert(pScene->mNumMeshes == 1);
-    SDL_assert(pScene->mMeshes[0]->mTextureCoords[0] != nullptr);
+    SDL_assert(pScene->mNumMaterials >= 1);
+    SDL_Log("Number of meshes: %d", pScene->mNumMeshes);
+    SDL_Log("Number of materials: %d", pScene->mNumMaterials);
 
-    meshCreateInfo.vertices.resize(pScene->mMeshes[0]->mNumVertices);
-    meshCreateInfo.indices.resize(pScene->mMeshes[0]->mNumFaces * 3);
+    vector<MeshInstance> instances;
+    CollectMeshInstances(pScene->mRootNode, Renderer::Mat4(1), instances);
 
-    for (i32 i = 0; i < pScene->mMeshes[0]->mNumVertices; i++) {
-        meshCreateInfo.vertices[i].pos = glm::vec3(
-            pScene->mMeshes[0]->mVertices[i].x,
-            pScene->mMeshes[0]->mVertices[i].y,
-            pScene->mMeshes[0]->mVertices[i].z
-        );
-        meshCreateInfo.vertices[i].normal = glm::vec3(
-            pScene->mMeshes[0]->mNormals[i].x,
-            pScene->mMeshes[0]->mNormals[i].y,
-            pScene->mMeshes[0]->mNormals[i].z
-        );
-        meshCreateInfo.vertices[i].tangent = glm::vec3(
-            pScene->mMeshes[0]->mTangents[i].x,
-            pScene->mMeshes[0]->mTangents[i].y,
-            pScene->mMeshes[0]->mTangents[i].z
-        );
-        meshCreateInfo.vertices[i].texCoord = glm::vec2(
-            pScene->mMeshes[0]->mTextureCoords[0][i].x,
-            pScene->mMeshes[0]->mTextureCoords[0][i].y
-        );
+    // Node names are not unique in general, the renderer needs them to be
+    umap<string, u32> nameCounts;
+    for (MeshInstance& instance : instances) {
+        const string meshName = pScene->mMeshes[instance.meshIdx]->mName.C_Str();
+        instance.name += "/" + meshName;
+        const u32 count = nameCounts[instance.name]++;
+        if (count > 0)
+            instance.name += "#" + std::to_string(count);
     }
 
-    for (i32 i = 0; i < pScene->mMeshes[0]->mNumFaces; i++) {
-        SDL_assert(pScene->mMeshes[0]->mFaces[i].mNumIndices == 3);
-        meshCreateInfo.indices[i * 3 + 0] = pScene->mMeshes[0]->mFaces[i].mIndices[0];
-        meshCreateInfo.indices[i * 3 + 1] = pScene->mMeshes[0]->mFaces[i].mIndices[1];
-        meshCreateInfo.indices[i * 3 + 2] = pScene->mMeshes[0]->mFaces[i].mIndices[2];
+    // Every referenced aiMesh once, the nodes placing it become its instances
+    vector<MeshAsset> meshes;
+    vector<u32> assetIndices(pScene->mNumMeshes, UINT32_MAX);
+    vector<u32> meshIndices;
+    for (MeshInstance& instance : instances) {
+        u32& assetIdx = assetIndices[instance.meshIdx];
+        if (assetIdx == UINT32_MAX) {
+            assetIdx = meshes.size();
+            meshes.push_back({ .name = pScene->mMeshes[instance.meshIdx]->mName.C_Str() });
+            meshIndices.push_back(instance.meshIdx);
+        }
+        meshes[assetIdx].instances.push_back({ std::move(instance.name), instance.transform });
     }
 
-    SDL_assert(pScene->mNumMaterials >= 1);
-    SDL_Log("Number of materials: %d", pScene->mNumMaterials);
-    SDL_Log("Diffuse texture count: %d", pScene->mMaterials[0]->GetTextureCount(aiTextureType_DIFFUSE));
-    SDL_Log("Normals texture count: %d", pScene->mMaterials[0]->GetTextureCount(aiTextureType_NORMALS));
-    SDL_Log("ARM texture count: %d", pScene->mMaterials[0]->GetTextureCount(aiTextureType_UNKNOWN));
-    SDL_Log("");
+    JobSystem::GetInstance().ParallelFor(meshes.size(), 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            const aiMesh* pMesh = pScene->mMeshes[meshIndices[i]];
+            meshes[i].texturePaths = GetMaterialTexturePaths(pScene->mMaterials[pMesh->mMaterialIndex]);
+            ConvertMesh(pMesh, meshes[i].createInfo);
+            // Tangents shipped with the file are kept, see asset/tangents.h
+            if (pMesh->mTangents == nullptr && pMesh->mTextureCoords[0] != nullptr)
+                GenerateTangents(meshes[i].createInfo);
+        }
+    });
 
-    aiString aiDiffusePath;
-    pScene->mMaterials[0]->GetTexture(aiTextureType_DIFFUSE, 0, &aiDiffusePath);
-    SDL_Log("Diffuse path: %s", aiDiffusePath.C_Str());
-    aiString aiNormalPath;
-    pScene->mMaterials[0]->GetTexture(aiTextureType_NORMALS, 0, &aiNormalPath);
-    SDL_Log("Normal path: %s", aiNormalPath.C_Str());
-    aiString aiArmPath;
-    pScene->mMaterials[0]->GetTexture(aiTextureType_UNKNOWN, 0, &aiArmPath);
-    SDL_Log("ARM path: %s", aiArmPath.C_Str());
-
-    // NOTE: the order must match the order of the MeshData texture type enum
-    const array<string, 3> texturePaths = {
-        std::filesystem::path(path).parent_path().string() + "/" + aiDiffusePath.C_Str(),
-        std::filesystem::path(path).parent_path().string() + "/" + aiNormalPath.C_Str(),
-        std::filesystem::path(path).parent_path().string() + "/" + aiArmPath.C_Str(),
+    return meshes;
+}
+
+// Imports the source model and writes its mesh cache, the bake tool calls this ahead of time
+vector<MeshAsset> BakeModelGeometry(const string& path, const ModelLoadSettings& settings) {
+    // glTF is read directly from its mapped buffers, anything the native loader declines goes through Assimp
+    vector<MeshAsset> meshes;
+    const string extension = std::filesystem::path(path).extension().string();
+    const bool isGltf = extension == ".gltf" || extension == ".glb";
+    if (!isGltf || !LoadGltf(path, meshes))
+        meshes = ImportModel(path);
+    ProcessMeshes(meshes, settings);
+    if (!WriteMeshCache(path, GetBakeFlags(settings), meshes))
+        SDL_Log("Could not write mesh cache: %s", GetMeshCachePath(path).c_str());
+    return meshes;
+}
+
+// Moves imported geometry into mapped transfer memory, compact vertices are quantized straight into it.
+// The key is hashed first, over the full precision vertices; it matches the one stored in the mesh cache
+void StageGeometry(Renderer::MeshCreateInfo& createInfo, bool quantize) {
+    createInfo.geometryKey = Renderer::GetGeometryKey(createInfo);
+    if (quantize)
+        createInfo.geometryKey = HashCombine(createInfo.geometryKey, Renderer::VertexFormat_Compact);
+
+    const u32 vertexNum = createInfo.vertices.size();
+    const u32 indexNum  = createInfo.indices.size();
+    const u32 vertexDataSize = vertexNum * Renderer::GetVertexSize(quantize ? Renderer::VertexFormat_Compact : createInfo.vertexFormat);
+    shared<Renderer::UploadBuffer> pStaging = Renderer::CreateStagingBuffer(vertexDataSize + indexNum * sizeof(Renderer::Index));
+    u8* pData = pStaging->Map();
+    if (quantize)
+        QuantizeVertices(createInfo, (Renderer::CompactVertex*)pData);
+    else
+        SDL_memcpy(pData, createInfo.vertices.data(), vertexDataSize);
+    SDL_memcpy(pData + vertexDataSize, createInfo.indices.data(), indexNum * sizeof(Renderer::Index));
+
+    createInfo.pStaging        = pStaging;
+    createInfo.stagedVertexNum = vertexNum;
+    createInfo.stagedIndexNum  = indexNum;
+    createInfo.vertices        = {};
+    createInfo.indices         = {};
+}
+
+// One mesh per instance, the copies share the staged geometry and its key so the GPU holds it once
+void ExpandMeshInstances(vector<MeshAsset>& meshes) {
+    vector<MeshAsset> expanded;
+    for (MeshAsset& mesh : meshes) {
+        if (mesh.instances.empty()) {
+            expanded.push_back(std::move(mesh));
+            continue;
+        }
+        for (u32 i = 0; i < mesh.instances.size(); i++) {
+            MeshAsset& instance = expanded.emplace_back();
+            instance.name         = std::move(mesh.instances[i].name);
+            instance.texturePaths = mesh.texturePaths;
+            instance.createInfo   = i + 1 < mesh.instances.size() ? mesh.createInfo : std::move(mesh.createInfo);
+            instance.createInfo.transform = mesh.instances[i].transform;
+        }
+    }
+    meshes = std::move(expanded);
+}
+
+// pCacheFile is the mesh cache read ahead (see FileSystem::ReadFiles()), null when there is none
+vector<MeshAsset> LoadModelGeometry(const string& path, const ModelLoadSettings& settings, const FileBuffer* pCacheFile) {
+    // Cached full precision vertices are decoded straight into transfer memory, the rest is staged below
+    vector<MeshAsset> meshes;
+    const bool stageFromCache = settings.stageUploads && !settings.compactVertices;
+    if (pCacheFile == nullptr || !ReadMeshCache(path, *pCacheFile, GetBakeFlags(settings), meshes, stageFromCache))
+        meshes = BakeModelGeometry(path, settings);
+
+    // Geometry keys are hashed here so that the render thread does not have to
+    JobSystem::GetInstance().ParallelFor(meshes.size(), 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            Renderer::MeshCreateInfo& createInfo = meshes[i].createInfo;
+            if (createInfo.pStaging != nullptr)
+                continue;
+            if (settings.stageUploads) {
+                StageGeometry(createInfo, settings.compactVertices);
+                continue;
+            }
+            if (settings.compactVertices)
+                QuantizeVertices(createInfo);
+            createInfo.geometryKey = Renderer::GetGeometryKey(createInfo);
+        }
+    });
+
+    ExpandMeshInstances(meshes);
+    return meshes;
+}
+
+vector<MeshAsset> LoadModelGeometry(const string& path, const ModelLoadSettings& settings) {
+    FileBuffer cacheFile;
+    const bool read = FileSystem::GetInstance().ReadFile(GetMeshCachePath(path), cacheFile);
+    return LoadModelGeometry(path, settings, read ? &cacheFile : nullptr);
+}
+
+// Compressed images written by the bake tool next to their source
+string GetBakedTexturePath(const string& path) {
+    return path + ".baked.ktx2";
+}
+
+// Loose baked files older than their source are stale; packed ones are trusted like mesh caches
+bool HasBakedTexture(const string& path) {
+    const string bakedPath = GetBakedTexturePath(path);
+    if (!FileSystem::GetInstance().Exists(bakedPath))
+        return false;
+
+    std::error_code sourceError, bakedError;
+    const auto sourceTime = std::filesystem::last_write_time(path, sourceError);
+    const auto bakedTime  = std::filesystem::last_write_time(bakedPath, bakedError);
+    return sourceError || bakedError || bakedTime >= sourceTime;
+}
+
+// bakedFile holds GetBakedTexturePath(path), copies in another format are rejected
+bool LoadBakedTexture(const string& path, const FileBuffer& bakedFile, Renderer::TexIdx texIdx, Renderer::TextureData& texture) {
+    if (!LoadKtx2(GetBakedTexturePath(path), bakedFile, texture))
+        return false;
+    if (texture.format != GetCompressedFormat(texIdx)) {
+        ScopedFree(texture.pPixels);
+        texture = {};
+        return false;
+    }
+    return true;
+}
+
+bool LoadBakedTexture(const string& path, Renderer::TexIdx texIdx, Renderer::TextureData& texture) {
+    FileBuffer bakedFile;
+    if (!HasBakedTexture(path) || !FileSystem::GetInstance().ReadFile(GetBakedTexturePath(path), bakedFile))
+        return false;
+    return LoadBakedTexture(path, bakedFile, texIdx, texture);
+}
+
+// The file DecodeTexture() reads for an image: its baked copy when there is a usable one
+string GetTextureFilePath(const string& path, const ModelLoadSettings& settings) {
+    if (settings.compressTextures && !IsTextureContainer(path) && HasBakedTexture(path))
+        return GetBakedTexturePath(path);
+    return path;
+}
+
+// RGBA8 pixels from stb_image, allocated with ScopedAlloc() like everything stb allocates.
+// False when the file is not an image stb can decode
+bool DecodeImage(const FileBuffer& file, Renderer::TextureData& image) {
+    int width, height, channelNum;
+    u8* pPixels = stbi_load_from_memory(file.GetData(), file.GetSize(), &width, &height, &channelNum, 4);
+    if (pPixels == nullptr)
+        return false;
+    image = {
+        .pPixels = pPixels,
+        .width   = (u32)width,
+        .height  = (u32)height
     };
+    return true;
+}
+
+bool DecodeImage(const string& path, Renderer::TextureData& image) {
+    FileBuffer file;
+    return FileSystem::GetInstance().ReadFile(path, file) && DecodeImage(file, image);
+}
 
-    for (i32 i = 0; i < texturePaths.size(); i++) {
-        int width, height, channelNum;
-        u8* pPixels = stbi_load(texturePaths[i].c_str(), &width, &height, &channelNum, 4);
-        SDL_assert(pPixels != nullptr);
-        meshCreateInfo.texturesData[i].width   = width;
-        meshCreateInfo.texturesData[i].height  = height;
-        meshCreateInfo.texturesData[i].pPixels = pPixels;
+// Compresses an image with its mip chain into GetBakedTexturePath(path); false when the source
+// cannot be read or decoded
+bool BakeTexture(const string& path, Renderer::TexIdx texIdx, ImageFilter mipFilter = ImageFilter_Box) {
+    // Both the image and the compressed copy are temporaries here
+    ScratchScope scratch;
+    Renderer::TextureData rgba;
+    if (!DecodeImage(path, rgba))
+        return false;
+    const Renderer::TextureData compressed = CompressTexture(rgba, texIdx, mipFilter);
+    return WriteKtx2(GetBakedTexturePath(path), compressed);
+}
+
+// file holds filePath = GetTextureFilePath(path, settings). The pixels belong to the arena, or with
+// settings.stageUploads to the mapped transfer buffer they are uploaded from. texIdx picks the
+// compressed format, only used with settings.compressTextures. Files that fail to decode give
+// empty data (null pixels), their slots keep the renderer's placeholder
+Renderer::TextureData DecodeTexture(
+    const string& path,
+    const string& filePath,
+    const FileBuffer& file,
+    Renderer::TexIdx texIdx,
+    const ModelLoadSettings& settings,
+    Arena& arena
+) {
+    // The final pixels are a single ScopedAlloc() in the output arena; staged, that allocation is a
+    // transfer buffer of its own and every branch below decodes, compresses or copies straight into it
+    vector<shared<Renderer::UploadBuffer>> stagingBuffers;
+    Arena stagingArena([&](u64 size) -> void* {
+        stagingBuffers.push_back(Renderer::CreateStagingBuffer((u32)size));
+        return stagingBuffers.back()->Map();
+    });
+    Arena& outputArena = settings.stageUploads ? stagingArena : arena;
+
+    ArenaScope scope(outputArena);
+    Renderer::TextureData texture;
+    if (IsTextureContainer(path)) {
+        // KTX2 and DDS already hold GPU formats and mip chains
+        if (!LoadTextureContainer(path, file, texture)) {
+            SDL_Log("Could not load texture: %s", path.c_str());
+            return {};
+        }
+    }
+    else if (!settings.compressTextures) {
+        // Uncompressed images get their mip chain too, built from the RGBA image in scratch
+        ScratchScope scratch;
+        Renderer::TextureData rgba;
+        if (!DecodeImage(file, rgba)) {
+            SDL_Log("Could not decode texture: %s", path.c_str());
+            return {};
+        }
+        ArenaScope output(outputArena);
+        texture = GenerateMips(rgba, settings.mipFilter, GetImageFlags(texIdx));
+    }
+    else if (filePath == path || !LoadBakedTexture(path, file, texIdx, texture)) {
+        // A baked copy in another format sends us back to the source
+        FileBuffer sourceFile;
+        if (filePath != path && !FileSystem::GetInstance().ReadFile(path, sourceFile)) {
+            SDL_Log("Could not read texture: %s", path.c_str());
+            return {};
+        }
+
+        // The RGBA image and stb's temporaries only live in the thread's scratch arena
+        ScratchScope scratch;
+        Renderer::TextureData rgba;
+        if (!DecodeImage(filePath == path ? file : sourceFile, rgba)) {
+            SDL_Log("Could not decode texture: %s", path.c_str());
+            return {};
+        }
+        ArenaScope output(outputArena);
+        texture = CompressTexture(rgba, texIdx, settings.mipFilter);
     }
 
-    return meshCreateInfo;
+    // The same file decoded to the same format is shared on the GPU without hashing the pixels. Without
+    // a file key the source bytes are hashed; staged pixels sit in write-combined memory, never read them
+    u64 fileKey = FileSystem::GetInstance().GetFileKey(path);
+    if (fileKey == 0)
+        fileKey = HashBytes(file.GetData(), file.GetSize());
+    texture.key = HashCombine(fileKey, texture.format);
+
+    for (const shared<Renderer::UploadBuffer>& pStaging : stagingBuffers) {
+        if (pStaging->Map() == texture.pPixels)
+            texture.pStaging = pStaging;
+    }
+    return texture;
 }
 
+// Decodes every distinct image referenced by the given models at the same time
+void DecodeModelTextures(const vector<string>& paths, vector<vector<MeshAsset>>& models, const ModelLoadSettings& settings, Arena& arena) {
+    // Materials are usually shared between many meshes, each image is decoded once
+    umap<string, u32> textureIndices;
+    vector<string> texturePaths;
+    vector<Renderer::TexIdx> textureSlots; // Slot of the first use, decides the compressed format
+    for (i32 modelIdx = 0; modelIdx < models.size(); modelIdx++) {
+        const string directory = std::filesystem::path(paths[modelIdx]).parent_path().string();
+        for (const MeshAsset& mesh : models[modelIdx]) {
+            for (i32 i = 0; i < mesh.texturePaths.size(); i++) {
+                // Materials without the map leave the slot to the renderer's placeholder
+                if (mesh.texturePaths[i].empty())
+                    continue;
+                const string texturePath = directory + "/" + mesh.texturePaths[i];
+                if (textureIndices.try_emplace(texturePath, texturePaths.size()).second) {
+                    texturePaths.push_back(texturePath);
+                    textureSlots.push_back((Renderer::TexIdx)i);
+                }
+            }
+        }
+    }
+
+    // Each image is decoded as soon as its file is in memory while the rest are still being read
+    vector<string> filePaths(texturePaths.size());
+    for (u32 i = 0; i < texturePaths.size(); i++)
+        filePaths[i] = GetTextureFilePath(texturePaths[i], settings);
+    vector<Renderer::TextureData> textures(texturePaths.size());
+    FileSystem::GetInstance().ReadFiles(filePaths, [&](u32 i, const FileBuffer& file, bool read) {
+        if (!read) {
+            SDL_Log("Could not read texture: %s", filePaths[i].c_str());
+            return;
+        }
+        textures[i] = DecodeTexture(texturePaths[i], filePaths[i], file, textureSlots[i], settings, arena);
+    });
+
+    for (i32 modelIdx = 0; modelIdx < models.size(); modelIdx++) {
+        const string directory = std::filesystem::path(paths[modelIdx]).parent_path().string();
+        for (MeshAsset& mesh : models[modelIdx]) {
+            for (i32 i = 0; i < mesh.texturePaths.size(); i++) {
+                if (!mesh.texturePaths[i].empty())
+                    mesh.createInfo.texturesData[i] = textures[textureIndices[directory + "/" + mesh.texturePaths[i]]];
+            }
+        }
+    }
+}
+
+// Loads a batch of models; geometry and images of all models are processed in parallel.
+// Decoded pixels are owned by the arena unless staged, reset it once the meshes are created
+vector<vector<MeshAsset>> LoadModels(const vector<string>& paths, Arena& arena, const ModelLoadSettings& settings = {}) {
+    // Mesh caches are read together, models without one are imported
+    vector<vector<MeshAsset>> models(paths.size());
+    vector<string> cachePaths(paths.size());
+    std::transform(paths.begin(), paths.end(), cachePaths.begin(), GetMeshCachePath);
+    FileSystem::GetInstance().ReadFiles(cachePaths, [&](u32 i, const FileBuffer& file, bool read) {
+        models[i] = LoadModelGeometry(paths[i], settings, read ? &file : nullptr);
+    });
+
+    DecodeModelTextures(paths, models, settings, arena);
+    return models;
+}
+
+vector<MeshAsset> LoadModel(const string& path, Arena& arena, const ModelLoadSettings& settings = {}) {
+    return std::move(LoadModels({ path }, arena, settings)[0]);
+}
+
+// Streams a model on the background thread while rendering continues: meshes are queued to the
+// renderer as soon as the geometry is ready and draw with placeholder textures until each image is
+// decoded. Meshes are named namePrefix + MeshAsset::name. The callback runs on the render thread
+// once the whole model is uploaded
+void LoadModelAsync(
+    const string& path,
+    const string& namePrefix,
+    const ModelLoadSettings& settings = {},
+    Renderer::UploadCallback callback = nullptr
+) {
+    JobSystem::GetInstance().SubmitBackground([=]() {
+        Renderer& renderer = Renderer::GetInstance();
+        vector<MeshAsset> meshes = LoadModelGeometry(path, settings);
+        // Owns every decoded image of the model until the last upload has copied it
+        shared<Arena> pArena = std::make_shared<Arena>();
+
+        // Images are shared between meshes, each one is decoded once and uploaded to all of its users
+        struct TextureUser {
+            string           meshName;
+            Renderer::TexIdx  texIdx;
+        };
+        const string directory = std::filesystem::path(path).parent_path().string();
+        umap<string, u32> textureIndices;
+        vector<string> texturePaths;
+        vector<vector<TextureUser>> textureUsers;
+        for (MeshAsset& mesh : meshes) {
+            const string meshName = namePrefix + mesh.name;
+            for (i32 i = 0; i < mesh.texturePaths.size(); i++) {
+                // Slots without a map keep their placeholder for good
+                if (mesh.texturePaths[i].empty())
+                    continue;
+                const string texturePath = directory + "/" + mesh.texturePaths[i];
+                auto [it, inserted] = textureIndices.try_emplace(texturePath, texturePaths.size());
+                if (inserted) {
+                    texturePaths.push_back(texturePath);
+                    textureUsers.emplace_back();
+                }
+                textureUsers[it->second].push_back({ meshName, (Renderer::TexIdx)i });
+            }
+            renderer.QueueMeshCreation(std::move(mesh.createInfo), meshName);
+        }
+
+        vector<string> filePaths(texturePaths.size());
+        for (u32 i = 0; i < texturePaths.size(); i++)
+            filePaths[i] = GetTextureFilePath(texturePaths[i], settings);
+        FileSystem::GetInstance().ReadFiles(filePaths, [&](u32 i, const FileBuffer& file, bool read) {
+            if (!read) {
+                SDL_Log("Could not read texture: %s", filePaths[i].c_str());
+                return;
+            }
+            const Renderer::TextureData texture = DecodeTexture(texturePaths[i], filePaths[i], file, textureUsers[i][0].texIdx, settings, *pArena);
+            if (texture.pPixels == nullptr)
+                return;
+            for (const TextureUser& user : textureUsers[i])
+                renderer.QueueTextureUpload(user.meshName, user.texIdx, texture);
+        });
+
+        // Runs after every upload above, the arena is released with the closure
+        renderer.QueueCallback([pArena, callback]() {
+            if (callback)
+                callback();
+        });
+    });
+}
 
@@ -1,6 +1,12 @@
 #include "pch.h"
+#include "arena.h"
+// Decoded images belong to the arena bound by the loader, see arena.h
+#define STBI_MALLOC(size)                       ScopedAlloc(size)
+#define STBI_REALLOC_SIZED(p, oldSize, newSize) ScopedRealloc(p, oldSize, newSize)
+#define STBI_FREE(p)                            ScopedFree(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
+#include "asset/file_system.h"
 
 void Error(const string& message) {
     SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Fatal error", message.c_str(), nullptr);
@@ -11,11 +17,27 @@ void FatalError(const string& message) {
     SDL_Quit();
 }
 
+// Goes through the virtual file system, mounted archives are searched first
 string ReadFile(const string& path) {
-    size_t size;
-    char* pData = (char*)SDL_LoadFile(path.c_str(), &size);
-    if (pData == nullptr)
+    FileBuffer buffer;
+    if (!FileSystem::GetInstance().ReadFile(path, buffer))
         FatalError("Could not read file: " + path);
-    return std::string(pData, size);
+    return std::string((const char*)buffer.GetData(), buffer.GetSize());
 }
 
+
+vector<string> ReadFiles(const vector<string>& paths) {
+    vector<string> files(paths.size());
+    vector<u8> read(paths.size(), false);
+    FileSystem::GetInstance().ReadFiles(paths, [&](u32 fileIdx, const FileBuffer& buffer, bool fileRead) {
+        read[fileIdx] = fileRead;
+        if (fileRead)
+            files[fileIdx].assign((const char*)buffer.GetData(), buffer.GetSize());
+    });
+    // Reported on the calling thread, the callback runs on the job system
+    for (u32 i = 0; i < paths.size(); i++) {
+        if (!read[i])
+            FatalError("Could not read file: " + paths[i]);
+    }
+    return files;
+}
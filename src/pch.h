@@ -62,3 +62,4 @@ private:
 };
 
 string ReadFile(const string& path);
+vector<string> ReadFiles(const vector<string>& paths); // One asynchronous batch, see FileSystem::ReadFiles()
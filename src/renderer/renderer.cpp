@@ -1,6 +1,7 @@
 #include "renderer.h"
 
 #include "../pch.h"
+#include "../hash.h"
 
 Renderer& Renderer::GetInstance() {
     static Renderer instance;
@@ -18,23 +19,48 @@ void Renderer::Initialize(SDL_Window* pWindow, u32 width, u32 height) {
     if (SDL_ClaimWindowForGPUDevice(GetDevice(), GetWindow()) == false)
         FatalError("Could not claim window for GPU device");
 
+    SDL_SetGPUAllowedFramesInFlight(GetDevice(), m_framesInFlight);
+    GetStagingRing().Initialize(STAGING_RING_SIZE);
+    for (i32 format = 0; format < VertexFormatCount; format++)
+        m_vertexPools[format].Initialize(SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ, GetVertexSize((VertexFormat)format), VERTEX_POOL_SIZE);
+    m_indexPool.Initialize(SDL_GPU_BUFFERUSAGE_INDEX, sizeof(Index), INDEX_POOL_SIZE);
+
     SamplerCreateInfo samplerCreateInfo;
     m_sampler.Initialize(samplerCreateInfo);
 
-    const GfxPipelineCreateInfo pipelineCreateInfo = {
+    // All stages are read at once
+    const vector<string> shaderSources = ReadFiles({
+        "C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/shaders_compiled/basic.vert.spv",
+        "C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/shaders_compiled/basic.frag.spv",
+        "C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/shaders_compiled/basic_compact.vert.spv",
+        "C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/shaders_compiled/basic_array.frag.spv"
+    });
+
+    GfxPipelineCreateInfo pipelineCreateInfo = {
         .vertShaderCreateInfo = {
             .stage  = SDL_GPU_SHADERSTAGE_VERTEX,
-            .source = ReadFile("C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/shaders_compiled/basic.vert.spv"),
-            .numUniformBuffers = 3
+            .source = shaderSources[0],
+            .numStorageBuffers = 2,
+            .numUniformBuffers = 2
         },
         .fragShaderCreateInfo = {
             .stage  = SDL_GPU_SHADERSTAGE_FRAGMENT,
-            .source = ReadFile("C:/Users/Bogdan/Documents/C_Projects/PbrRenderer/shaders_compiled/basic.frag.spv"),
+            .source = shaderSources[1],
             .numSamplers       = 3,
             .numStorageBuffers = 1
         }
     };
-    m_pipeline.Initialize(pipelineCreateInfo);
+    m_pipelines[VertexFormat_Full].Initialize(pipelineCreateInfo);
+
+    // Same fragment stage, the compact vertex shader decodes into the same varyings
+    pipelineCreateInfo.vertShaderCreateInfo.source = shaderSources[2];
+    m_pipelines[VertexFormat_Compact].Initialize(pipelineCreateInfo);
+
+    // Batched materials sample texture arrays at the layers of the draw
+    pipelineCreateInfo.fragShaderCreateInfo.source = shaderSources[3];
+    m_arrayPipelines[VertexFormat_Compact].Initialize(pipelineCreateInfo);
+    pipelineCreateInfo.vertShaderCreateInfo.source = shaderSources[0];
+    m_arrayPipelines[VertexFormat_Full].Initialize(pipelineCreateInfo);
 
     UpdateProjection(width, height);
 
@@ -47,16 +73,36 @@ void Renderer::Initialize(SDL_Window* pWindow, u32 width, u32 height) {
         depthTextureCreateInfo.data.height = height;
         m_depthTexture.Initialize(depthTextureCreateInfo);
 
-        // Storage buffer for vertex shader frame data
-        m_fragmentShaderFrameDataBuffer.Initialize(
-            pCmdBuf,
-            SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ,
-            sizeof(FragmentShaderFrameData)
-        );
+        // Storage buffers for fragment shader frame data
+        for (FrameResources& frame : m_frames) {
+            frame.fragmentShaderFrameDataBuffer.Initialize(
+                SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ,
+                sizeof(FragmentShaderFrameData)
+            );
+        }
+
+        // Placeholders: grey albedo, flat normal, no occlusion with rough dielectric. Array
+        // materials get them as array layers, the array pipeline never samples a plain 2D texture
+        // NOTE: the order must match the order of the MeshData texture type enum
+        static constexpr array<u32, TextureCount> placeholderPixels = { 0xFF808080, 0xFFFF8080, 0xFF00FFFF };
+        for (i32 i = 0; i < TextureCount; i++) {
+            TextureCreateInfo placeholderCreateInfo;
+            placeholderCreateInfo.data = {
+                .pPixels = (void*)&placeholderPixels[i],
+                .width   = 1,
+                .height  = 1
+            };
+            m_placeholderTextures[i].Initialize(placeholderCreateInfo);
+            m_placeholderTextures[i].Upload(placeholderCreateInfo.data);
+            InitializeArrayLayer(m_placeholderLayers[i], placeholderCreateInfo.data);
+            m_placeholderLayers[i].Upload(placeholderCreateInfo.data);
+        }
     });
 }
 
 Renderer::~Renderer() {
+    GetSubmissionTracker().Release();
+    GetStagingRing().Release();
     SDL_ReleaseWindowFromGPUDevice(GetDevice(), GetWindow());
     SDL_DestroyGPUDevice(GetDevice());
 }
@@ -84,6 +130,11 @@ void Renderer::HandleResize(u32 newWidth, u32 newHeight) {
 }
 
 void Renderer::RenderFrame() {
+    // The frame's buffers are free once the GPU finished the frame that used them last
+    m_frameIdx = (m_frameIdx + 1) % m_framesInFlight;
+    FrameResources& frame = m_frames[m_frameIdx];
+    GetSubmissionTracker().Wait(frame.submission);
+
     SDL_GPUCommandBuffer* pCmdBuf = SDL_AcquireGPUCommandBuffer(GetDevice());
 
     // ImGui
@@ -91,8 +142,12 @@ void Renderer::RenderFrame() {
     if (pDrawData != nullptr)
         ImGui_ImplSDLGPU3_PrepareDrawData(pDrawData, pCmdBuf);
 
-    // Copy pass for updating fragment shader frame data
-    UpdateFragmentShaderFrameData(pCmdBuf);
+    // Streamed meshes and textures, fragment shader frame data and draws; one copy pass for all
+    RecordPendingUploads();
+    UpdateFragmentShaderFrameData();
+    UpdateFrustumPlanes();
+    PrepareDraws();
+    GetUploadScheduler().Flush(pCmdBuf, true);
 
     // Get swapchain texture
     SDL_GPUTexture* pSwapchainTexture;
@@ -101,7 +156,8 @@ void Renderer::RenderFrame() {
         FatalError("Could not acquire GPUSwapchain Texture");
     // Return early if window is minimized
     if (pSwapchainTexture == nullptr) {
-        SDL_SubmitGPUCommandBuffer(pCmdBuf);
+        frame.submission = SubmitCommandBuffer(pCmdBuf);
+        GetUploadScheduler().RunFinalizers();
         return;
     }
     
@@ -123,29 +179,36 @@ void Renderer::RenderFrame() {
     depthStencilTargetInfo.stencil_store_op = SDL_GPU_STOREOP_STORE;
     SDL_GPURenderPass* pRenderPass = SDL_BeginGPURenderPass(pCmdBuf, &colorTargetInfo, 1, &depthStencilTargetInfo);
 
-    // Bind pipeline
-    SDL_BindGPUGraphicsPipeline(pRenderPass, m_pipeline.GetHandle());
-
-    // Vertex shader frame data
-    constexpr u32 projSlotIdx = 0;
-    constexpr u32 viewSlotIdx = 2;
-    SDL_PushGPUVertexUniformData(pCmdBuf, viewSlotIdx, &m_view, sizeof(Mat4));
-    // Bind other stuff (temporary; TODO: only do these when the information is updated)
-    SDL_PushGPUVertexUniformData(pCmdBuf, projSlotIdx, &m_proj, sizeof(Mat4));
-
-    // Fragment shader frame data
-    PushFragmentShaderFrameData(pRenderPass);
+    // One indirect draw per batch, the pipeline changes with the vertex format and material kind
+    for (u32 i = 0; i < m_drawBatches.size(); i++) {
+        const DrawBatch& batch = m_drawBatches[i];
+        if (i == 0 || batch.key.vertexFormat != m_drawBatches[i - 1].key.vertexFormat || batch.key.arrayMaterial != m_drawBatches[i - 1].key.arrayMaterial)
+            BindPipeline(pRenderPass, pCmdBuf, batch.key);
+
+        array<SDL_GPUTextureSamplerBinding, TextureCount> samplerBindings;
+        for (i32 texIdx = 0; texIdx < TextureCount; texIdx++) {
+            samplerBindings[texIdx] = {
+                .texture = batch.key.textures[texIdx],
+                .sampler = m_sampler.GetHandle()
+            };
+        }
+        SDL_BindGPUFragmentSamplers(pRenderPass, 0, samplerBindings.data(), samplerBindings.size());
 
-    // Draw meshes
-    for (auto& it : m_meshes)
-        DrawMesh(it.second, pRenderPass, pCmdBuf);
+        SDL_DrawGPUIndexedPrimitivesIndirect(
+            pRenderPass,
+            frame.pDrawCommandBuffer->GetHandle(),
+            batch.firstCommand * sizeof(SDL_GPUIndexedIndirectDrawCommand),
+            batch.commandNum
+        );
+    }
 
     if (pDrawData != nullptr)
         ImGui_ImplSDLGPU3_RenderDrawData(pDrawData, pCmdBuf, pRenderPass);
 
     SDL_EndGPURenderPass(pRenderPass);
 
-    SDL_SubmitGPUCommandBuffer(pCmdBuf);
+    frame.submission = SubmitCommandBuffer(pCmdBuf);
+    GetUploadScheduler().RunFinalizers();
 }
 
 void Renderer::SetViewMatrix(const Mat4& viewMat) {
@@ -157,49 +220,67 @@ bool Renderer::CreateMesh(const MeshCreateInfo& createInfo, const string& meshNa
         return false;
 
     Mesh& mesh = m_meshes[meshName] = Mesh();
-
     ImmediateCmdBuf([&](SDL_GPUCommandBuffer* pCmdBuf) {
-        // Vertex buffer
-        mesh.vertexBuffer.Initialize(
-            pCmdBuf,
-            SDL_GPU_BUFFERUSAGE_VERTEX,
-            createInfo.vertices.size() * sizeof(Vertex)
-        );
-        mesh.vertexBuffer.Upload(
-            pCmdBuf,
-            createInfo.vertices.data(),
-            createInfo.vertices.size() * sizeof(Vertex)
-        );
+        InitializeMesh(mesh, createInfo);
+    });
 
-        // Index buffer
-        mesh.indexBuffer.Initialize(
-            pCmdBuf,
-            SDL_GPU_BUFFERUSAGE_INDEX,
-            createInfo.indices.size() * sizeof(Index)
-        );
-        mesh.indexBuffer.Upload(
-            pCmdBuf,
-            createInfo.indices.data(),
-            createInfo.indices.size() * sizeof(Index)
-        );
-        mesh.indicesNum = createInfo.indices.size();
+    return true;
+}
 
-        // Textures
-        for (i32 i = 0; i < TextureCount; i++) {
-            TextureCreateInfo textureCreateInfo;
-            textureCreateInfo.data = createInfo.texturesData[i];
-            mesh.textures[i].Initialize(textureCreateInfo);
-            mesh.textures[i].Upload(pCmdBuf, textureCreateInfo.data);
-        }
+void Renderer::QueueMeshCreation(MeshCreateInfo&& createInfo, const string& meshName) {
+    // std::function needs a copyable closure
+    shared<MeshCreateInfo> pCreateInfo = std::make_shared<MeshCreateInfo>(std::move(createInfo));
+    std::lock_guard lock(m_uploadMutex);
+    m_pendingUploads.push_back([this, pCreateInfo, meshName]() {
+        // Drawn once its copies are recorded, which read from the create info until then
+        shared<Mesh> pMesh = std::make_shared<Mesh>();
+        InitializeMesh(*pMesh, *pCreateInfo);
+        GetUploadScheduler().AddFinalizer([this, pMesh, pCreateInfo, meshName]() {
+            // Logged rather than reported, a message box would stall the render loop
+            if (m_meshes.contains(meshName)) {
+                SDL_Log("Mesh already exists, dropped: %s", meshName.c_str());
+                return;
+            }
+            m_meshes[meshName] = std::move(*pMesh);
+        });
     });
+}
 
-    return true;
+void Renderer::QueueTextureUpload(const string& meshName, TexIdx texIdx, const TextureData& data) {
+    std::lock_guard lock(m_uploadMutex);
+    m_pendingUploads.push_back([this, meshName, texIdx, data]() {
+        shared<Texture> pTexture = AcquireTexture(data);
+        // Bound once its copies are recorded; the mesh may have been deleted in the meantime
+        GetUploadScheduler().AddFinalizer([this, meshName, texIdx, data, pTexture]() {
+            auto it = m_meshes.find(meshName);
+            if (it != m_meshes.end())
+                it->second.textures[texIdx] = pTexture;
+        });
+    });
+}
+
+void Renderer::QueueCallback(UploadCallback callback) {
+    std::lock_guard lock(m_uploadMutex);
+    m_pendingUploads.push_back([callback = std::move(callback)]() {
+        GetUploadScheduler().AddFinalizer(callback);
+    });
+}
+
+void Renderer::SetUploadBudget(u32 bytesPerFrame) {
+    GetUploadScheduler().SetBudget(bytesPerFrame);
 }
 
 bool Renderer::DeleteMesh(const string& meshName) {
     if (!m_meshes.contains(meshName))
         return false;
     m_meshes.erase(meshName);
+    // Resources of the mesh are freed with their last user, forget those
+    m_textureRegistry.Prune();
+    m_geometryRegistry.Prune();
+    ReleaseEmptyArrayPages();
+    for (BufferPool& vertexPool : m_vertexPools)
+        vertexPool.Defragment();
+    m_indexPool.Defragment();
     return true;
 }
 
@@ -222,6 +303,30 @@ void Renderer::ClearPointLights() {
     m_fragmentShaderFrameData.pointLightNum = 0;
 }
 
+void Renderer::SetClusterCulling(bool enabled) {
+    m_clusterCulling = enabled;
+}
+
+void Renderer::SetConeCulling(bool enabled) {
+    m_coneCulling = enabled;
+}
+
+void Renderer::SetLodThreshold(float pixels) {
+    m_lodThreshold = pixels;
+}
+
+void Renderer::SetMaterialBatching(bool enabled) {
+    m_materialBatching = enabled;
+}
+
+void Renderer::SetFramesInFlight(u32 frameNum) {
+    SDL_assert(frameNum >= 2 && frameNum <= MAX_FRAMES_IN_FLIGHT);
+    if (SDL_SetGPUAllowedFramesInFlight(GetDevice(), frameNum) == false)
+        Error(string("Could not set frames in flight: ") + SDL_GetError());
+    m_framesInFlight = frameNum;
+    m_frameIdx       = 0;
+}
+
 void Renderer::Shader::Initialize(const ShaderCreateInfo& createInfo) {
     SDL_GPUShaderCreateInfo vertShaderCreateInfo = {
         .code_size            = createInfo.source.size(),
@@ -265,11 +370,6 @@ void Renderer::GfxPipeline::Initialize(const GfxPipelineCreateInfo& createInfo)
     colorTargetDesc.blend_state.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA;
     colorTargetDesc.blend_state.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
 
-    SDL_GPUVertexBufferDescription vertBufferDesc = {};
-    vertBufferDesc.slot = 0;
-    vertBufferDesc.pitch = sizeof(Vertex);
-    vertBufferDesc.input_rate = SDL_GPU_VERTEXINPUTRATE_VERTEX;
-
     SDL_GPUGraphicsPipelineCreateInfo pipelineCreateInfo = {};
 
     pipelineCreateInfo.target_info.num_color_targets         = 1;
@@ -277,11 +377,7 @@ void Renderer::GfxPipeline::Initialize(const GfxPipelineCreateInfo& createInfo)
     pipelineCreateInfo.target_info.has_depth_stencil_target  = true;
     pipelineCreateInfo.target_info.depth_stencil_format      = SDL_GPU_TEXTUREFORMAT_D16_UNORM;
 
-    pipelineCreateInfo.vertex_input_state.num_vertex_buffers         = 1;
-    pipelineCreateInfo.vertex_input_state.vertex_buffer_descriptions = &vertBufferDesc;
-    pipelineCreateInfo.vertex_input_state.num_vertex_attributes      = s_vertexAttribs.size();
-    pipelineCreateInfo.vertex_input_state.vertex_attributes          = s_vertexAttribs.data();
-
+    // No vertex input, the vertex shaders pull from storage buffers
     pipelineCreateInfo.primitive_type  = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST;
     pipelineCreateInfo.vertex_shader   = vertShader.GetHandle();
     pipelineCreateInfo.fragment_shader = fragShader.GetHandle();
@@ -318,6 +414,7 @@ void Renderer::UploadBuffer::Initialize(u32 byteSize) {
         FatalError("Could not create transfer buffer");
 }
 Renderer::UploadBuffer::~UploadBuffer() {
+    Unmap();
     SDL_ReleaseGPUTransferBuffer(GetDevice(), m_pHandle);
 }
 SDL_GPUTransferBuffer* Renderer::UploadBuffer::GetHandle() const {
@@ -332,8 +429,29 @@ void Renderer::UploadBuffer::SetData(const void* pData, u32 byteSize) {
     SDL_memcpy(pMappedMemory, pData, byteSize);
     SDL_UnmapGPUTransferBuffer(GetDevice(), m_pHandle);
 }
+u8* Renderer::UploadBuffer::Map() {
+    if (m_pMapped == nullptr) {
+        m_pMapped = (u8*)SDL_MapGPUTransferBuffer(GetDevice(), m_pHandle, false);
+        if (m_pMapped == nullptr)
+            FatalError("Could not map transfer buffer");
+    }
+    return m_pMapped;
+}
+// Copy passes only read unmapped transfer buffers
+void Renderer::UploadBuffer::Unmap() {
+    if (m_pMapped != nullptr)
+        SDL_UnmapGPUTransferBuffer(GetDevice(), m_pHandle);
+    m_pMapped = nullptr;
+}
 
-void Renderer::Buffer::Initialize(SDL_GPUCommandBuffer* pCmdBuf, SDL_GPUBufferUsageFlags usage, u32 byteSize) {
+shared<Renderer::UploadBuffer> Renderer::CreateStagingBuffer(u32 byteSize) {
+    shared<UploadBuffer> pUploadBuf = std::make_shared<UploadBuffer>();
+    pUploadBuf->Initialize(std::max(byteSize, 1u));
+    pUploadBuf->Map();
+    return pUploadBuf;
+}
+
+void Renderer::Buffer::Initialize(SDL_GPUBufferUsageFlags usage, u32 byteSize) {
     SDL_GPUBufferCreateInfo bufCreateInfo = {
         .usage = usage,
         .size  = byteSize,
@@ -350,26 +468,338 @@ Renderer::Buffer::~Buffer() {
 SDL_GPUBuffer* Renderer::Buffer::GetHandle() const {
     return m_pHandle;
 }
-void Renderer::Buffer::Upload(SDL_GPUCommandBuffer* pCmdBuf, const UploadBuffer& uploadBuf, u32 byteSize) {
-    SDL_GPUTransferBufferLocation transferBufferLocation = {
-        .transfer_buffer = uploadBuf.GetHandle(),
-        .offset          = 0
+void Renderer::Buffer::Upload(const UploadBuffer& uploadBuf, u32 byteSize, u32 uploadOffset) {
+    GetUploadScheduler().Add({
+        .pUploadBuf   = &uploadBuf,
+        .uploadOffset = uploadOffset,
+        .byteSize     = (byteSize != 0 ? byteSize : uploadBuf.GetSize()),
+        .pBuffer      = m_pHandle
+    });
+}
+void Renderer::Buffer::Upload(const void* pData, u32 byteSize) {
+    GetUploadScheduler().Add({
+        .pData    = pData,
+        .byteSize = byteSize,
+        .pBuffer  = m_pHandle
+    });
+}
+
+void Renderer::StagingRing::Initialize(u32 byteSize) {
+    m_pUploadBuffer = std::make_unique<UploadBuffer>();
+    m_pUploadBuffer->Initialize(byteSize);
+}
+void Renderer::StagingRing::Release() {
+    m_submissions.clear();
+    m_pUploadBuffer = nullptr;
+    m_head = m_tail = m_submittedHead = 0;
+}
+const Renderer::UploadBuffer& Renderer::StagingRing::GetUploadBuffer() const {
+    return *m_pUploadBuffer;
+}
+bool Renderer::StagingRing::Write(const void* pData, u32 byteSize, u32 alignment, u32& offset) {
+    SDL_assert((alignment & (alignment - 1)) == 0);
+    const u64 size = m_pUploadBuffer->GetSize();
+    if (byteSize > size)
+        return false;
+
+    // Allocations never straddle the end of the buffer
+    Reclaim(false);
+    u64 pos = (m_head + alignment - 1) & ~(u64)(alignment - 1);
+    if (pos % size + byteSize > size)
+        pos += size - pos % size;
+    while (pos + byteSize - m_tail > size) {
+        if (m_submissions.empty())
+            return false;
+        Reclaim(true);
+    }
+
+    offset = pos % size;
+    SDL_memcpy(m_pUploadBuffer->Map() + offset, pData, byteSize);
+    m_pUploadBuffer->Unmap();
+    m_head = pos + byteSize;
+    return true;
+}
+void Renderer::StagingRing::OnSubmit(u64 submission) {
+    if (m_head == m_submittedHead)
+        return;
+    m_submissions.push_back({ submission, m_head });
+    m_submittedHead = m_head;
+}
+// Oldest first; with wait the oldest submission is waited for
+void Renderer::StagingRing::Reclaim(bool wait) {
+    if (wait && !m_submissions.empty())
+        GetSubmissionTracker().Wait(m_submissions.front().submission);
+    const u64 completed = GetSubmissionTracker().GetCompleted();
+    while (!m_submissions.empty() && m_submissions.front().submission <= completed) {
+        m_tail = m_submissions.front().end;
+        m_submissions.pop_front();
+    }
+}
+
+u64 Renderer::SubmissionTracker::Add(SDL_GPUFence* pFence) {
+    m_fences.push_back(pFence);
+    return ++m_submitted;
+}
+u64 Renderer::SubmissionTracker::GetCompleted() {
+    while (!m_fences.empty() && SDL_QueryGPUFence(GetDevice(), m_fences.front())) {
+        SDL_ReleaseGPUFence(GetDevice(), m_fences.front());
+        m_fences.pop_front();
+        m_completed++;
+    }
+    return m_completed;
+}
+void Renderer::SubmissionTracker::Wait(u64 submission) {
+    SDL_assert(submission <= m_submitted);
+    while (m_completed < submission) {
+        SDL_WaitForGPUFences(GetDevice(), true, &m_fences.front(), 1);
+        SDL_ReleaseGPUFence(GetDevice(), m_fences.front());
+        m_fences.pop_front();
+        m_completed++;
+    }
+}
+void Renderer::SubmissionTracker::Release() {
+    Wait(m_submitted);
+}
+
+Renderer::SubmissionTracker& Renderer::GetSubmissionTracker() {
+    static SubmissionTracker submissionTracker;
+    return submissionTracker;
+}
+
+Renderer::StagingRing& Renderer::GetStagingRing() {
+    static StagingRing stagingRing;
+    return stagingRing;
+}
+
+void Renderer::UploadScheduler::SetBudget(u32 bytesPerFrame) {
+    m_budget = bytesPerFrame;
+}
+void Renderer::UploadScheduler::SetStreaming(bool streaming) {
+    m_streaming = streaming;
+}
+void Renderer::UploadScheduler::Add(const Copy& copy) {
+    if (!m_streaming) {
+        m_copies.push_back(copy);
+        return;
+    }
+    if (copy.byteSize <= UPLOAD_CHUNK_SIZE) {
+        m_streamedSteps.push_back({ copy });
+        return;
+    }
+
+    // Buffers split by bytes, textures by rows; block-compressed rows come in whole blocks
+    const bool isBufferCopy = copy.IsBufferCopy();
+    const u32 rowSize     = isBufferCopy ? 1 : SDL_CalculateGPUTextureFormatSize(copy.format, copy.textureRegion.w, 1, 1);
+    const u32 blockHeight = isBufferCopy || SDL_CalculateGPUTextureFormatSize(copy.format, copy.textureRegion.w, 4, 1) != rowSize ? 1 : 4;
+    const u32 rowNum      = isBufferCopy ? copy.byteSize : copy.textureRegion.h;
+    const u32 chunkRowNum = std::max(UPLOAD_CHUNK_SIZE / rowSize, 1u) * blockHeight;
+    for (u32 row = 0; row < rowNum; row += chunkRowNum) {
+        const u32 dataOffset = row / blockHeight * rowSize;
+        Copy chunk = copy;
+        if (chunk.pUploadBuf != nullptr)
+            chunk.uploadOffset += dataOffset;
+        else
+            chunk.pData = (const u8*)chunk.pData + dataOffset;
+
+        if (isBufferCopy) {
+            chunk.bufferOffset += dataOffset;
+            chunk.byteSize = std::min(chunkRowNum, rowNum - row);
+        }
+        else {
+            chunk.textureRegion.y += row;
+            chunk.textureRegion.h = std::min(chunkRowNum, rowNum - row);
+            chunk.byteSize = SDL_CalculateGPUTextureFormatSize(copy.format, copy.textureRegion.w, chunk.textureRegion.h, 1);
+        }
+        m_streamedSteps.push_back({ chunk });
+    }
+}
+void Renderer::UploadScheduler::AddMove(const shared<Buffer>& pSrc, u32 srcOffset, const shared<Buffer>& pDst, u32 dstOffset, u32 byteSize) {
+    m_moves.push_back({ pSrc, pDst, srcOffset, dstOffset, byteSize });
+}
+void Renderer::UploadScheduler::AddFinalizer(UploadCallback finalizer) {
+    if (m_streaming)
+        m_streamedSteps.push_back({ .finalizer = std::move(finalizer) });
+    else
+        finalizer();
+}
+void Renderer::UploadScheduler::Flush(SDL_GPUCommandBuffer* pCmdBuf, bool streamed) {
+    SDL_GPUCopyPass* pCopyPass = nullptr;
+    auto beginCopyPass = [&]() {
+        if (pCopyPass == nullptr)
+            pCopyPass = SDL_BeginGPUCopyPass(pCmdBuf);
     };
-    SDL_GPUBufferRegion bufferRegion = {
-        .buffer = m_pHandle,
-        .offset = 0,
-        .size   = (byteSize != 0 ? byteSize : uploadBuf.GetSize())
+    auto record = [&](const Copy& copy) {
+        beginCopyPass();
+        Record(pCopyPass, copy);
     };
 
-    SDL_GPUCopyPass* pCopyPass = SDL_BeginGPUCopyPass(pCmdBuf);
-    SDL_UploadToGPUBuffer(pCopyPass, &transferBufferLocation, &bufferRegion, false);
-    SDL_EndGPUCopyPass(pCopyPass);
+    // Pending copies into a relocated pool already target the new buffer, the old contents go first
+    for (const Move& move : m_moves) {
+        beginCopyPass();
+        SDL_GPUBufferLocation src = {
+            .buffer = move.pSrc->GetHandle(),
+            .offset = move.srcOffset
+        };
+        SDL_GPUBufferLocation dst = {
+            .buffer = move.pDst->GetHandle(),
+            .offset = move.dstOffset
+        };
+        SDL_CopyGPUBufferToBuffer(pCopyPass, &src, &dst, move.byteSize, false);
+    }
+    m_moves.clear();
+
+    for (const Copy& copy : m_copies)
+        record(copy);
+    m_copies.clear();
+
+    // At least one streamed copy per frame, however small the budget
+    u64 streamedSize = 0;
+    while (streamed && !m_streamedSteps.empty()) {
+        StreamedStep& step = m_streamedSteps.front();
+        if (step.finalizer) {
+            m_readyFinalizers.push_back(std::move(step.finalizer));
+        }
+        else {
+            if (streamedSize != 0 && streamedSize + step.copy.byteSize > m_budget)
+                break;
+            record(step.copy);
+            streamedSize += step.copy.byteSize;
+        }
+        m_streamedSteps.pop_front();
+    }
+
+    if (pCopyPass != nullptr)
+        SDL_EndGPUCopyPass(pCopyPass);
 }
-void Renderer::Buffer::Upload(SDL_GPUCommandBuffer* pCmdBuf, const void* pData, u32 byteSize) {
-    UploadBuffer uploadBuf;
-    uploadBuf.Initialize(byteSize);
-    uploadBuf.SetData(pData, byteSize);
-    Upload(pCmdBuf, uploadBuf);
+void Renderer::UploadScheduler::RunFinalizers() {
+    // Moved out first, finalizers may upload again
+    vector<UploadCallback> finalizers;
+    finalizers.swap(m_readyFinalizers);
+    for (UploadCallback& finalizer : finalizers)
+        finalizer();
+}
+// CPU data goes through the staging ring, or a temporary transfer buffer when it does not fit
+void Renderer::UploadScheduler::Record(SDL_GPUCopyPass* pCopyPass, const Copy& copy) {
+    const UploadBuffer* pUploadBuf = copy.pUploadBuf;
+    u32 uploadOffset = copy.uploadOffset;
+    unique<UploadBuffer> pTemporaryBuf;
+    if (pUploadBuf == nullptr) {
+        // Texture copies from D3D12 upload heaps want 512 byte placement
+        if (GetStagingRing().Write(copy.pData, copy.byteSize, copy.IsBufferCopy() ? 16 : 512, uploadOffset)) {
+            pUploadBuf = &GetStagingRing().GetUploadBuffer();
+        }
+        else {
+            pTemporaryBuf = std::make_unique<UploadBuffer>();
+            pTemporaryBuf->Initialize(copy.byteSize);
+            pTemporaryBuf->SetData(copy.pData, copy.byteSize);
+            pUploadBuf   = pTemporaryBuf.get();
+            uploadOffset = 0;
+        }
+    }
+
+    if (copy.IsBufferCopy()) {
+        SDL_GPUTransferBufferLocation transferBufferLocation = {
+            .transfer_buffer = pUploadBuf->GetHandle(),
+            .offset          = uploadOffset
+        };
+        SDL_GPUBufferRegion bufferRegion = {
+            .buffer = copy.pBuffer,
+            .offset = copy.bufferOffset,
+            .size   = copy.byteSize
+        };
+        if (copy.pPool != nullptr) {
+            bufferRegion.buffer  = copy.pPool->GetHandle();
+            bufferRegion.offset += copy.pPool->GetOffset(copy.allocation) * copy.pPool->GetElementSize();
+        }
+        SDL_UploadToGPUBuffer(pCopyPass, &transferBufferLocation, &bufferRegion, false);
+    }
+    else {
+        // Rows are tightly packed; for block-compressed formats the pitch is in whole blocks
+        SDL_GPUTextureTransferInfo transferInfo = {
+            .transfer_buffer = pUploadBuf->GetHandle(),
+            .offset          = uploadOffset,
+            .pixels_per_row  = 0,
+            .rows_per_layer  = 0
+        };
+        SDL_UploadToGPUTexture(pCopyPass, &transferInfo, &copy.textureRegion, false);
+    }
+}
+
+Renderer::UploadScheduler& Renderer::GetUploadScheduler() {
+    static UploadScheduler uploadScheduler;
+    return uploadScheduler;
+}
+
+void Renderer::BufferPool::Initialize(SDL_GPUBufferUsageFlags usage, u32 elementSize, u32 elementNum) {
+    m_usage       = usage;
+    m_elementSize = elementSize;
+    m_allocator   = TlsfAllocator(elementNum);
+    m_pBuffer     = std::make_shared<Buffer>();
+    m_pBuffer->Initialize(usage, elementNum * elementSize);
+}
+u32 Renderer::BufferPool::Allocate(u32 elementNum) {
+    u32 allocation = m_allocator.Allocate(elementNum);
+    if (allocation != TlsfAllocator::INVALID_ALLOCATION)
+        return allocation;
+
+    // Compacted when the free space suffices, doubled otherwise
+    const u32 size = m_allocator.GetSize();
+    Relocate(m_allocator.GetFreeSize() >= elementNum ? size : std::max(size * 2, size + elementNum));
+    allocation = m_allocator.Allocate(elementNum);
+    SDL_assert(allocation != TlsfAllocator::INVALID_ALLOCATION);
+    return allocation;
+}
+void Renderer::BufferPool::Free(u32 allocation) {
+    m_allocator.Free(allocation);
+}
+u32 Renderer::BufferPool::GetOffset(u32 allocation) const {
+    return m_allocator.GetOffset(allocation);
+}
+u32 Renderer::BufferPool::GetElementSize() const {
+    return m_elementSize;
+}
+SDL_GPUBuffer* Renderer::BufferPool::GetHandle() const {
+    return m_pBuffer->GetHandle();
+}
+void Renderer::BufferPool::Upload(u32 allocation, const UploadBuffer& uploadBuf, u32 byteSize, u32 uploadOffset) {
+    GetUploadScheduler().Add({
+        .pUploadBuf   = &uploadBuf,
+        .uploadOffset = uploadOffset,
+        .byteSize     = byteSize,
+        .pPool        = this,
+        .allocation   = allocation
+    });
+}
+void Renderer::BufferPool::Upload(u32 allocation, const void* pData, u32 byteSize) {
+    GetUploadScheduler().Add({
+        .pData      = pData,
+        .byteSize   = byteSize,
+        .pPool      = this,
+        .allocation = allocation
+    });
+}
+// Worth a copy of the live data once a quarter of the pool is free and scattered
+void Renderer::BufferPool::Defragment() {
+    const u32 freeSize = m_allocator.GetFreeSize();
+    if (freeSize > m_allocator.GetSize() / 4 && m_allocator.GetLargestFreeSize() < freeSize / 2)
+        Relocate(m_allocator.GetSize());
+}
+void Renderer::BufferPool::Relocate(u32 elementNum) {
+    const vector<TlsfAllocator::Move> moves = m_allocator.Compact();
+    if (elementNum > m_allocator.GetSize())
+        m_allocator.Grow(elementNum);
+
+    shared<Buffer> pBuffer = std::make_shared<Buffer>();
+    pBuffer->Initialize(m_usage, elementNum * m_elementSize);
+    for (const TlsfAllocator::Move& move : moves)
+        GetUploadScheduler().AddMove(m_pBuffer, move.srcOffset * m_elementSize, pBuffer, move.dstOffset * m_elementSize, move.size * m_elementSize);
+    m_pBuffer = pBuffer;
+}
+
+Renderer::Geometry::~Geometry() {
+    Renderer& renderer = GetInstance();
+    renderer.m_vertexPools[vertexFormat].Free(vertexAllocation);
+    renderer.m_indexPool.Free(indexAllocation);
 }
 
 void Renderer::Sampler::Initialize(const SamplerCreateInfo& createInfo) {
@@ -410,43 +840,125 @@ void Renderer::Texture::Initialize(const TextureCreateInfo& createInfo) {
 Renderer::Texture::~Texture() {
     Release();
 }
+void Renderer::Texture::InitializeLayer(const shared<TextureArray>& pArray, u32 layer) {
+    m_pArray  = pArray;
+    m_layer   = layer;
+    m_pHandle = pArray->GetHandle();
+}
 void Renderer::Texture::Release() {
-    if (m_pHandle != nullptr)
+    if (m_pArray != nullptr)
+        m_pArray->FreeLayer(m_layer);
+    else if (m_pHandle != nullptr)
         SDL_ReleaseGPUTexture(GetDevice(), m_pHandle);
+    m_pArray  = nullptr;
     m_pHandle = nullptr;
 }
+bool Renderer::Texture::IsArrayLayer() const {
+    return m_pArray != nullptr;
+}
+u32 Renderer::Texture::GetLayer() const {
+    return m_layer;
+}
 SDL_GPUTexture* Renderer::Texture::GetHandle() const {
     return m_pHandle;
 }
-void Renderer::Texture::Upload(SDL_GPUCommandBuffer* pCmdBuf, const UploadBuffer& uploadBuf, const TextureData& data) {
-    SDL_GPUTextureTransferInfo transferInfo = {
-        .transfer_buffer = uploadBuf.GetHandle(),
-        .offset          = 0,
-        .pixels_per_row  = 0,
-        .rows_per_layer  = 0
-    };
+void Renderer::Texture::Upload(const UploadBuffer& uploadBuf, const TextureData& data, u32 uploadOffset) {
+    AddCopies(&uploadBuf, data, uploadOffset);
+}
+void Renderer::Texture::Upload(const TextureData& data) {
+    if (data.pStaging != nullptr) {
+        data.pStaging->Unmap();
+        Upload(*data.pStaging, data);
+        return;
+    }
+    AddCopies(nullptr, data, 0);
+}
+// One copy per level and layer, from the transfer buffer or from data.pPixels
+void Renderer::Texture::AddCopies(const UploadBuffer* pUploadBuf, const TextureData& data, u32 uploadOffset) {
+    u32 offset = uploadOffset;
+    for (u32 mip = 0; mip < data.mipLevelNum; mip++) {
+        const u32 width  = std::max(data.width >> mip, 1u);
+        const u32 height = std::max(data.height >> mip, 1u);
+        const u32 layerSize = SDL_CalculateGPUTextureFormatSize(data.format, width, height, 1);
+
+        for (u32 layer = 0; layer < data.layerNum; layer++) {
+            UploadScheduler::Copy copy = {
+                .byteSize = layerSize,
+                .textureRegion = {
+                    .texture   = m_pHandle,
+                    .mip_level = mip,
+                    .layer     = m_layer + layer,
+                    .x         = 0,
+                    .y         = 0,
+                    .w         = width,
+                    .h         = height,
+                    .d         = 1
+                },
+                .format = data.format
+            };
+            if (pUploadBuf != nullptr) {
+                copy.pUploadBuf   = pUploadBuf;
+                copy.uploadOffset = offset;
+            }
+            else {
+                copy.pData = (const u8*)data.pPixels + offset;
+            }
+            GetUploadScheduler().Add(copy);
+            offset += layerSize;
+        }
+    }
+}
 
-    SDL_GPUTextureRegion textureRegion = {
-        .texture   = m_pHandle,
-        .mip_level = 0,
-        .layer     = 0,
-        .x         = 0,
-        .y         = 0,
-        .w         = data.width,
-        .h         = data.height,
-        .d         = 1
-    };
+void Renderer::TextureArray::Initialize(const TextureData& data, u32 layerNum) {
+    TextureCreateInfo createInfo;
+    createInfo.data        = data;
+    createInfo.type        = SDL_GPU_TEXTURETYPE_2D_ARRAY;
+    createInfo.format      = data.format;
+    createInfo.layerNum    = layerNum;
+    createInfo.mipLevelNum = data.mipLevelNum;
+    m_texture.Initialize(createInfo);
+
+    // Lowest layers first
+    m_layerNum = layerNum;
+    for (u32 layer = layerNum; layer > 0; layer--)
+        m_freeLayers.push_back(layer - 1);
+}
+SDL_GPUTexture* Renderer::TextureArray::GetHandle() const {
+    return m_texture.GetHandle();
+}
+bool Renderer::TextureArray::AllocateLayer(u32& layer) {
+    if (m_freeLayers.empty())
+        return false;
+    layer = m_freeLayers.back();
+    m_freeLayers.pop_back();
+    return true;
+}
+void Renderer::TextureArray::FreeLayer(u32 layer) {
+    m_freeLayers.push_back(layer);
+}
+bool Renderer::TextureArray::IsEmpty() const {
+    return m_freeLayers.size() == m_layerNum;
+}
 
-    SDL_GPUCopyPass* pCopyPass = SDL_BeginGPUCopyPass(pCmdBuf);
-    SDL_UploadToGPUTexture(pCopyPass, &transferInfo, &textureRegion, false);
-    SDL_EndGPUCopyPass(pCopyPass);
+u32 Renderer::GetTextureDataSize(const TextureData& data) {
+    u32 size = 0;
+    for (u32 mip = 0; mip < data.mipLevelNum; mip++)
+        size += SDL_CalculateGPUTextureFormatSize(data.format, std::max(data.width >> mip, 1u), std::max(data.height >> mip, 1u), 1) * data.layerNum;
+    return size;
 }
-// NOTE: as of now, this assumes 32 bits per pixel
-void Renderer::Texture::Upload(SDL_GPUCommandBuffer* pCmdBuf, const TextureData& data) {
-    UploadBuffer uploadBuf;
-    uploadBuf.Initialize(data.width * data.height * sizeof(u32));
-    uploadBuf.SetData(data.pPixels, data.width * data.height * sizeof(u32));
-    Upload(pCmdBuf, uploadBuf, data);
+
+u32 Renderer::GetVertexSize(VertexFormat format) {
+    return format == VertexFormat_Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+}
+
+u32 Renderer::GetVertexNum(const MeshCreateInfo& createInfo) {
+    if (createInfo.pStaging != nullptr)
+        return createInfo.stagedVertexNum;
+    return createInfo.vertexFormat == VertexFormat_Compact ? createInfo.compactVertices.size() : createInfo.vertices.size();
+}
+
+u32 Renderer::GetIndexNum(const MeshCreateInfo& createInfo) {
+    return createInfo.pStaging != nullptr ? createInfo.stagedIndexNum : createInfo.indices.size();
 }
 
 SDL_GPUDevice*& Renderer::GetDevice() {
@@ -461,16 +973,163 @@ SDL_Window*& Renderer::GetWindow() {
 void Renderer::ImmediateCmdBuf(CommandBufferFunction function) {
     SDL_GPUCommandBuffer* pCmdBuf = SDL_AcquireGPUCommandBuffer(GetDevice());
     function(pCmdBuf);
-    SDL_SubmitGPUCommandBuffer(pCmdBuf);
+    GetUploadScheduler().Flush(pCmdBuf, false);
+    SubmitCommandBuffer(pCmdBuf);
+}
+
+u64 Renderer::SubmitCommandBuffer(SDL_GPUCommandBuffer* pCmdBuf) {
+    SDL_GPUFence* pFence = SDL_SubmitGPUCommandBufferAndAcquireFence(pCmdBuf);
+    if (pFence == nullptr)
+        FatalError("Could not submit command buffer");
+    const u64 submission = GetSubmissionTracker().Add(pFence);
+    GetStagingRing().OnSubmit(submission);
+    return submission;
+}
+
+void Renderer::RecordPendingUploads() {
+    // Swapped out so that loader threads are never blocked on the recording
+    vector<UploadCallback> uploads;
+    {
+        std::lock_guard lock(m_uploadMutex);
+        uploads.swap(m_pendingUploads);
+    }
+    GetUploadScheduler().SetStreaming(true);
+    for (UploadCallback& upload : uploads)
+        upload();
+    GetUploadScheduler().SetStreaming(false);
+}
+
+void Renderer::InitializeMesh(Mesh& mesh, const MeshCreateInfo& createInfo) {
+    mesh.transform    = createInfo.transform;
+    mesh.vertexFormat = createInfo.vertexFormat;
+    mesh.meshlets     = createInfo.meshlets;
+    mesh.lods         = createInfo.lods;
+    mesh.boundsCenter = createInfo.boundsCenter;
+    mesh.boundsRadius = createInfo.boundsRadius;
+    if (createInfo.vertexFormat == VertexFormat_Compact)
+        mesh.dequantization = glm::scale(glm::translate(Mat4(1), createInfo.boundsMin), createInfo.boundsExtent);
+
+    mesh.pGeometry  = AcquireGeometry(createInfo);
+    mesh.indicesNum = createInfo.lods.empty() ? GetIndexNum(createInfo) : createInfo.lods[0].indexNum;
+
+    // Textures; missing ones are replaced by placeholders in AddMeshDraw
+    for (i32 i = 0; i < TextureCount; i++) {
+        if (createInfo.texturesData[i].pPixels != nullptr)
+            mesh.textures[i] = AcquireTexture(createInfo.texturesData[i]);
+    }
+}
+
+u64 Renderer::GetTextureKey(const TextureData& data) {
+    if (data.key != 0)
+        return data.key;
+    SDL_assert(data.pStaging == nullptr);
+
+    u64 key = HashBytes(data.pPixels, GetTextureDataSize(data));
+    key = HashCombine(key, (u64)data.width << 32 | data.height);
+    key = HashCombine(key, (u64)data.format << 32 | data.type);
+    return HashCombine(key, (u64)data.mipLevelNum << 32 | data.layerNum);
+}
+
+u64 Renderer::GetGeometryKey(const MeshCreateInfo& createInfo) {
+    if (createInfo.geometryKey != 0)
+        return createInfo.geometryKey;
+    SDL_assert(createInfo.pStaging == nullptr);
+
+    const u64 key = createInfo.vertexFormat == VertexFormat_Compact ?
+        HashBytes(createInfo.compactVertices.data(), createInfo.compactVertices.size() * sizeof(CompactVertex)) :
+        HashBytes(createInfo.vertices.data(), createInfo.vertices.size() * sizeof(Vertex));
+    return HashCombine(HashCombine(key, createInfo.vertexFormat), HashBytes(createInfo.indices.data(), createInfo.indices.size() * sizeof(Index)));
+}
+
+shared<Renderer::Texture> Renderer::AcquireTexture(const TextureData& data) {
+    const u64 key = GetTextureKey(data);
+    shared<Texture> pTexture = m_textureRegistry.Find(key);
+    if (pTexture != nullptr)
+        return pTexture;
+
+    TextureCreateInfo textureCreateInfo;
+    textureCreateInfo.data        = data;
+    textureCreateInfo.type        = data.type;
+    textureCreateInfo.format      = data.format;
+    textureCreateInfo.layerNum    = data.layerNum;
+    textureCreateInfo.mipLevelNum = data.mipLevelNum;
+    pTexture = std::make_shared<Texture>();
+    if (m_materialBatching && data.type == SDL_GPU_TEXTURETYPE_2D && data.layerNum == 1)
+        InitializeArrayLayer(*pTexture, data);
+    else
+        pTexture->Initialize(textureCreateInfo);
+    pTexture->Upload(data);
+
+    m_textureRegistry.Add(key, pTexture);
+    return pTexture;
+}
+
+// Pages of one size, format and mip count start small and double, a full page is never moved
+void Renderer::InitializeArrayLayer(Texture& texture, const TextureData& data) {
+    const u64 key = HashCombine(HashCombine((u64)data.width << 32 | data.height, data.format), data.mipLevelNum);
+    vector<shared<TextureArray>>& pages = m_textureArrays[key];
+    u32 layer;
+    for (const shared<TextureArray>& pPage : pages) {
+        if (pPage->AllocateLayer(layer)) {
+            texture.InitializeLayer(pPage, layer);
+            return;
+        }
+    }
+
+    shared<TextureArray> pPage = std::make_shared<TextureArray>();
+    pPage->Initialize(data, std::min(4u << std::min<u32>(pages.size(), 4), MATERIAL_ARRAY_MAX_LAYERS));
+    pages.push_back(pPage);
+    pPage->AllocateLayer(layer);
+    texture.InitializeLayer(pPage, layer);
+}
+
+// The GPU texture of a page is released once the command buffers using it are done
+void Renderer::ReleaseEmptyArrayPages() {
+    for (auto it = m_textureArrays.begin(); it != m_textureArrays.end();) {
+        std::erase_if(it->second, [](const shared<TextureArray>& pPage) { return pPage->IsEmpty(); });
+        it = it->second.empty() ? m_textureArrays.erase(it) : std::next(it);
+    }
+}
+
+shared<Renderer::Geometry> Renderer::AcquireGeometry(const MeshCreateInfo& createInfo) {
+    const u64 key = GetGeometryKey(createInfo);
+    shared<Geometry> pGeometry = m_geometryRegistry.Find(key);
+    if (pGeometry != nullptr)
+        return pGeometry;
+
+    const u32 vertexDataSize = GetVertexNum(createInfo) * GetVertexSize(createInfo.vertexFormat);
+    const u32 indexDataSize  = GetIndexNum(createInfo) * sizeof(Index);
+
+    BufferPool& vertexPool = m_vertexPools[createInfo.vertexFormat];
+    pGeometry = std::make_shared<Geometry>();
+    pGeometry->vertexFormat     = createInfo.vertexFormat;
+    pGeometry->vertexAllocation = vertexPool.Allocate(GetVertexNum(createInfo));
+    pGeometry->indexAllocation  = m_indexPool.Allocate(GetIndexNum(createInfo));
+
+    // Staged geometry is uploaded where the loader decoded it
+    if (createInfo.pStaging != nullptr) {
+        createInfo.pStaging->Unmap();
+        vertexPool.Upload(pGeometry->vertexAllocation, *createInfo.pStaging, vertexDataSize);
+        m_indexPool.Upload(pGeometry->indexAllocation, *createInfo.pStaging, indexDataSize, vertexDataSize);
+    }
+    else {
+        const void* pVertexData = createInfo.vertexFormat == VertexFormat_Compact ?
+            (const void*)createInfo.compactVertices.data() : (const void*)createInfo.vertices.data();
+        vertexPool.Upload(pGeometry->vertexAllocation, pVertexData, vertexDataSize);
+        m_indexPool.Upload(pGeometry->indexAllocation, createInfo.indices.data(), indexDataSize);
+    }
+
+    m_geometryRegistry.Add(key, pGeometry);
+    return pGeometry;
 }
 
 void Renderer::UpdateProjection(u32 width, u32 height) {
+    m_viewportHeight = height;
     m_proj = glm::perspective(glm::radians(FOV_DEG), (float)width / height, CAM_NEAR, CAM_FAR);
 }
 
-void Renderer::UpdateFragmentShaderFrameData(SDL_GPUCommandBuffer* pCmdBuf) {
-    m_fragmentShaderFrameDataBuffer.Upload(
-        pCmdBuf,
+void Renderer::UpdateFragmentShaderFrameData() {
+    m_frames[m_frameIdx].fragmentShaderFrameDataBuffer.Upload(
         &m_fragmentShaderFrameData,
         sizeof(FragmentShaderFrameData)
     );
@@ -478,40 +1137,190 @@ void Renderer::UpdateFragmentShaderFrameData(SDL_GPUCommandBuffer* pCmdBuf) {
 
 void Renderer::PushFragmentShaderFrameData(SDL_GPURenderPass* pRenderPass) {
     constexpr u32 SHADER_FRAME_DATA_SLOT_IDX = 0; // why tf does this work when binding = 3 in shader???
-    SDL_GPUBuffer* pBufferRawPtr = m_fragmentShaderFrameDataBuffer.GetHandle();
+    SDL_GPUBuffer* pBufferRawPtr = m_frames[m_frameIdx].fragmentShaderFrameDataBuffer.GetHandle();
     SDL_BindGPUFragmentStorageBuffers(pRenderPass, SHADER_FRAME_DATA_SLOT_IDX, &pBufferRawPtr, 1);
 }
 
-void Renderer::DrawMesh(const Mesh& mesh, SDL_GPURenderPass* pRenderPass, SDL_GPUCommandBuffer* pCmdBuf) {
-    // Binding sampler-texture pairs
-    array<SDL_GPUTextureSamplerBinding, TextureCount> samplerBindings;
-    for (i32 i = 0; i < TextureCount; i++) {
-        SDL_GPUTextureSamplerBinding binding = {
-            .texture = mesh.textures[i].GetHandle(),
-            .sampler = m_sampler.GetHandle()
-        };
-        samplerBindings[i] = binding;
+void Renderer::UpdateFrustumPlanes() {
+    // Gribb-Hartmann; clip space depth is [0, 1]
+    const Mat4 viewProj = m_proj * m_view;
+    const Vec4 row0 = glm::vec4(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+    const Vec4 row1 = glm::vec4(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+    const Vec4 row2 = glm::vec4(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+    const Vec4 row3 = glm::vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+    m_frustumPlanes = {
+        row3 + row0,
+        row3 - row0,
+        row3 + row1,
+        row3 - row1,
+        row2,
+        row3 - row2
+    };
+    for (Vec4& plane : m_frustumPlanes)
+        plane /= glm::length(Vec3(plane));
+}
+
+// Coarsest level whose error, projected at the near side of the bounding sphere, stays under the threshold
+u32 Renderer::SelectLod(const Mesh& mesh, float maxScale) const {
+    if (mesh.lods.size() <= 1)
+        return 0;
+
+    const Vec3 center = Vec3(mesh.transform * Vec4(mesh.boundsCenter, 1.0f));
+    const float distance = glm::max(
+        glm::distance(center, m_fragmentShaderFrameData.camPos) - mesh.boundsRadius * maxScale,
+        CAM_NEAR
+    );
+    const float pixelsPerUnit = m_viewportHeight / (2.0f * glm::tan(glm::radians(FOV_DEG) * 0.5f) * distance);
+
+    u32 lod = 0;
+    while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * maxScale * pixelsPerUnit <= m_lodThreshold)
+        lod++;
+    return lod;
+}
+
+bool Renderer::MeshletIsVisible(const Meshlet& meshlet, const Mat4& transform, float maxScale, bool coneTest) const {
+    const Vec3 center = Vec3(transform * Vec4(meshlet.center, 1.0f));
+    const float radius = meshlet.radius * maxScale;
+
+    for (const Vec4& plane : m_frustumPlanes) {
+        if (glm::dot(Vec3(plane), center) + plane.w < -radius)
+            return false;
     }
-    SDL_BindGPUFragmentSamplers(pRenderPass, 0, samplerBindings.data(), samplerBindings.size());
+    if (!coneTest)
+        return true;
 
-    // Binding vertex buffer
-    SDL_GPUBufferBinding vertBufferBinding = {
-        .buffer = mesh.vertexBuffer.GetHandle(),
-        .offset = 0
+    const Vec3 coneAxis = glm::normalize(glm::mat3(transform) * meshlet.coneAxis);
+    const Vec3 toCenter = center - m_fragmentShaderFrameData.camPos;
+    return glm::dot(toCenter, coneAxis) < meshlet.coneCutoff * glm::length(toCenter) + radius;
+}
+
+void Renderer::AddMeshDraw(const Mesh& mesh) {
+    const Vec3 scale = Vec3(glm::length(Vec3(mesh.transform[0])), glm::length(Vec3(mesh.transform[1])), glm::length(Vec3(mesh.transform[2])));
+    const float maxScale = glm::max(glm::max(scale.x, scale.y), scale.z);
+    // Cones keep their angle under uniform scale only
+    const float minScale = glm::min(glm::min(scale.x, scale.y), scale.z);
+    const bool coneTest = m_coneCulling && maxScale - minScale <= maxScale * 1e-3f;
+
+    // Index ranges, offset to where the mesh lives in the index pool
+    const u32 firstIndex = m_indexPool.GetOffset(mesh.pGeometry->indexAllocation);
+    const u32 firstRange = m_visibleRanges.size();
+    const u32 lod = SelectLod(mesh, maxScale);
+    if (lod > 0) {
+        m_visibleRanges.push_back({ firstIndex + mesh.lods[lod].indexOffset, mesh.lods[lod].indexNum });
+    }
+    else if (!m_clusterCulling || mesh.meshlets.empty()) {
+        m_visibleRanges.push_back({ firstIndex, mesh.indicesNum });
+    }
+    else {
+        // Cluster culling; visible meshlets that are adjacent in the index buffer share a command
+        for (const Meshlet& meshlet : mesh.meshlets) {
+            if (!MeshletIsVisible(meshlet, mesh.transform, maxScale, coneTest))
+                continue;
+            if (m_visibleRanges.size() > firstRange && m_visibleRanges.back().firstIndex + m_visibleRanges.back().indexNum == firstIndex + meshlet.indexOffset)
+                m_visibleRanges.back().indexNum += meshlet.triangleNum * 3;
+            else
+                m_visibleRanges.push_back({ firstIndex + meshlet.indexOffset, meshlet.triangleNum * 3 });
+        }
+        if (m_visibleRanges.size() == firstRange)
+            return;
+    }
+
+    // Meshes with all textures in arrays share bindings with any other such mesh using the same pages.
+    // Missing textures are filled with placeholders of the same kind; a layer is never bound to the
+    // non-array pipeline, it falls back to the plain placeholder
+    bool hasLayer = false, hasTexture = false;
+    for (const shared<Texture>& pTexture : mesh.textures) {
+        if (pTexture != nullptr)
+            (pTexture->IsArrayLayer() ? hasLayer : hasTexture) = true;
+    }
+    MeshDraw meshDraw = {
+        .key = {
+            .vertexFormat  = mesh.vertexFormat,
+            .arrayMaterial = !hasTexture && (hasLayer || m_materialBatching)
+        },
+        .drawIdx    = (u32)m_drawData.size(),
+        .firstRange = firstRange,
+        .rangeNum   = (u32)m_visibleRanges.size() - firstRange
     };
-    SDL_BindGPUVertexBuffers(pRenderPass, 0, &vertBufferBinding, 1);
+    DrawData drawData = {
+        .model        = mesh.transform * mesh.dequantization,
+        .vertexOffset = m_vertexPools[mesh.vertexFormat].GetOffset(mesh.pGeometry->vertexAllocation)
+    };
+    for (i32 i = 0; i < TextureCount; i++) {
+        const Texture* pTexture = mesh.textures[i].get();
+        if (pTexture == nullptr || pTexture->IsArrayLayer() != meshDraw.key.arrayMaterial)
+            pTexture = meshDraw.key.arrayMaterial ? &m_placeholderLayers[i] : &m_placeholderTextures[i];
+        meshDraw.key.textures[i]     = pTexture->GetHandle();
+        drawData.materialLayers[i]   = pTexture->GetLayer();
+    }
+    m_meshDraws.push_back(meshDraw);
+    m_drawData.push_back(drawData);
+}
 
-    // Binding index buffer
+void Renderer::PrepareDraws() {
+    m_drawData.clear();
+    m_meshDraws.clear();
+    m_drawCommands.clear();
+    m_drawBatches.clear();
+    m_visibleRanges.clear();
+    for (auto& it : m_meshes)
+        AddMeshDraw(it.second);
+    if (m_meshDraws.empty())
+        return;
+
+    // Sorted by pipeline first, then by textures
+    std::sort(m_meshDraws.begin(), m_meshDraws.end(), [](const MeshDraw& a, const MeshDraw& b) { return a.key < b.key; });
+    for (const MeshDraw& meshDraw : m_meshDraws) {
+        if (m_drawBatches.empty() || m_drawBatches.back().key != meshDraw.key)
+            m_drawBatches.push_back({ meshDraw.key, (u32)m_drawCommands.size(), 0 });
+        for (u32 i = meshDraw.firstRange; i < meshDraw.firstRange + meshDraw.rangeNum; i++) {
+            m_drawCommands.push_back({
+                .num_indices    = m_visibleRanges[i].indexNum,
+                .num_instances  = 1,
+                .first_index    = m_visibleRanges[i].firstIndex,
+                .vertex_offset  = 0,
+                .first_instance = meshDraw.drawIdx
+            });
+        }
+        m_drawBatches.back().commandNum += meshDraw.rangeNum;
+    }
+
+    // The frame's buffers grow by doubling; the data is uploaded in the frame's copy pass
+    FrameResources& frame = m_frames[m_frameIdx];
+    if (m_drawData.size() > frame.drawDataCapacity) {
+        frame.drawDataCapacity = std::max<u32>(m_drawData.size(), frame.drawDataCapacity * 2);
+        frame.pDrawDataBuffer = std::make_unique<Buffer>();
+        frame.pDrawDataBuffer->Initialize(SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ, frame.drawDataCapacity * sizeof(DrawData));
+    }
+    if (m_drawCommands.size() > frame.drawCommandCapacity) {
+        frame.drawCommandCapacity = std::max<u32>(m_drawCommands.size(), frame.drawCommandCapacity * 2);
+        frame.pDrawCommandBuffer = std::make_unique<Buffer>();
+        frame.pDrawCommandBuffer->Initialize(SDL_GPU_BUFFERUSAGE_INDIRECT, frame.drawCommandCapacity * sizeof(SDL_GPUIndexedIndirectDrawCommand));
+    }
+    frame.pDrawDataBuffer->Upload(m_drawData.data(), m_drawData.size() * sizeof(DrawData));
+    frame.pDrawCommandBuffer->Upload(m_drawCommands.data(), m_drawCommands.size() * sizeof(SDL_GPUIndexedIndirectDrawCommand));
+}
+
+void Renderer::BindPipeline(SDL_GPURenderPass* pRenderPass, SDL_GPUCommandBuffer* pCmdBuf, const BatchKey& key) {
+    GfxPipeline& pipeline = key.arrayMaterial ? m_arrayPipelines[key.vertexFormat] : m_pipelines[key.vertexFormat];
+    SDL_BindGPUGraphicsPipeline(pRenderPass, pipeline.GetHandle());
+
+    // Geometry of every mesh of the format and the draw data of all meshes
+    array<SDL_GPUBuffer*, 2> storageBuffers = { m_vertexPools[key.vertexFormat].GetHandle(), m_frames[m_frameIdx].pDrawDataBuffer->GetHandle() };
+    SDL_BindGPUVertexStorageBuffers(pRenderPass, 0, storageBuffers.data(), storageBuffers.size());
     SDL_GPUBufferBinding indexBufferBinding = {
-        .buffer = mesh.indexBuffer.GetHandle(),
+        .buffer = m_indexPool.GetHandle(),
         .offset = 0
     };
     SDL_BindGPUIndexBuffer(pRenderPass, &indexBufferBinding, SDL_GPU_INDEXELEMENTSIZE_32BIT);
 
-    // Model uniform
-    constexpr u32 modelSlotIdx = 1;
-    SDL_PushGPUVertexUniformData(pCmdBuf, modelSlotIdx, &mesh.transform, sizeof(Mat4));
+    // Vertex shader frame data
+    constexpr u32 projSlotIdx = 0;
+    constexpr u32 viewSlotIdx = 1;
+    SDL_PushGPUVertexUniformData(pCmdBuf, viewSlotIdx, &m_view, sizeof(Mat4));
+    // Bind other stuff (temporary; TODO: only do these when the information is updated)
+    SDL_PushGPUVertexUniformData(pCmdBuf, projSlotIdx, &m_proj, sizeof(Mat4));
 
-    SDL_DrawGPUIndexedPrimitives(pRenderPass, mesh.indicesNum, 1, 0, 0, 0);
+    // Fragment shader frame data
+    PushFragmentShaderFrameData(pRenderPass);
 }
-
@@ -1,11 +1,21 @@
 #pragma once
 
 #include "../pch.h"
+#include "tlsf_allocator.h"
+#include <mutex>
+#include <deque>
 
 constexpr float FOV_DEG  = 80.0f;
 constexpr float CAM_NEAR = 0.01f;
 constexpr float CAM_FAR  = 1000.0f;
 constexpr u32   MAX_POINT_LIGHT_NUM = 1024;
+constexpr u32   MAX_FRAMES_IN_FLIGHT = 3;
+constexpr u32   STAGING_RING_SIZE   = 64 * 1024 * 1024;
+constexpr u32   UPLOAD_BUDGET       = 16 * 1024 * 1024; // Default bytes of streamed uploads recorded per frame
+constexpr u32   UPLOAD_CHUNK_SIZE   = 2 * 1024 * 1024;  // Streamed copies are split into pieces of about this size
+constexpr u32   VERTEX_POOL_SIZE    = 1024 * 1024;      // Initial vertices per vertex format, the pools grow on demand
+constexpr u32   INDEX_POOL_SIZE     = 4 * 1024 * 1024;  // Initial indices
+constexpr u32   MATERIAL_ARRAY_MAX_LAYERS = 64; // Texture array pages start at 4 layers and double up to this
 
 class Renderer {
 private:
@@ -15,6 +25,8 @@ public:
     Renderer(const Renderer&) = delete;
     void operator=(const Renderer&) = delete;
 
+    class UploadBuffer;
+
     using Vec2 = glm::vec2;
     using Vec3 = glm::vec3;
     using Vec4 = glm::vec4;
@@ -28,11 +40,32 @@ public:
     };
     using Index = u32;
 
+    // 20 bytes instead of 44; see QuantizeVertices() in asset/vertex_quantization.h
+    struct CompactVertex {
+        u16 pos[4];      // UNORM16 inside the mesh bounds, w is padding
+        i16 normal[2];   // Octahedral SNORM16
+        i16 tangent[2];  // Octahedral SNORM16
+        u16 texCoord[2]; // Half floats
+    };
+
+    enum VertexFormat {
+        VertexFormat_Full = 0,
+        VertexFormat_Compact,
+        VertexFormatCount
+    };
+
     struct TextureData {
-        void* pPixels = nullptr;
+        void* pPixels = nullptr; // Mip levels back to back, largest first; each level holds all of its layers
         u32 width     = 0;
         u32 height    = 0;
+        SDL_GPUTextureFormat format = SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM; // Block-compressed formats are supported
+        u32 mipLevelNum = 1;
+        u32 layerNum    = 1; // Array layers times 6 for cubemaps, faces are consecutive layers
+        SDL_GPUTextureType type = SDL_GPU_TEXTURETYPE_2D;
+        u64 key = 0; // Sharing key, e.g. GetFileKey() of the source plus the format; 0 hashes the pixels
+        shared<UploadBuffer> pStaging; // Optional: pPixels points into its mapped memory and is uploaded from there; needs a key
     };
+    static u32 GetTextureDataSize(const TextureData& data); // Bytes of all levels and layers
 
     enum TexIdx {
         TexIdx_Albedo = 0,
@@ -41,11 +74,67 @@ public:
         TextureCount
     };
 
+    // Cluster of consecutive triangles in the index buffer, see asset/meshlets.h
+    struct Meshlet {
+        Vec3  center;     // Bounding sphere, object space
+        float radius;
+        Vec3  coneAxis;   // Backface cone: the meshlet is invisible when
+        float coneCutoff; // dot(center - camPos, coneAxis) >= coneCutoff * length(center - camPos) + radius
+        u32   indexOffset;
+        u32   triangleNum;
+    };
+
+    // Range of the index buffer drawn at one level of detail
+    struct MeshLod {
+        u32   indexOffset;
+        u32   indexNum;
+        float error; // Object space distance
+    };
+
     struct MeshCreateInfo {
-        vector<Vertex> vertices;
+        Mat4                  transform = Mat4(1);
+        VertexFormat          vertexFormat = VertexFormat_Full;
+        vector<Vertex>        vertices;        // VertexFormat_Full
+        vector<CompactVertex> compactVertices; // VertexFormat_Compact
+        Vec3                  boundsMin    = Vec3(0); // Dequantization range of CompactVertex::pos
+        Vec3                  boundsExtent = Vec3(1);
         vector<Index> indices;
+        vector<Meshlet> meshlets; // Optional, enables cluster culling; covers LOD 0 only
+        vector<MeshLod> lods;     // Optional, LOD 0 is the full mesh; see asset/simplifier.h
+        Vec3            boundsCenter = Vec3(0); // Bounding sphere used for LOD selection
+        float           boundsRadius = 0.0f;
         array<TextureData, TextureCount> texturesData;
+        u64 geometryKey = 0; // Sharing key of the vertex and index data, 0 hashes them on creation
+        // Optional, replaces the vertex and index vectors: stagedVertexNum vertices of vertexFormat
+        // followed by stagedIndexNum indices, written in place by the loader; needs a geometryKey
+        shared<UploadBuffer> pStaging;
+        u32 stagedVertexNum = 0;
+        u32 stagedIndexNum  = 0;
+    };
+    static u32 GetVertexSize(VertexFormat format);
+    static u32 GetVertexNum(const MeshCreateInfo& createInfo);
+    static u32 GetIndexNum(const MeshCreateInfo& createInfo);
+    // Meshes with equal keys share GPU buffers and textures; see ResourceRegistry
+    static u64 GetTextureKey(const TextureData& data);
+    static u64 GetGeometryKey(const MeshCreateInfo& createInfo);
+
+    // GPU transfer memory. Loaders get one mapped from CreateStagingBuffer() and decode straight
+    // into it, the upload then copies nothing on the CPU
+    class UploadBuffer {
+    public:
+        void Initialize(u32 byteSize);
+        ~UploadBuffer();
+        SDL_GPUTransferBuffer* GetHandle() const;
+        u32 GetSize() const;
+        void SetData(const void* pData, u32 byteSize);
+        u8* Map(); // Write-combined on most devices, write it sequentially and never read it back
+        void Unmap();
+    private:
+        SDL_GPUTransferBuffer* m_pHandle;
+        u32 m_byteSize;
+        u8* m_pMapped = nullptr;
     };
+    static shared<UploadBuffer> CreateStagingBuffer(u32 byteSize); // Mapped, callable from any thread
 
     struct PointLight {
         Vec3  pos;
@@ -62,11 +151,29 @@ public:
     void RenderFrame();
     void SetViewMatrix(const glm::mat4& viewMat);
     bool CreateMesh(const MeshCreateInfo& createInfo, const string& meshName);
+    // Thread-safe counterparts of CreateMesh for streaming; the uploads are recorded at the start of
+    // the next RenderFrame. Textures without pixel data draw with placeholders until they are uploaded
+    using UploadCallback = std::function<void()>;
+    void QueueMeshCreation(MeshCreateInfo&& createInfo, const string& meshName);
+    void QueueTextureUpload(const string& meshName, TexIdx texIdx, const TextureData& data); // Pixels must outlive the upload
+    void QueueCallback(UploadCallback callback); // Runs on the render thread once everything queued before it is uploaded
+    // Queued uploads are spread over frames so that no frame records more than about this many bytes
+    void SetUploadBudget(u32 bytesPerFrame);
     bool DeleteMesh(const string& meshName);
     glm::mat4* GetMeshTransform(const string& meshName);
     void SetCameraPos(const Vec3& camPos);
     void PushPointLight(const PointLight& pointLight); // NOTE: point lights are reset on every new frame
     void ClearPointLights();
+    void SetClusterCulling(bool enabled); // Frustum culling of meshlets
+    // Backface rejection of meshlets by their normal cones, off by default: the pipeline draws both
+    // faces, so only enable it when every mesh is closed, single-sided geometry
+    void SetConeCulling(bool enabled);
+    void SetLodThreshold(float pixels); // Largest acceptable screen space error
+    // Textures acquired from then on are packed into texture arrays by size, format and mip count;
+    // meshes whose textures all share arrays are drawn together whatever their materials
+    void SetMaterialBatching(bool enabled);
+    // Frames the CPU may record while the GPU still renders earlier ones, 2 (default) or 3
+    void SetFramesInFlight(u32 frameNum);
 private:
     struct ShaderCreateInfo {
         SDL_GPUShaderStage stage;
@@ -98,25 +205,14 @@ private:
         SDL_GPUGraphicsPipeline* m_pHandle;
     };
 
-    class UploadBuffer {
-    public:
-        void Initialize(u32 byteSize);
-        ~UploadBuffer();
-        SDL_GPUTransferBuffer* GetHandle() const;
-        u32 GetSize() const;
-        void SetData(const void* pData, u32 byteSize);
-    private:
-        SDL_GPUTransferBuffer* m_pHandle;
-        u32 m_byteSize;
-    };
-
     class Buffer {
     public:
-        void Initialize(SDL_GPUCommandBuffer* pCmdBuf, SDL_GPUBufferUsageFlags usage, u32 byteSize);
+        void Initialize(SDL_GPUBufferUsageFlags usage, u32 byteSize);
         ~Buffer();
         SDL_GPUBuffer* GetHandle() const;
-        void Upload(SDL_GPUCommandBuffer* pCmdBuf, const UploadBuffer& uploadBuf, u32 byteSize = 0);
-        void Upload(SDL_GPUCommandBuffer* pCmdBuf, const void* pData, u32 byteSize);
+        // Both are recorded by the UploadScheduler; pData must stay valid until then
+        void Upload(const UploadBuffer& uploadBuf, u32 byteSize = 0, u32 uploadOffset = 0);
+        void Upload(const void* pData, u32 byteSize);
     private:
         SDL_GPUBuffer* m_pHandle;
     };
@@ -143,25 +239,214 @@ private:
         u32                      layerNum    = 1;
         u32                      mipLevelNum = 1;
     };
+    class TextureArray;
     class Texture {
     public:
         void Initialize(const TextureCreateInfo& createInfo);
+        // A layer of a texture array instead of a texture of its own, uploads go to that layer
+        void InitializeLayer(const shared<TextureArray>& pArray, u32 layer);
+        bool IsArrayLayer() const;
+        u32 GetLayer() const;
         ~Texture();
         void Release();
         SDL_GPUTexture* GetHandle() const;
-        void Upload(SDL_GPUCommandBuffer* pCmdBuf, const UploadBuffer& uploadBuf, const TextureData& data);
-        void Upload(SDL_GPUCommandBuffer* pCmdBuf, const TextureData& data);
+        void Upload(const UploadBuffer& uploadBuf, const TextureData& data, u32 uploadOffset = 0);
+        // From data.pStaging when set, otherwise through the staging ring
+        void Upload(const TextureData& data);
+    private:
+        void AddCopies(const UploadBuffer* pUploadBuf, const TextureData& data, u32 uploadOffset);
+
+        SDL_GPUTexture*      m_pHandle = nullptr;
+        shared<TextureArray> m_pArray;
+        u32                  m_layer = 0;
+    };
+
+    // Page of same-size, same-format 2D textures in one 2D array texture
+    class TextureArray {
+    public:
+        void Initialize(const TextureData& data, u32 layerNum);
+        SDL_GPUTexture* GetHandle() const;
+        bool AllocateLayer(u32& layer);
+        void FreeLayer(u32 layer);
+        bool IsEmpty() const;
     private:
-        SDL_GPUTexture* m_pHandle = nullptr;
+        Texture     m_texture;
+        vector<u32> m_freeLayers;
+        u32         m_layerNum = 0;
     };
     
+    // Fences of all submitted command buffers, released in order once signaled. Submissions are
+    // numbered from 1, so waiting for one works on plain counters. Render thread only
+    class SubmissionTracker {
+    public:
+        u64 Add(SDL_GPUFence* pFence); // Number of the submission
+        u64 GetCompleted();            // Last submission the GPU finished
+        void Wait(u64 submission);     // Returns right away for completed ones and 0
+        void Release();                // Waits for all
+    private:
+        std::deque<SDL_GPUFence*> m_fences; // Of the submissions after m_completed
+        u64 m_submitted = 0;
+        u64 m_completed = 0;
+    };
+    static SubmissionTracker& GetSubmissionTracker();
+
+    // Persistent transfer buffer behind the uploads from CPU memory. Space is bump-allocated in
+    // submission order and reclaimed once the command buffer that read it completes, so steady
+    // frames create no transfer buffers. Render thread only
+    class StagingRing {
+    public:
+        void Initialize(u32 byteSize);
+        void Release(); // After the GPU is done with it
+        const UploadBuffer& GetUploadBuffer() const;
+        // Copies pData in, waiting for older submissions while the ring is full; false when it does
+        // not fit next to the writes of the command buffer being recorded
+        bool Write(const void* pData, u32 byteSize, u32 alignment, u32& offset);
+        void OnSubmit(u64 submission); // Called for every submitted command buffer
+    private:
+        struct Submission {
+            u64 submission;
+            u64 end;
+        };
+        void Reclaim(bool wait);
+
+        unique<UploadBuffer> m_pUploadBuffer;
+        u64 m_head = 0; // Positions keep growing, the offset in the buffer is modulo its size
+        u64 m_tail = 0;
+        u64 m_submittedHead = 0;
+        std::deque<Submission> m_submissions;
+    };
+    static StagingRing& GetStagingRing();
+    u64 SubmitCommandBuffer(SDL_GPUCommandBuffer* pCmdBuf); // Number of the submission
+
+    class BufferPool;
+
+    // Collects the copies of Buffer::Upload() and Texture::Upload() and records them in one copy
+    // pass per command buffer. Copies added while streaming are split into chunks and recorded in
+    // order over the following frames, about the budget per frame. Render thread only
+    class UploadScheduler {
+    public:
+        struct Copy {
+            const UploadBuffer*  pUploadBuf = nullptr; // Null: pData goes through the staging ring when recorded
+            const void*          pData = nullptr;
+            u32                  uploadOffset = 0;
+            u32                  byteSize = 0;
+            SDL_GPUBuffer*       pBuffer = nullptr; // Destination: a buffer, a pool allocation or a texture region
+            const BufferPool*    pPool = nullptr;   // Looked up when recorded, pools move their allocations
+            u32                  allocation = 0;
+            u32                  bufferOffset = 0;  // From the start of the buffer or the allocation
+            SDL_GPUTextureRegion textureRegion = {};
+            SDL_GPUTextureFormat format = SDL_GPU_TEXTUREFORMAT_INVALID;
+
+            bool IsBufferCopy() const { return pBuffer != nullptr || pPool != nullptr; }
+        };
+        void SetBudget(u32 bytesPerFrame);
+        void SetStreaming(bool streaming);
+        void Add(const Copy& copy);
+        // Buffer to buffer copies of relocated pools, recorded in order before every other copy
+        void AddMove(const shared<Buffer>& pSrc, u32 srcOffset, const shared<Buffer>& pDst, u32 dstOffset, u32 byteSize);
+        // Runs once every copy streamed before it is recorded, right away when not streaming.
+        // Whatever streamed copies read from or write to must be kept alive by a finalizer
+        void AddFinalizer(UploadCallback finalizer);
+        // Records the moves and copies added since the last flush and, with streamed, the next
+        // streamed ones within the budget
+        void Flush(SDL_GPUCommandBuffer* pCmdBuf, bool streamed);
+        // The finalizers reached by the last flushes; after the submission, so that uploads they
+        // make in command buffers of their own are ordered after the recorded ones
+        void RunFinalizers();
+    private:
+        struct StreamedStep {
+            Copy           copy;
+            UploadCallback finalizer; // Set for finalizer steps
+        };
+        struct Move {
+            shared<Buffer> pSrc; // Kept alive until recorded
+            shared<Buffer> pDst;
+            u32            srcOffset;
+            u32            dstOffset;
+            u32            byteSize;
+        };
+        static void Record(SDL_GPUCopyPass* pCopyPass, const Copy& copy);
+
+        vector<Move>             m_moves;
+        vector<Copy>             m_copies;
+        std::deque<StreamedStep> m_streamedSteps;
+        vector<UploadCallback>   m_readyFinalizers;
+        u32  m_budget    = UPLOAD_BUDGET;
+        bool m_streaming = false;
+    };
+    static UploadScheduler& GetUploadScheduler();
+
+    // One large GPU buffer suballocated in elements of a fixed size, for geometry of all meshes.
+    // Running out of space compacts or grows it into a new buffer: the UploadScheduler copies the
+    // allocations over before anything else and uploads find their allocation when recorded
+    class BufferPool {
+    public:
+        void Initialize(SDL_GPUBufferUsageFlags usage, u32 elementSize, u32 elementNum);
+        u32 Allocate(u32 elementNum); // Handle, may move the other allocations
+        void Free(u32 allocation);
+        u32 GetOffset(u32 allocation) const; // In elements
+        u32 GetElementSize() const;
+        SDL_GPUBuffer* GetHandle() const;
+        void Upload(u32 allocation, const UploadBuffer& uploadBuf, u32 byteSize, u32 uploadOffset = 0);
+        void Upload(u32 allocation, const void* pData, u32 byteSize);
+        void Defragment(); // Compacts when the free space is scattered
+    private:
+        void Relocate(u32 elementNum);
+
+        SDL_GPUBufferUsageFlags m_usage;
+        u32                     m_elementSize;
+        shared<Buffer>          m_pBuffer;
+        TlsfAllocator           m_allocator;
+    };
+    // Vertices are pulled from storage buffers, one pool per format; draws of all meshes share the bindings
+    array<BufferPool, VertexFormatCount> m_vertexPools;
+    BufferPool                           m_indexPool;
+
+    // Ranges of the pools, returned on destruction
+    struct Geometry {
+        VertexFormat vertexFormat;
+        u32          vertexAllocation;
+        u32          indexAllocation;
+        ~Geometry();
+    };
     struct Mesh {
-        glm::mat4                    transform = Mat4(1);
-        Buffer                       vertexBuffer;
-        Buffer                       indexBuffer;
-        u32                          indicesNum;
-        array<Texture, TextureCount> textures;
+        glm::mat4                            transform = Mat4(1);
+        glm::mat4                            dequantization = Mat4(1); // Applied before transform
+        VertexFormat                         vertexFormat = VertexFormat_Full;
+        shared<Geometry>                     pGeometry;
+        u32                                  indicesNum;
+        vector<Meshlet>                      meshlets;
+        vector<MeshLod>                      lods;
+        Vec3                                 boundsCenter;
+        float                                boundsRadius;
+        array<shared<Texture>, TextureCount> textures; // Null ones are drawn with placeholders
+    };
+
+    // GPU resources shared between meshes by key; an entry lives as long as its last user
+    template<typename T>
+    class ResourceRegistry {
+    public:
+        shared<T> Find(u64 key) const {
+            auto it = m_entries.find(key);
+            return it != m_entries.end() ? it->second.lock() : nullptr;
+        }
+        void Add(u64 key, const shared<T>& pResource) {
+            m_entries[key] = pResource;
+        }
+        void Prune() {
+            std::erase_if(m_entries, [](const auto& entry) { return entry.second.expired(); });
+        }
+    private:
+        umap<u64, std::weak_ptr<T>> m_entries;
     };
+    ResourceRegistry<Texture>  m_textureRegistry;
+    ResourceRegistry<Geometry> m_geometryRegistry;
+    shared<Texture> AcquireTexture(const TextureData& data);
+    umap<u64, vector<shared<TextureArray>>> m_textureArrays; // Pages by size, format and mip count
+    bool m_materialBatching = false;
+    void InitializeArrayLayer(Texture& texture, const TextureData& data);
+    void ReleaseEmptyArrayPages();
+    shared<Geometry> AcquireGeometry(const MeshCreateInfo& createInfo);
 
     struct FragmentShaderFrameData {
         Vec3       camPos;
@@ -171,55 +456,95 @@ private:
         PointLight pointLights[MAX_POINT_LIGHT_NUM];
     };
     FragmentShaderFrameData m_fragmentShaderFrameData;
-    Buffer m_fragmentShaderFrameDataBuffer;
+
+    // Per mesh drawn this frame, the vertex shaders read it at gl_InstanceIndex: the first_instance
+    // of the mesh's indirect commands (Vulkan counts it in, and the device only takes SPIR-V)
+    struct DrawData {
+        Mat4 model;        // transform * dequantization
+        u32  vertexOffset; // Of the mesh in its vertex pool
+        u32  materialLayers[TextureCount]; // Array layers of the textures when batched
+    };
+    // Draws sharing a pipeline and texture bindings
+    struct BatchKey {
+        VertexFormat                         vertexFormat;
+        bool                                 arrayMaterial; // Textures are layers of texture arrays
+        array<SDL_GPUTexture*, TextureCount> textures;
+        auto operator<=>(const BatchKey&) const = default;
+    };
+    struct MeshDraw {
+        BatchKey key;
+        u32      drawIdx;
+        u32      firstRange; // In m_visibleRanges
+        u32      rangeNum;
+    };
+    struct DrawBatch {
+        BatchKey key;
+        u32      firstCommand;
+        u32      commandNum;
+    };
+    vector<DrawData>                          m_drawData;
+    vector<MeshDraw>                          m_meshDraws;
+    vector<SDL_GPUIndexedIndirectDrawCommand> m_drawCommands;
+    vector<DrawBatch>                         m_drawBatches;
+
+    // GPU buffers rewritten every frame, one set per frame in flight: the copies of a frame never
+    // wait for the GPU to stop reading the previous one, and the CPU only waits when it is a full
+    // ring of frames ahead
+    struct FrameResources {
+        u64            submission = 0; // The last one that used the set
+        Buffer         fragmentShaderFrameDataBuffer;
+        unique<Buffer> pDrawDataBuffer;
+        unique<Buffer> pDrawCommandBuffer;
+        u32            drawDataCapacity    = 0;
+        u32            drawCommandCapacity = 0;
+    };
+    array<FrameResources, MAX_FRAMES_IN_FLIGHT> m_frames;
+    u32 m_frameIdx       = 0;
+    u32 m_framesInFlight = 2;
 
     glm::mat4 m_proj = glm::mat4(1);
     glm::mat4 m_view;
+    array<Vec4, 6> m_frustumPlanes; // World space, inside is dot(plane, Vec4(p, 1)) >= 0
+    bool m_clusterCulling = true;
+    bool m_coneCulling    = false;
+    float m_lodThreshold = 1.0f;
+    float m_viewportHeight = 1.0f;
+    struct IndexRange {
+        u32 firstIndex;
+        u32 indexNum;
+    };
+    vector<IndexRange> m_visibleRanges; // Of all meshes drawn this frame, first indices are in the index pool
     umap<string, Mesh> m_meshes;
 
-    GfxPipeline m_pipeline;
+    array<GfxPipeline, VertexFormatCount> m_pipelines;
+    array<GfxPipeline, VertexFormatCount> m_arrayPipelines; // Sample texture arrays
     Sampler     m_sampler;
     Texture     m_depthTexture;
 
-    static constexpr std::array<SDL_GPUVertexAttribute, 4> s_vertexAttribs = {
-        SDL_GPUVertexAttribute{
-            .location = 0,
-            .buffer_slot = 0,
-            .format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT3,
-            .offset = offsetof(Vertex, pos)
-        },
-        SDL_GPUVertexAttribute{
-            .location = 1,
-            .buffer_slot = 0,
-            .format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT3,
-            .offset = offsetof(Vertex, normal)
-        },
-        SDL_GPUVertexAttribute{
-            .location = 2,
-            .buffer_slot = 0,
-            .format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT3,
-            .offset = offsetof(Vertex, tangent)
-        },
-        SDL_GPUVertexAttribute{
-            .location = 3,
-            .buffer_slot = 0,
-            .format = SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2,
-            .offset = offsetof(Vertex, texCoord)
-        }
-    };
-
     static SDL_GPUDevice*& GetDevice();
     static SDL_Window*& GetWindow();
 
     // NOTE: check if std::function<> hurts performance in the future
     using CommandBufferFunction = std::function<void(SDL_GPUCommandBuffer*)>;
     void ImmediateCmdBuf(CommandBufferFunction function);
+    std::mutex             m_uploadMutex;
+    vector<UploadCallback> m_pendingUploads; // Filled from any thread, drained by RenderFrame
+    void RecordPendingUploads(); // Their copies are streamed
+    void InitializeMesh(Mesh& mesh, const MeshCreateInfo& createInfo);
+
+    array<Texture, TextureCount> m_placeholderTextures; // 1x1, bound in place of textures that are not uploaded yet
+    array<Texture, TextureCount> m_placeholderLayers;   // The same as array layers, for array materials
     void UpdateProjection(u32 width, u32 height);
 
-    void UpdateFragmentShaderFrameData(SDL_GPUCommandBuffer* pCmdBuf);
+    void UpdateFragmentShaderFrameData();
     void PushFragmentShaderFrameData(SDL_GPURenderPass* pRenderPass);
 
-    void DrawMesh(const Mesh& mesh, SDL_GPURenderPass* pRenderPass, SDL_GPUCommandBuffer* pCmdBuf);
+    void UpdateFrustumPlanes();
+    u32 SelectLod(const Mesh& mesh, float maxScale) const;
+    bool MeshletIsVisible(const Meshlet& meshlet, const Mat4& transform, float maxScale, bool coneTest) const;
+    void AddMeshDraw(const Mesh& mesh);
+    void PrepareDraws(); // Culls, then batches and uploads the draws of the frame
+    void BindPipeline(SDL_GPURenderPass* pRenderPass, SDL_GPUCommandBuffer* pCmdBuf, const BatchKey& key);
 };
 
 
@@ -0,0 +1,259 @@
+#include "tlsf_allocator.h"
+
+#include <bit>
+
+TlsfAllocator::TlsfAllocator(u32 size) {
+    for (array<u32, SL_NUM>& bins : m_bins)
+        bins.fill(INVALID_ALLOCATION);
+    if (size != 0)
+        Grow(size);
+}
+
+u32 TlsfAllocator::Allocate(u32 size) {
+    SDL_assert(size != 0);
+    const u32 nodeIdx = FindFreeNode(size);
+    if (nodeIdx == INVALID_ALLOCATION)
+        return INVALID_ALLOCATION;
+    RemoveFree(nodeIdx);
+
+    // The rest of the range goes back to its bin
+    if (m_nodes[nodeIdx].size > size) {
+        const u32 restIdx = NewNode();
+        Node& node = m_nodes[nodeIdx];
+        Node& rest = m_nodes[restIdx];
+        rest.offset   = node.offset + size;
+        rest.size     = node.size - size;
+        rest.prevPhys = nodeIdx;
+        rest.nextPhys = node.nextPhys;
+        if (node.nextPhys != INVALID_ALLOCATION)
+            m_nodes[node.nextPhys].prevPhys = restIdx;
+        node.nextPhys = restIdx;
+        node.size     = size;
+        InsertFree(restIdx);
+    }
+
+    m_nodes[nodeIdx].free = false;
+    m_freeSize -= size;
+    return nodeIdx;
+}
+
+void TlsfAllocator::Free(u32 allocation) {
+    SDL_assert(allocation < m_nodes.size() && m_nodes[allocation].size != 0 && !m_nodes[allocation].free);
+    u32 nodeIdx = allocation;
+    m_freeSize += m_nodes[nodeIdx].size;
+
+    const u32 nextIdx = m_nodes[nodeIdx].nextPhys;
+    if (nextIdx != INVALID_ALLOCATION && m_nodes[nextIdx].free) {
+        RemoveFree(nextIdx);
+        m_nodes[nodeIdx].size    += m_nodes[nextIdx].size;
+        m_nodes[nodeIdx].nextPhys = m_nodes[nextIdx].nextPhys;
+        if (m_nodes[nodeIdx].nextPhys != INVALID_ALLOCATION)
+            m_nodes[m_nodes[nodeIdx].nextPhys].prevPhys = nodeIdx;
+        ReleaseNode(nextIdx);
+    }
+
+    const u32 prevIdx = m_nodes[nodeIdx].prevPhys;
+    if (prevIdx != INVALID_ALLOCATION && m_nodes[prevIdx].free) {
+        RemoveFree(prevIdx);
+        m_nodes[prevIdx].size    += m_nodes[nodeIdx].size;
+        m_nodes[prevIdx].nextPhys = m_nodes[nodeIdx].nextPhys;
+        if (m_nodes[prevIdx].nextPhys != INVALID_ALLOCATION)
+            m_nodes[m_nodes[prevIdx].nextPhys].prevPhys = prevIdx;
+        ReleaseNode(nodeIdx);
+        nodeIdx = prevIdx;
+    }
+
+    InsertFree(nodeIdx);
+}
+
+u32 TlsfAllocator::GetOffset(u32 allocation) const {
+    return m_nodes[allocation].offset;
+}
+
+u32 TlsfAllocator::GetSize() const {
+    return m_size;
+}
+
+u32 TlsfAllocator::GetFreeSize() const {
+    return m_freeSize;
+}
+
+u32 TlsfAllocator::GetLargestFreeSize() const {
+    if (m_flBitmap == 0)
+        return 0;
+    const u32 fl = std::bit_width(m_flBitmap) - 1;
+    const u32 sl = std::bit_width(m_slBitmaps[fl]) - 1;
+    u32 largest = 0;
+    for (u32 nodeIdx = m_bins[fl][sl]; nodeIdx != INVALID_ALLOCATION; nodeIdx = m_nodes[nodeIdx].nextFree)
+        largest = std::max(largest, m_nodes[nodeIdx].size);
+    return largest;
+}
+
+vector<TlsfAllocator::Move> TlsfAllocator::Compact() {
+    // Free ranges are dropped and rebuilt as one at the end
+    m_flBitmap = 0;
+    m_slBitmaps.fill(0);
+    for (array<u32, SL_NUM>& bins : m_bins)
+        bins.fill(INVALID_ALLOCATION);
+    vector<u32> allocations;
+    for (u32 i = 0; i < m_nodes.size(); i++) {
+        if (m_nodes[i].size == 0)
+            continue;
+        if (m_nodes[i].free)
+            ReleaseNode(i);
+        else
+            allocations.push_back(i);
+    }
+    std::sort(allocations.begin(), allocations.end(), [&](u32 a, u32 b) { return m_nodes[a].offset < m_nodes[b].offset; });
+
+    // Allocations that stay adjacent share a move
+    vector<Move> moves;
+    u32 offset  = 0;
+    u32 prevIdx = INVALID_ALLOCATION;
+    for (u32 nodeIdx : allocations) {
+        Node& node = m_nodes[nodeIdx];
+        if (!moves.empty() && moves.back().srcOffset + moves.back().size == node.offset)
+            moves.back().size += node.size;
+        else
+            moves.push_back({ node.offset, offset, node.size });
+
+        node.offset   = offset;
+        node.prevPhys = prevIdx;
+        node.nextPhys = INVALID_ALLOCATION;
+        if (prevIdx != INVALID_ALLOCATION)
+            m_nodes[prevIdx].nextPhys = nodeIdx;
+        prevIdx = nodeIdx;
+        offset += node.size;
+    }
+
+    if (offset < m_size) {
+        const u32 restIdx = NewNode();
+        m_nodes[restIdx].offset   = offset;
+        m_nodes[restIdx].size     = m_size - offset;
+        m_nodes[restIdx].prevPhys = prevIdx;
+        if (prevIdx != INVALID_ALLOCATION)
+            m_nodes[prevIdx].nextPhys = restIdx;
+        InsertFree(restIdx);
+    }
+    return moves;
+}
+
+void TlsfAllocator::Grow(u32 size) {
+    SDL_assert(size > m_size);
+    const u32 addedSize = size - m_size;
+
+    u32 lastIdx = INVALID_ALLOCATION;
+    for (u32 i = 0; i < m_nodes.size(); i++) {
+        if (m_nodes[i].size != 0 && m_nodes[i].nextPhys == INVALID_ALLOCATION)
+            lastIdx = i;
+    }
+
+    if (lastIdx != INVALID_ALLOCATION && m_nodes[lastIdx].free) {
+        RemoveFree(lastIdx);
+        m_nodes[lastIdx].size += addedSize;
+        InsertFree(lastIdx);
+    }
+    else {
+        const u32 restIdx = NewNode();
+        m_nodes[restIdx].offset   = m_size;
+        m_nodes[restIdx].size     = addedSize;
+        m_nodes[restIdx].prevPhys = lastIdx;
+        if (lastIdx != INVALID_ALLOCATION)
+            m_nodes[lastIdx].nextPhys = restIdx;
+        InsertFree(restIdx);
+    }
+
+    m_size      = size;
+    m_freeSize += addedSize;
+}
+
+// Sizes below SL_NUM are binned linearly, larger ones by their top SL_BITS + 1 bits
+void TlsfAllocator::GetBin(u32 size, u32& fl, u32& sl) {
+    if (size < SL_NUM) {
+        fl = 0;
+        sl = size;
+        return;
+    }
+    const u32 log2 = std::bit_width(size) - 1;
+    fl = log2 - SL_BITS + 1;
+    sl = (size >> (log2 - SL_BITS)) - SL_NUM;
+}
+
+// Good fit: the size is rounded up to the next bin so that any range found there is large enough
+u32 TlsfAllocator::FindFreeNode(u32 size) const {
+    u64 roundedSize = size;
+    if (size >= SL_NUM)
+        roundedSize += (1ull << (std::bit_width(size) - 1 - SL_BITS)) - 1;
+    if (roundedSize > UINT32_MAX)
+        return INVALID_ALLOCATION;
+
+    u32 fl, sl;
+    GetBin(roundedSize, fl, sl);
+    u32 slBitmap = m_slBitmaps[fl] & (~0u << sl);
+    if (slBitmap == 0) {
+        const u32 flBitmap = m_flBitmap & (~0u << (fl + 1));
+        if (flBitmap != 0) {
+            fl = std::countr_zero(flBitmap);
+            slBitmap = m_slBitmaps[fl];
+        }
+    }
+    if (slBitmap != 0)
+        return m_bins[fl][std::countr_zero(slBitmap)];
+
+    // Nothing in larger bins, the bin of the size itself may still hold a range that fits
+    GetBin(size, fl, sl);
+    for (u32 nodeIdx = m_bins[fl][sl]; nodeIdx != INVALID_ALLOCATION; nodeIdx = m_nodes[nodeIdx].nextFree) {
+        if (m_nodes[nodeIdx].size >= size)
+            return nodeIdx;
+    }
+    return INVALID_ALLOCATION;
+}
+
+void TlsfAllocator::InsertFree(u32 nodeIdx) {
+    u32 fl, sl;
+    GetBin(m_nodes[nodeIdx].size, fl, sl);
+    Node& node = m_nodes[nodeIdx];
+    node.free     = true;
+    node.prevFree = INVALID_ALLOCATION;
+    node.nextFree = m_bins[fl][sl];
+    if (node.nextFree != INVALID_ALLOCATION)
+        m_nodes[node.nextFree].prevFree = nodeIdx;
+    m_bins[fl][sl] = nodeIdx;
+    m_flBitmap      |= 1u << fl;
+    m_slBitmaps[fl] |= 1u << sl;
+}
+
+void TlsfAllocator::RemoveFree(u32 nodeIdx) {
+    u32 fl, sl;
+    GetBin(m_nodes[nodeIdx].size, fl, sl);
+    Node& node = m_nodes[nodeIdx];
+    if (node.prevFree != INVALID_ALLOCATION)
+        m_nodes[node.prevFree].nextFree = node.nextFree;
+    else
+        m_bins[fl][sl] = node.nextFree;
+    if (node.nextFree != INVALID_ALLOCATION)
+        m_nodes[node.nextFree].prevFree = node.prevFree;
+
+    if (m_bins[fl][sl] == INVALID_ALLOCATION) {
+        m_slBitmaps[fl] &= ~(1u << sl);
+        if (m_slBitmaps[fl] == 0)
+            m_flBitmap &= ~(1u << fl);
+    }
+    node.free = false;
+}
+
+u32 TlsfAllocator::NewNode() {
+    if (m_releasedNodes.empty()) {
+        m_nodes.emplace_back();
+        return m_nodes.size() - 1;
+    }
+    const u32 nodeIdx = m_releasedNodes.back();
+    m_releasedNodes.pop_back();
+    m_nodes[nodeIdx] = Node();
+    return nodeIdx;
+}
+
+void TlsfAllocator::ReleaseNode(u32 nodeIdx) {
+    m_nodes[nodeIdx] = Node();
+    m_releasedNodes.push_back(nodeIdx);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "../pch.h"
+
+// Two-level segregated fit allocator of ranges in [0, size), e.g. elements of a GPU buffer.
+// Only offsets are tracked, the memory itself is never touched. Allocating and freeing are
+// O(1): free ranges sit in bins by size (power of two, then 16 linear steps) found through
+// two bitmaps, neighbors are merged on free
+class TlsfAllocator {
+public:
+    static constexpr u32 INVALID_ALLOCATION = UINT32_MAX;
+    struct Move {
+        u32 srcOffset;
+        u32 dstOffset;
+        u32 size;
+    };
+
+    explicit TlsfAllocator(u32 size = 0);
+    u32 Allocate(u32 size); // Handle, INVALID_ALLOCATION when no free range is large enough
+    void Free(u32 allocation);
+    u32 GetOffset(u32 allocation) const;
+    u32 GetSize() const;
+    u32 GetFreeSize() const;
+    u32 GetLargestFreeSize() const;
+    // Packs the allocations to the front in offset order, handles stay valid. The moves copy
+    // the old layout into the new one and never overlap in the destination
+    vector<Move> Compact();
+    void Grow(u32 size); // Larger than the current size, the new space is free
+private:
+    static constexpr u32 SL_BITS = 4;
+    static constexpr u32 SL_NUM  = 1 << SL_BITS;
+    static constexpr u32 FL_NUM  = 32 - SL_BITS + 1;
+
+    // Sizes of 0 mark released nodes
+    struct Node {
+        u32  offset   = 0;
+        u32  size     = 0;
+        u32  prevPhys = INVALID_ALLOCATION; // Neighbors in memory
+        u32  nextPhys = INVALID_ALLOCATION;
+        u32  prevFree = INVALID_ALLOCATION; // Bin list
+        u32  nextFree = INVALID_ALLOCATION;
+        bool free     = false;
+    };
+
+    static void GetBin(u32 size, u32& fl, u32& sl);
+    u32 FindFreeNode(u32 size) const;
+    void InsertFree(u32 nodeIdx);
+    void RemoveFree(u32 nodeIdx);
+    u32 NewNode();
+    void ReleaseNode(u32 nodeIdx);
+
+    vector<Node> m_nodes;
+    vector<u32>  m_releasedNodes;
+    u32 m_flBitmap = 0;
+    array<u32, FL_NUM> m_slBitmaps = {};
+    array<array<u32, SL_NUM>, FL_NUM> m_bins;
+    u32 m_size     = 0;
+    u32 m_freeSize = 0;
+};
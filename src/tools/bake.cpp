@@ -0,0 +1,227 @@
+/*
+ * Offline asset baker: imports, optimizes and caches every model under an asset
+ * directory and compresses the images they reference into .baked.ktx2 files, so
+ * the renderer starts from baked data instead of running the import path.
+ *
+ * Usage: pbr_bake <asset directory> [--lods N] [--meshlets] [--no-optimize] [--kaiser] [--force]
+ *
+ * A dependency database (bake.db in the asset directory) records a hash of every
+ * baked source together with the tool version and the settings; unchanged assets
+ * whose outputs are still valid are skipped.
+ */
+#include "../pch.h"
+#include "../model.h"
+#include "../asset/json.h"
+#include <map>
+#include <atomic>
+
+// Bump to re-bake everything after changing any step of the pipeline
+constexpr u32 BAKE_TOOL_VERSION = 3;
+
+const char* BAKE_DATABASE_NAME = "bake.db";
+
+const array<string, 5> MODEL_EXTENSIONS = { ".gltf", ".glb", ".obj", ".fbx", ".dae" };
+
+// Source path relative to the asset directory -> key of the inputs it was baked from
+class BakeDatabase {
+public:
+    void Load(const string& path) {
+        size_t size;
+        char* pText = (char*)SDL_LoadFile(path.c_str(), &size);
+        if (pText == nullptr)
+            return;
+
+        // One "<hex key> <path>" pair per line
+        const char* pLine = pText;
+        const char* pEnd  = pText + size;
+        while (pLine < pEnd) {
+            const char* pLineEnd = std::find(pLine, pEnd, '\n');
+            const char* pSpace   = std::find(pLine, pLineEnd, ' ');
+            if (pSpace != pLineEnd)
+                m_entries[string(pSpace + 1, pLineEnd)] = SDL_strtoull(string(pLine, pSpace).c_str(), nullptr, 16);
+            pLine = pLineEnd + 1;
+        }
+        SDL_free(pText);
+    }
+    bool Save(const string& path) const {
+        string text;
+        for (const auto& [source, key] : m_entries) {
+            char keyText[17];
+            SDL_snprintf(keyText, sizeof(keyText), "%016llx", (unsigned long long)key);
+            text += string(keyText) + " " + source + "\n";
+        }
+        const string tempPath = path + ".tmp";
+        if (!SDL_SaveFile(tempPath.c_str(), text.data(), text.size()))
+            return false;
+        std::error_code error;
+        std::filesystem::rename(tempPath, path, error);
+        return !error;
+    }
+    bool IsCurrent(const string& source, u64 key) const {
+        std::lock_guard lock(m_mutex);
+        auto it = m_entries.find(source);
+        return it != m_entries.end() && it->second == key;
+    }
+    void Set(const string& source, u64 key) {
+        std::lock_guard lock(m_mutex);
+        m_entries[source] = key;
+    }
+private:
+    std::map<string, u64> m_entries; // Ordered so that the file diffs cleanly
+    mutable std::mutex    m_mutex;
+};
+
+u64 HashFile(const string& path) {
+    FileBuffer file;
+    if (!FileSystem::GetInstance().ReadFile(path, file))
+        return 0;
+    return HashBytes(file.GetData(), file.GetSize());
+}
+
+// Files a model is built from: the model itself plus the external buffers of a glTF
+vector<string> GetModelInputs(const string& path) {
+    vector<string> inputs = { path };
+    if (std::filesystem::path(path).extension() != ".gltf")
+        return inputs;
+
+    FileBuffer file;
+    JsonValue root;
+    string error;
+    if (!FileSystem::GetInstance().ReadFile(path, file) || !ParseJson((const char*)file.GetData(), file.GetSize(), root, error))
+        return inputs;
+    const string directory = std::filesystem::path(path).parent_path().string();
+    for (const JsonValue& buffer : root["buffers"].GetElements()) {
+        const string& uri = buffer["uri"].GetString();
+        if (!uri.empty() && uri.rfind("data:", 0) != 0)
+            inputs.push_back(directory + "/" + uri);
+    }
+    return inputs;
+}
+
+u64 GetInputsKey(const vector<string>& inputs, u64 settingsKey) {
+    u64 key = HashCombine(BAKE_TOOL_VERSION, settingsKey);
+    for (const string& input : inputs)
+        key = HashCombine(key, HashFile(input));
+    return key;
+}
+
+string GetRelativePath(const string& path, const string& root) {
+    return GetGenericPath(std::filesystem::relative(path, root).string());
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        SDL_Log("Usage: pbr_bake <asset directory> [--lods N] [--meshlets] [--no-optimize] [--kaiser] [--force]");
+        return 1;
+    }
+
+    const string root = GetGenericPath(argv[1]);
+    ModelLoadSettings settings;
+    settings.stageUploads = false; // No GPU device here
+    bool force = false;
+    for (i32 i = 2; i < argc; i++) {
+        const string arg = argv[i];
+        if (arg == "--lods" && i + 1 < argc)
+            settings.lodNum = SDL_clamp(SDL_atoi(argv[++i]), 1, 255);
+        else if (arg == "--meshlets")
+            settings.buildMeshlets = true;
+        else if (arg == "--no-optimize")
+            settings.optimizeMeshes = false;
+        else if (arg == "--kaiser")
+            settings.mipFilter = ImageFilter_Kaiser;
+        else if (arg == "--force")
+            force = true;
+        else
+            SDL_Log("Unknown argument: %s", arg.c_str());
+    }
+
+    const string databasePath = root + "/" + BAKE_DATABASE_NAME;
+    BakeDatabase database;
+    if (!force)
+        database.Load(databasePath);
+
+    vector<string> modelPaths;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(root, error)) {
+        const string extension = entry.path().extension().string();
+        if (entry.is_regular_file() && std::find(MODEL_EXTENSIONS.begin(), MODEL_EXTENSIONS.end(), extension) != MODEL_EXTENSIONS.end())
+            modelPaths.push_back(GetGenericPath(entry.path().string()));
+    }
+    if (error)
+        FatalError("Could not list asset directory: " + root);
+
+    Timer timer;
+    std::atomic<u32> bakedModelNum = 0;
+    const u64 geometryKey = HashCombine(MESH_CACHE_VERSION, GetBakeFlags(settings));
+
+    // Models in parallel, every model also spreads its meshes over the job system
+    vector<vector<MeshAsset>> models(modelPaths.size());
+    JobSystem::GetInstance().ParallelFor(modelPaths.size(), 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            const string& path = modelPaths[i];
+            const string source = GetRelativePath(path, root);
+            const u64 key = GetInputsKey(GetModelInputs(path), geometryKey);
+
+            // The cache is also checked against the source stamp, a touched file is baked again
+            if (database.IsCurrent(source, key) && ReadMeshCache(path, GetBakeFlags(settings), models[i]))
+                continue;
+            models[i] = BakeModelGeometry(path, settings);
+            database.Set(source, key);
+            bakedModelNum++;
+            SDL_Log("Baked %s", source.c_str());
+        }
+    });
+
+    // Every distinct image once, compressed for the slot of its first use
+    umap<string, u32> textureIndices;
+    vector<string> texturePaths;
+    vector<Renderer::TexIdx> textureSlots;
+    for (u32 modelIdx = 0; modelIdx < models.size(); modelIdx++) {
+        const string directory = std::filesystem::path(modelPaths[modelIdx]).parent_path().string();
+        for (const MeshAsset& mesh : models[modelIdx]) {
+            for (i32 i = 0; i < mesh.texturePaths.size(); i++) {
+                if (mesh.texturePaths[i].empty() || IsTextureContainer(mesh.texturePaths[i]))
+                    continue;
+                const string texturePath = GetGenericPath(directory + "/" + mesh.texturePaths[i]);
+                if (textureIndices.try_emplace(texturePath, texturePaths.size()).second) {
+                    texturePaths.push_back(texturePath);
+                    textureSlots.push_back((Renderer::TexIdx)i);
+                }
+            }
+        }
+    }
+
+    std::atomic<u32> bakedTextureNum = 0;
+    JobSystem::GetInstance().ParallelFor(texturePaths.size(), 1, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+            const string& path = texturePaths[i];
+            const string source = GetRelativePath(path, root);
+            const u64 key = GetInputsKey({ path }, HashCombine(GetCompressedFormat(textureSlots[i]), settings.mipFilter));
+
+            if (database.IsCurrent(source, key)) {
+                ScratchScope scratch;
+                Renderer::TextureData baked;
+                if (LoadBakedTexture(path, textureSlots[i], baked))
+                    continue;
+            }
+            if (!BakeTexture(path, textureSlots[i], settings.mipFilter)) {
+                SDL_Log("Could not bake %s", source.c_str());
+                continue;
+            }
+            database.Set(source, key);
+            bakedTextureNum++;
+            SDL_Log("Baked %s", source.c_str());
+        }
+    });
+
+    if (!database.Save(databasePath))
+        Error("Could not write the bake database: " + databasePath);
+
+    SDL_Log(
+        "Baked %u/%zu models and %u/%zu textures in %.1f ms",
+        bakedModelNum.load(), modelPaths.size(),
+        bakedTextureNum.load(), texturePaths.size(),
+        timer.GetTime()
+    );
+    return 0;
+}